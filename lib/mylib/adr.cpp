@@ -0,0 +1,69 @@
+#include "adr.hpp"
+
+// Sensitivity of modes 1..16 in dBm: noise floor -174 + NF 6 + 10log10(BW)
+// plus the SNR limit of the SF (SF7 -7.5 dB .. SF12 -20 dB), rounded up.
+static const int16_t sensitivity[16] = {
+  -137, -134, -132, -131, -129, -128, -126, -123,
+  -121, -118, -139, -144, -143, -143, -134, -118};
+
+// Modes picked by ADR, fastest first. Each one is slower and more sensitive
+// than the previous one; modes that give less than 1 dB for more airtime
+// (5) or need a TCXO (7.8 kHz: 11, 12) are left out.
+static const uint8_t ladder[] = {10, 9, 8, 7, 6, 4, 3, 2, 1, 13};
+static const uint8_t LADDER_LEN = sizeof(ladder);
+
+void adr_init(adr_link *link, uint8_t mode){
+  link->level = 0;
+  link->samples = 0;
+  link->mode = mode;
+}
+
+void adr_sample(adr_link *link, int16_t rssi){
+  int16_t level = rssi * 4;
+
+  if(link->samples == 0 && link->level == 0){
+    link->level = level; // first packet ever
+  }
+  else if(level < link->level){
+    link->level -= (link->level - level) / 2; // fades are followed fast
+  }
+  else{
+    link->level += (level - link->level) / 4;
+  }
+  if(link->samples < 0xFF) link->samples++;
+}
+
+void adr_switch(adr_link *link, uint8_t mode){
+  link->mode = mode;
+  link->samples = 0;
+}
+
+uint8_t adr_pick(const adr_link *link){
+  int16_t level = link->level >> 2;
+  int16_t current = sensitivity[(link->mode - 1) & 0x0F];
+
+  if(link->samples == 0) return link->mode;
+  for(uint8_t i = 0; i < LADDER_LEN; i++){
+    int16_t sens = sensitivity[ladder[i] - 1];
+    int16_t need = sens + LORA_ADR_MARGIN;
+
+    if(sens > current){
+      // faster than the mode in use: only with some history and more margin
+      if(link->samples < LORA_ADR_SAMPLES) continue;
+      need += LORA_ADR_HYSTERESIS;
+    }
+    if(level >= need) return ladder[i];
+  }
+  return ladder[LADDER_LEN - 1];
+}
+
+uint8_t adr_encode(uint8_t mode){
+  for(uint8_t i = 0; i < LADDER_LEN; i++){
+    if(ladder[i] == mode) return i + 1;
+  }
+  return 0;
+}
+
+uint8_t adr_decode(uint8_t code){
+  return (code != 0 && code <= LADDER_LEN) ? ladder[code - 1] : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef ADR_HPP
+#define ADR_HPP
+
+#include <stdint.h>
+#include "definitions.hpp"
+
+// Adaptive data rate: picks the fastest mode of a fixed ladder whose
+// sensitivity stays LORA_ADR_MARGIN dB under the signal level of the latest
+// packets. Only arithmetic on the RSSI given by the caller, no radio access:
+// it runs the same on a PC fed with recorded or simulated levels.
+struct adr_link{
+  int16_t level;   // signal level in 1/4 dBm, moving average
+  uint8_t samples; // packets heard since the last switch, saturates at 255
+  uint8_t mode;    // mode in use, 1..16 as in setMode<>()
+};
+
+void adr_init(adr_link *link, uint8_t mode);
+void adr_sample(adr_link *link, int16_t rssi); // RSSI of a received packet (dBm)
+void adr_switch(adr_link *link, uint8_t mode); // the mode changed, samples start again
+uint8_t adr_pick(const adr_link *link);        // mode to use next, link->mode to stay
+
+// Ladder modes travel as a 4-bit code (in the ACK): 0 is no mode
+uint8_t adr_encode(uint8_t mode);
+uint8_t adr_decode(uint8_t code);              // 0 if the code is not valid
+
+#endif
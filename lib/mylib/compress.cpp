@@ -0,0 +1,79 @@
+#include "compress.hpp"
+
+// Entries of the dictionary, each one is its length followed by its bytes.
+// Code 0x80 + i is entry i, 0xFF is not used.
+static const char dict[] =
+  "\4 the" "\4the " "\4ing " "\4 and" "\4and " "\4tion" "\4 to " "\4 of "
+  "\4 you" "\4 is " "\3 a " "\3er " "\3ed " "\3es " "\2s " "\2e " "\2t "
+  "\2d " "\2n " "\2y " "\2r " "\2o " "\2, " "\2. " "\2? " "\2! " "\2th"
+  "\2he" "\2in" "\2er" "\2an" "\2re" "\2on" "\2at" "\2en" "\2nd" "\2ti"
+  "\2es" "\2or" "\2te" "\2of" "\2ed" "\2is" "\2it" "\2al" "\2ar" "\2st"
+  "\2to" "\2nt" "\2ng" "\2se" "\2ha" "\2as" "\2ou" "\2io" "\2le" "\2ve"
+  "\2co" "\2me" "\2de" "\2hi" "\2ri" "\2ro" "\2ic" "\2ne" "\2ea" "\2ra"
+  "\2ce" "\2li" "\2ch" "\2ll" "\2be" "\2ma" "\2si" "\2om" "\2ur" "\2ca"
+  "\2el" "\2ta" "\2la" "\2ns" "\2ge" "\2ly" "\2os" "\2no" "\2do" "\2pa"
+  "\2ac" "\2ot" "\2di" "\2tr" "\2sh" "\2wh" "\2ow" "\2ee" "\2oo" "\2ad"
+  "\2lo" "\2un" "\2ho" "\2ut" "\2us" "\2ai" "\2ay" "\2ir" "\2et" "\2il"
+  "\2em" "\2 t" "\2 a" "\2 s" "\2 w" "\2 i" "\2 o" "\2 c" "\2 b" "\2 m"
+  "\2 h" "\2 p" "\2 f" "\2 d" "\2 l" "\2 n" "\2ok" "\5hello" "\4lora" "\3msg";
+
+static const uint8_t DICT_ENTRIES = 127;
+
+// Longest dictionary entry matching 'in', 0 if none. '*code' gets its index
+static uint8_t dict_match(const uint8_t *in, uint8_t len, uint8_t *code){
+  const char *e = dict;
+  uint8_t best = 0;
+
+  for(uint8_t i = 0; i < DICT_ENTRIES; i++){
+    uint8_t n = (uint8_t)*e++;
+    if(n > best && n <= len){
+      uint8_t k = 0;
+      while(k < n && (uint8_t)e[k] == in[k]) k++;
+      if(k == n){
+        best = n;
+        *code = i;
+      }
+    }
+    e += n;
+  }
+  return best;
+}
+
+uint8_t text_compress(const uint8_t *in, uint8_t len, uint8_t *out, uint8_t out_max){
+  uint8_t pos = 0, sz = 0, code = 0;
+
+  while(pos < len){
+    if(in[pos] & 0x80) return 0;   // not ASCII, codes would be ambiguous
+    if(sz == out_max) return 0;
+
+    uint8_t n = dict_match(in + pos, len - pos, &code);
+    if(n > 1){
+      out[sz++] = 0x80 | code;
+      pos += n;
+    }
+    else out[sz++] = in[pos++];
+  }
+  return (sz < len) ? sz : 0;      // no gain: send raw
+}
+
+uint8_t text_decompress(const uint8_t *in, uint8_t len, uint8_t *out, uint8_t out_max){
+  uint8_t sz = 0;
+
+  for(uint8_t pos = 0; pos < len; pos++){
+    if(!(in[pos] & 0x80)){
+      if(sz == out_max) return 0;
+      out[sz++] = in[pos];
+      continue;
+    }
+
+    uint8_t code = in[pos] & 0x7F;
+    if(code >= DICT_ENTRIES) return 0;
+    const char *e = dict;
+    while(code--) e += (uint8_t)*e + 1;
+
+    uint8_t n = (uint8_t)*e++;
+    if(n > out_max - sz) return 0;
+    for(uint8_t k = 0; k < n; k++) out[sz++] = e[k];
+  }
+  return sz;
+}
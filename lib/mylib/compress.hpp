@@ -0,0 +1,18 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <stdint.h>
+
+// Static-dictionary coder for short ASCII text (chat lines from the UART).
+// Bytes below 0x80 are copied as they are, 0x80 + i stands for entry i of a
+// fixed table of common English fragments. No state and no RAM besides the
+// output buffer; the table (about 500 bytes) is in flash.
+
+// Returns the compressed length, 0 if the text has non-ASCII bytes, does not
+// fit in out_max or does not get shorter: then it is sent raw.
+uint8_t text_compress(const uint8_t *in, uint8_t len, uint8_t *out, uint8_t out_max);
+
+// Returns the text length, 0 if 'in' is not valid or does not fit in out_max.
+uint8_t text_decompress(const uint8_t *in, uint8_t len, uint8_t *out, uint8_t out_max);
+
+#endif
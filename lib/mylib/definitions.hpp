@@ -17,6 +17,11 @@
 
 	#define LORA_POWER  'I' // 'M'=20dbm - 'H'=14dbm - 'I'=8dbm - 'L'=2dbm
 
+	#define LORA_USE_DIO_IRQ  1 // 1 -> sleep until DIO0/DIO1 interrupt, 0 -> poll REG_IRQ_FLAGS over SPI
+
+	#define SX1278_REG_CACHE      1 // 1 -> serve static config registers from a RAM shadow, 0 -> always read over SPI
+	#define SX1278_VERIFY_WRITES  0 // 1 -> first read after a write goes to the bus (verify-after-write), 0 -> served from shadow
+
 	#ifdef LORA_SEND
 		#define LORA_ADDRESS  				2
 		#define LORA_SEND_TO_ADDRESS  4
@@ -26,17 +31,67 @@
 	#endif
 #endif
 
+#define RX_QUEUE_LEN      5 // frames buffered in RAM while the radio keeps receiving (RX_FRAME_MAX + 1 bytes each)
+#define RX_FRAME_MAX      115 // longest frame kept in the RX queue: 5-byte header + the 110-byte my_packet of main.cpp. Longer ones are dropped
+#define LORA_WINDOW_SIZE  4 // packets in flight in windowed (selective repeat) mode, 1..8
+#define LORA_COMPACT_HEADER 0 // 1: 4-byte frame header (flags instead of length and retry byte), varint message number. Same on both ends
+#define LORA_IMPLICIT_ACK 0 // 1: ACKs are sent with an implicit LoRa header (fixed length, no PHY header symbols). Same on both ends
+#define TEXT_COMPRESSION  0 // 1: UART text is sent coded with text_compress() when it gets shorter (PAYLOAD_COMPRESSED flag). Same on both ends
+#define COMPRESS_BENCHMARK 0 // 1 -> print ratio and encode/decode time of text_compress() over sample chat lines at startup
+#define LORA_ADR          0 // 1: the ACK carries a mode picked from the RSSI/SNR of the packet, both ends switch after the exchange. Same on both ends
+#define LORA_ADR_MARGIN   10 // dB kept between the signal level and the sensitivity of the mode picked
+#define LORA_ADR_HYSTERESIS 3 // extra dB needed to move to a faster mode
+#define LORA_ADR_SAMPLES  2 // packets heard in a mode before a faster one is picked
+#define LORA_ADR_FALLBACK_MS 30000 // back to LORA_MODE after this long without a packet or ACK (ms)
+#define LORA_POWER_CONTROL 0 // 1: ACKs report the SNR of the packet, the sender lowers its power per peer to keep LORA_TPC_MARGIN. Same on both ends
+#define LORA_TPC_MARGIN   10 // dB kept between the SNR at the peer and the SNR limit of the spreading factor
+#define LORA_TPC_HYSTERESIS 4 // dB over the margin before the power is lowered
+#define LORA_TPC_MAX_DBM  17 // power of a new peer and after a send without ACK (2..17, 20 needs the PA_DAC boost)
+#define LORA_TPC_PEERS    4 // peers with their own power level, the oldest entry is reused
+#define LORA_CSMA         0 // 1: listen before talk, a CAD before each data packet and a random backoff while the channel is busy
+#define LORA_CSMA_ATTEMPTS 8 // busy CADs before a send gives up (state 10)
+#define LORA_CSMA_MAX_BE  5 // backoff exponent limit: 0 .. 2^BE - 1 slots of one packet time-on-air
+#define LORA_DUTY_CYCLE   0 // 1: every transmission is charged its time-on-air, data packets wait while the sliding window budget is used
+#define LORA_DUTY_PERMILLE 100 // airtime budget in 1/1000 of the window (433.05-434.79 MHz SRD band: 10%)
+#define LORA_DUTY_WINDOW_S 3600 // sliding window of the budget (s)
+#define LORA_DUTY_BUCKETS 12 // the window is kept in this many buckets, older airtime is freed one bucket at a time
+#define LORA_DUTY_MAX_DEFER_MS 60000 // longest wait for budget, a send that would wait longer fails (state 11)
+#define LORA_LOW_POWER_RX 0 // 1: the idle radio sleeps and wakes for a CAD every LORA_LPRX_INTERVAL_MS, full Rx only on a preamble; data packets are sent with a preamble longer than the interval (same setting on both ends)
+#define LORA_LPRX_INTERVAL_MS 1000 // sleep between two CADs (ms): longer saves receiver current (CAD time / interval) but delays packets and lengthens every data packet by about this much airtime
+#define LORA_PREAMBLE 8 // preamble of ACKs and of all packets without LORA_LOW_POWER_RX (symbols, module default)
+#define LORA_ACK_GUARD_MS 20 // margin added to time-on-air for Tx/Rx turnaround and ACK waits (ms)
+
 #define MCO_OUT_PORT      GPIOA
 #define MCO_OUT_PIN       GPIO8
 
-#define SPI_SCK_PORT      GPIOB
-#define SPI_SCK_PIN       GPIO7
+#define SPI_BACKEND       0 // 0 -> bit-bang on the pins below, 1 -> SPI1 peripheral + DMA (SCK PA5, MISO PA6, MOSI PA7)
+#define SPI_BENCHMARK     0 // 1 -> print register and FIFO burst timings of the SPI backend at startup
+#define SPI_CORE_CLOCK_HZ 48000000 // core clock set by init_clock(), paces the bit-bang SCK
+#define SPI_MAX_CLOCK_HZ  10000000 // SX1278 SCK limit
+#define SPI_DMA_MIN       8 // SPI_BACKEND 1: shorter bursts are polled, DMA setup costs more than it saves
+
+#if SPI_BACKEND == 0
+	#define SPI_SCK_PORT      GPIOB
+	#define SPI_SCK_PIN       GPIO7
+
+	#define SPI_MISO_PORT     GPIOB
+	#define SPI_MISO_PIN      GPIO6
+
+	#define SPI_MOSI_PORT     GPIOB
+	#define SPI_MOSI_PIN      GPIO5
+#else
+	// SPI1 AF0 pins of the STM32F042
+	#define SPI_SCK_PORT      GPIOA
+	#define SPI_SCK_PIN       GPIO5
 
-#define SPI_MISO_PORT     GPIOB
-#define SPI_MISO_PIN      GPIO6
+	#define SPI_MISO_PORT     GPIOA
+	#define SPI_MISO_PIN      GPIO6
 
-#define SPI_MOSI_PORT     GPIOB
-#define SPI_MOSI_PIN      GPIO5
+	#define SPI_MOSI_PORT     GPIOA
+	#define SPI_MOSI_PIN      GPIO7
+
+	#define SPI_AF            GPIO_AF0
+#endif
 
 #define SPI_NSS_PORT      GPIOB
 #define SPI_NSS_PIN       GPIO4
@@ -44,6 +99,17 @@
 #define LED_PORT          GPIOB
 #define LED_PIN           GPIO3
 
+// SX1278 DIO0 (TxDone/RxDone/CadDone) and DIO1 (RxTimeout/CadDetected)
+#define LORA_DIO0_PORT    GPIOA
+#define LORA_DIO0_PIN     GPIO0
+#define LORA_DIO0_EXTI    EXTI0
+
+#define LORA_DIO1_PORT    GPIOA
+#define LORA_DIO1_PIN     GPIO1
+#define LORA_DIO1_EXTI    EXTI1
+
+#define LORA_DIO_NVIC     NVIC_EXTI0_1_IRQ
+
 // USART RELATED DEFINITIONS //
 #define DEBUG_USART USART1
 #define DEBUG_USART_RCC RCC_USART1
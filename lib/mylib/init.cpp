@@ -6,6 +6,7 @@
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/exti.h>
 #include <libopencm3/cm3/nvic.h>
 
 #include "system_functions.hpp"
@@ -23,12 +24,8 @@ void init_gpio(){
 	rcc_periph_clock_enable(RCC_GPIOA);
 	rcc_periph_clock_enable(RCC_GPIOB);
 
-	gpio_mode_setup(SPI_SCK_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_SCK_PIN);
-	gpio_mode_setup(SPI_MISO_PORT, GPIO_MODE_INPUT, GPIO_PUPD_NONE, SPI_MISO_PIN);
-	gpio_mode_setup(SPI_MOSI_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_MOSI_PIN);
-	gpio_mode_setup(SPI_NSS_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_NSS_PIN);
+	spi_setup(); // SPI pins, and SPI1 + DMA with SPI_BACKEND 1
 	gpio_mode_setup(LED_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, LED_PIN);
-	unselect_chip();
 }
 
 void init_usart(){
@@ -124,3 +121,25 @@ void init_timer(){
 		send_debug("Init TIM3 Done!");
 	#endif
 }
+
+void init_exti(){
+	rcc_periph_clock_enable(RCC_SYSCFG_COMP);
+
+	gpio_mode_setup(LORA_DIO0_PORT, GPIO_MODE_INPUT, GPIO_PUPD_PULLDOWN, LORA_DIO0_PIN);
+	gpio_mode_setup(LORA_DIO1_PORT, GPIO_MODE_INPUT, GPIO_PUPD_PULLDOWN, LORA_DIO1_PIN);
+
+	// DIO lines go high when the mapped IRQ flag is set and low when it is cleared
+	exti_select_source(LORA_DIO0_EXTI, LORA_DIO0_PORT);
+	exti_set_trigger(LORA_DIO0_EXTI, EXTI_TRIGGER_RISING);
+	exti_enable_request(LORA_DIO0_EXTI);
+
+	exti_select_source(LORA_DIO1_EXTI, LORA_DIO1_PORT);
+	exti_set_trigger(LORA_DIO1_EXTI, EXTI_TRIGGER_RISING);
+	exti_enable_request(LORA_DIO1_EXTI);
+
+	nvic_enable_irq(LORA_DIO_NVIC);
+
+	#if DEBUG_MODE
+		send_debug("Init EXTI Done!");
+	#endif
+}
@@ -9,5 +9,6 @@ void init_usart();
 void init_systick();
 void init_mco();
 void init_timer();
+void init_exti();
 
 #endif
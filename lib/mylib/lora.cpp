@@ -3,6 +3,7 @@
 #include "definitions.hpp"
 #include "spi.hpp"
 #include "uart.hpp"
+#include "rx_queue.hpp"
 
 
 void init_lora(){
@@ -10,79 +11,91 @@ void init_lora(){
 	spi_write8(RegOpMode_ADR, 0x80 | (1 << 3)); // LoRa sleep mode
 	spi_write8(RegOpMode_ADR, 0x81 | (1 << 3)); // LoRa standby mode
 
-	spi_write8(RegMaxPayloadLength_ADR, 0x80);
+	SpiBatch batch;
+	batch.write(RegMaxPayloadLength_ADR, 0x80);
 
-	spi_write8(RegIrqFlagsMask_ADR, 0b10010111);
+	batch.write(RegIrqFlagsMask_ADR, 0b10010111);
 
-	// Set RegModemConfig1 to Default values
-	spi_write8(RegModemConfig1_ADR, 0x72);
-	// Set RegModemConfig2 to Default values
-	spi_write8(RegModemConfig2_ADR, 0x70);
-	// Set RegModemConfig2 to Default values
-	spi_write8(RegModemConfig3_ADR, 0x00);
+	// Set RegModemConfig1..3 to Default values
+	batch.write(RegModemConfig1_ADR, 0x72);
+	batch.write(RegModemConfig2_ADR, 0x70);
+	batch.write(RegModemConfig3_ADR, 0x00);
+	batch.flush();
 
 #if DEBUG_MODE
 	send_debug("Init LORA Done!");
 #endif
 }
 
+// Copies rx_nb_bytes of the FIFO from rx_adr to the RX queue
+static void queue_fifo(uint8_t rx_adr, uint8_t rx_nb_bytes){
+	rx_frame *frame = rx_queue_push(rx_nb_bytes);
+	if(frame){
+		// FifoAddrPtr wraps from 0xFF to 0x00 by itself
+		spi_write8(RegFifoAddrPtr_ADR, rx_adr);
+		spi_read(RegFifo_ADR, rx_nb_bytes, frame->data);
+		frame->sz = rx_nb_bytes;
+		rx_queue_commit();
+	}
+	else send_error("RX Queue Full!!");
+}
+
 void lora_cont_recv(){
-	spi_write8(RegFifoAddrPtr_ADR, 0x00);
-	spi_write8(RegFifoRxBaseAddr_ADR, 0x00);
-	spi_write8(RegFifoRxByteAddr_ADR, 0x00);
+	uint8_t rx_tail = 0x00; // FIFO address after the last frame queued
+
+	// FifoTxBaseAddr too, so the three FIFO pointers go out in one burst
+	SpiBatch batch;
+	batch.write(RegFifoAddrPtr_ADR, 0x00);
+	batch.write(RegFifoTxBaseAddr_ADR, 0x00);
+	batch.write(RegFifoRxBaseAddr_ADR, 0x00);
+	batch.write(RegFifoRxByteAddr_ADR, 0x00);
+	batch.flush();
 	spi_write8(RegOpMode_ADR, 0x85 | (1 << 3)); // selecting LoRa mode and RXCONT
 
 	while(true){
 		uint8_t irq = spi_read8(RegIrqFlags_ADR);
 		if (irq & (1 << 6)){
-			send_debug("Data Received!!");
-			if (irq & (1 << 5))
-				send_error("CRC Error!!");
-
+			// the pointers first: a packet ending before the flags are
+			// cleared is then found from rx_tail on the next RxDone
+			uint8_t rx_curr_adr = spi_read8(FifoRxCurrentAddr_ADR);
 			uint8_t rx_nb_bytes = spi_read8(RegRxNbBytes_ADR);
-			//uint8_t rx_curr_adr = spi_read8(FifoRxCurrentAddr_ADR);
-			//spi_write8(RegFifoAddrPtr_ADR, rx_curr_adr);
-			spi_write8(RegFifoAddrPtr_ADR, 0x00);
-
-			uint8_t recv_data[0xFF];
-			//spi_read(RegFifo_ADR, rx_nb_bytes, recv_data);
-			for(int i = 0; i < rx_nb_bytes; i++) recv_data[i] = spi_read8(RegFifo_ADR);
-			spi_write8(RegFifoAddrPtr_ADR, 0x00);
 
-			for(int i = 0; i < rx_nb_bytes; i++)
-				send_char(recv_data[i]);
-
-			/* DELETE LATER */
-			/*spi_write8(RegFifoAddrPtr_ADR, 0x80);
-			uint8_t recv_data[0x80];
-			spi_read(RegFifo_ADR, 0x80, recv_data);
-			spi_write8(RegFifoAddrPtr_ADR, 0x80); // NOTE: base RX addr
-			for(int i = 0; i < 0x80; i++)
-				send_char(recv_data[i]);*/
+			// clear only the rx flags, the radio stays in RXCONT and keeps
+			// writing new packets after this one (the FIFO is a ring)
+			spi_write8(RegIrqFlags_ADR, (1 << 6) | (1 << 5) | (1 << 4));
 
+			if (irq & (1 << 5))
+				send_error("CRC Error!!"); // the earlier packets too, the failed one is not known
+			else{
+				// packets that ended while this loop was printing, their
+				// frames carry no length so they are queued together
+				if(rx_tail != rx_curr_adr)
+					queue_fifo(rx_tail, rx_curr_adr - rx_tail);
+				queue_fifo(rx_curr_adr, rx_nb_bytes);
+			}
+			rx_tail = rx_curr_adr + rx_nb_bytes;
+		}
 
+		// one frame per turn, so the radio is checked again between slow uart prints
+		rx_frame *frame = rx_queue_front();
+		if(frame){
+			send_debug("Data Received!!");
+			for(int i = 0; i < frame->sz; i++)
+				send_char(frame->data[i]);
 			send_data("\r\n");
 			send_data("\r\n");
-
-			spi_write8(RegIrqFlags_ADR, 0xFF);
+			rx_queue_pop();
 		}
-		/*else{
-			send_int(irq);
-			send_data(" - ");
-			uint8_t op_mode = spi_read8(RegOpMode_ADR);
-			send_int(op_mode);
-			send_data("\r\n");
-
-			wait_with_timer2(100); // 10ms wait
-		}*/
 	}
 }
 
 void lora_send(uint8_t sz, uint8_t *data){
 	//send_debug("LoRa Send Start!!");
 	spi_write8(RegOpMode_ADR, 0x81 | (1 << 3)); // selecting LoRa mode and Standby
-	spi_write8(RegFifoAddrPtr_ADR, 0x00);
-	spi_write8(RegFifoTxBaseAddr_ADR, 0x00);
+	SpiBatch batch;
+	batch.write(RegFifoAddrPtr_ADR, 0x00);
+	batch.write(RegFifoTxBaseAddr_ADR, 0x00);
+	batch.flush();
 	for(int i = 0; i < sz; i++) spi_write8(RegFifo_ADR, data[i]);
 	//spi_write(RegFifo_ADR, sz, data);
 	spi_write8(RegPayloadLength_ADR, sz);
@@ -44,6 +44,69 @@ SX1278::SX1278()
 	_retries = 0;
 	_maxRetries = 3;
 	packet_sent.retry = _retries;
+	packet_sent.data = 0;
+	_iovCount = 0;
+	_payloadFlags = 0;
+	packet_received.data = 0;
+	_rxBufferSize = 0;
+	_irqPending = 0;
+	_dioMapping = DIO_MAPPING_RX;
+	_async.step = ASYNC_IDLE;
+	_async.wait = 0;
+	_async.previous = 0;
+	_async.callback = 0;
+	_async.duplicate = false;
+	_savedTransactions = 0;
+	_rxTail = 0;
+	_rxCrcErrors = 0;
+	_rxLost = 0;
+	_fifoValid = false;
+	_fifoTxBase = 0;
+	_windowSize = LORA_WINDOW_SIZE;
+	_win.count = 0;
+	_winPeer = BROADCAST_0;
+	_winHigh = 0;
+	_winSeen = 0;
+	_winMsg = 0;
+	_winMsgSize = 0;
+	_winMsgFilled = 0;
+	_winMsgLength = 0;
+	#if LORA_DUTY_CYCLE
+		for( uint8_t i = 0; i < DUTY_SLOTS; i++ )
+		{
+			_airtime.bucket[i] = 0;
+		}
+		_airtime.head = 0;
+		_airtime.headStart = 0;
+		_airtime.totalMs = 0;
+		_airtime.deferred = 0;
+		_airtime.rejected = 0;
+	#endif
+	#if LORA_LOW_POWER_RX
+		_listen = LISTEN_OFF;
+		_listenSince = 0;
+	#endif
+	#if LORA_CSMA
+		_csma.random = 0;
+		_csma.cads = 0;
+		_csma.busy = 0;
+		_csma.dropped = 0;
+		_csma.collisions = 0;
+		_csma.backoffMs = 0;
+	#endif
+	#if LORA_POWER_CONTROL
+		for( uint8_t i = 0; i < LORA_TPC_PEERS; i++ )
+		{
+			_peers[i].address = BROADCAST_0;
+		}
+		_peerNext = 0;
+	#endif
+	#if LORA_ADR
+		adr_init(&_adr, LORA_MODE);
+		_adrOffer = 0;
+		_adrHeard = 0;
+	#endif
+	invalidateCache();
 };
 
 // PRIVATE FUNCTION //
@@ -80,6 +143,9 @@ uint8_t SX1278::ON()
 	// Powering the module
   unselect_chip();
 
+	// The module may have been reset, nothing shadowed can be trusted
+	invalidateCache();
+
 	// Set Maximum Over Current Protection
 	state = setMaxCurrent(0x1B);
 
@@ -129,7 +195,31 @@ void SX1278::OFF()
 */
 uint8_t SX1278::readRegister(uint8_t address)
 {
-  uint8_t value = spi_read8(address);
+  uint8_t value;
+
+	#if SX1278_REG_CACHE
+		if( regCached(address) && bitRead(_shadowValid[address >> 3], address & 0x07)
+			&& bitRead(_shadowVerified[address >> 3], address & 0x07) )
+		{
+			_savedTransactions++;
+			return _shadow[address];
+		}
+	#endif
+
+  value = spi_read8(address);
+
+	#if SX1278_REG_CACHE
+		if( address == REG_OP_MODE )
+		{
+			cacheOpMode(value);
+		}
+		else if( regCached(address) )
+		{
+			_shadow[address] = value;
+			bitSet(_shadowValid[address >> 3], address & 0x07);
+			bitSet(_shadowVerified[address >> 3], address & 0x07);
+		}
+	#endif
 
   #if (SX1278_debug_mode > 2)
     Serial.print("## Reading:  ##\t");
@@ -152,8 +242,40 @@ uint8_t SX1278::readRegister(uint8_t address)
 */
 void SX1278::writeRegister(uint8_t address, uint8_t data)
 {
+	#if SX1278_REG_CACHE
+		// The register already holds this value, nothing to write
+		if( regCached(address) && bitRead(_shadowValid[address >> 3], address & 0x07)
+			&& bitRead(_shadowVerified[address >> 3], address & 0x07) && (_shadow[address] == data) )
+		{
+			_savedTransactions++;
+			return;
+		}
+	#endif
+
 	spi_write8(address, data);
 
+	if( (address == REG_OP_MODE) && ((data & 0x07) == 0x00) )
+	{
+		_fifoValid = false;	// FIFO is cleared in sleep mode
+	}
+
+	#if SX1278_REG_CACHE
+		if( address == REG_OP_MODE )
+		{
+			cacheOpMode(data);
+		}
+		else if( regCached(address) )
+		{
+			_shadow[address] = data;
+			bitSet(_shadowValid[address >> 3], address & 0x07);
+			#if SX1278_VERIFY_WRITES
+				bitClear(_shadowVerified[address >> 3], address & 0x07);
+			#else
+				bitSet(_shadowVerified[address >> 3], address & 0x07);
+			#endif
+		}
+	#endif
+
   #if (SX1278_debug_mode > 2)
     Serial.print("## Writing:  ##\t");
 		Serial.print("Register ");
@@ -166,6 +288,241 @@ void SX1278::writeRegister(uint8_t address, uint8_t data)
 
 }
 
+/*
+ Function: Writes consecutive registers in a single burst (one chip select,
+ one address byte) and updates their shadow. The range must not include
+ REG_OP_MODE.
+ Returns: Nothing
+ Parameters:
+   address: first register to write in
+   data: values to write
+   length: number of registers
+*/
+void SX1278::writeRegisters(uint8_t address, uint8_t *data, uint8_t length)
+{
+	spi_write(address, length, data);
+
+	#if SX1278_REG_CACHE
+		for(uint8_t i = 0; i < length; i++, address++)
+		{
+			if( regCached(address) )
+			{
+				_shadow[address] = data[i];
+				bitSet(_shadowValid[address >> 3], address & 0x07);
+				#if SX1278_VERIFY_WRITES
+					bitClear(_shadowVerified[address >> 3], address & 0x07);
+				#else
+					bitSet(_shadowVerified[address >> 3], address & 0x07);
+				#endif
+			}
+		}
+	#endif
+}
+
+/*
+ Function: Writes a batch of registers with one burst per run of consecutive
+ addresses. Entries the shadow already holds are dropped, and a single
+ register gap between two runs is filled with its shadowed value so both
+ runs go out in one transaction. The batch is empty on return.
+ Returns: the number of SPI transactions used
+ Parameters:
+   batch: register writes (not REG_OP_MODE)
+*/
+uint8_t SX1278::writeBatch(SpiBatch &batch)
+{
+	uint8_t cycles = 0;
+	uint8_t i, n;
+
+	#if SX1278_REG_CACHE
+		uint8_t gap;
+
+		for(i = 0; i < batch._count; )
+		{
+			gap = batch._reg[i];
+			if( regCached(gap) && bitRead(_shadowValid[gap >> 3], gap & 0x07)
+				&& bitRead(_shadowVerified[gap >> 3], gap & 0x07) && (_shadow[gap] == batch._value[i]) )
+			{
+				batch.remove(i);
+				_savedTransactions++;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		// Two bytes of a known value are cheaper than a chip select and an address byte
+		for(i = 0; i + 1 < batch._count; i++)
+		{
+			gap = batch._reg[i] + 1;
+			if( (batch._reg[i + 1] == gap + 1) && regCached(gap)
+				&& bitRead(_shadowValid[gap >> 3], gap & 0x07)
+				&& bitRead(_shadowVerified[gap >> 3], gap & 0x07) )
+			{
+				batch.write(gap, _shadow[gap]);
+			}
+		}
+	#endif
+
+	for(i = 0; i < batch._count; i += n)
+	{
+		n = batch.run(i);
+		writeRegisters(batch._reg[i], &batch._value[i], n);
+		cycles++;
+	}
+	batch.clear();
+	return cycles;
+}
+
+/*
+ Function: Reads consecutive registers in a single burst and refreshes their
+ shadow. It always goes to the bus, so it can verify a writeRegisters().
+ Returns: Nothing
+ Parameters:
+   address: first register to read from
+   data: buffer to store the values read
+   length: number of registers
+*/
+void SX1278::readRegisters(uint8_t address, uint8_t *data, uint8_t length)
+{
+	spi_read(address, length, data);
+
+	#if SX1278_REG_CACHE
+		for(uint8_t i = 0; i < length; i++, address++)
+		{
+			if( regCached(address) )
+			{
+				_shadow[address] = data[i];
+				bitSet(_shadowValid[address >> 3], address & 0x07);
+				bitSet(_shadowVerified[address >> 3], address & 0x07);
+			}
+		}
+	#endif
+}
+
+/*
+ Function: Forgets every shadowed register value. Until REG_OP_MODE is
+ written or read again the paged registers are not shadowed either.
+ Returns: Nothing
+*/
+void SX1278::invalidateCache()
+{
+	for(uint8_t i = 0; i < REG_CACHE_SIZE / 8; i++)
+	{
+		_shadowValid[i] = 0;
+		_shadowVerified[i] = 0;
+	}
+	_cacheOpMode = FSK_SLEEP_MODE;
+}
+
+/*
+ Function: Tells if the value of a register only changes when the driver
+ writes it, so its shadow copy can be used instead of an SPI read.
+ Returns: true if the register is shadowed, false otherwise
+ Parameters:
+   address: register address
+*/
+bool SX1278::regCached(uint8_t address)
+{
+	// 0x0D..0x3F are different registers in the FSK page
+	if( (address >= REG_FIFO_ADDR_PTR) && (address < REG_DIO_MAPPING1)
+		&& ((_cacheOpMode & 0xC0) != 0x80) )
+	{
+		return false;
+	}
+
+	switch( address )
+	{
+		case REG_OP_MODE:
+		case REG_FRF_MSB:
+		case REG_FRF_MID:
+		case REG_FRF_LSB:
+		case REG_PA_CONFIG:
+		case REG_PA_RAMP:
+		case REG_OCP:
+		case REG_FIFO_TX_BASE_ADDR:
+		case REG_FIFO_RX_BASE_ADDR:
+		case REG_IRQ_FLAGS_MASK:
+		case REG_MODEM_CONFIG1:
+		case REG_MODEM_CONFIG2:
+		case REG_SYMB_TIMEOUT_LSB:
+		case REG_PREAMBLE_MSB_LORA:
+		case REG_PREAMBLE_LSB_LORA:
+		case REG_PAYLOAD_LENGTH_LORA:
+		case REG_MAX_PAYLOAD_LENGTH:
+		case REG_HOP_PERIOD:
+		case REG_MODEM_CONFIG3:
+		case REG_DETECT_OPTIMIZE:
+		case REG_INVERT_IQ:
+		case REG_DETECTION_THRESHOLD:
+		case REG_SYNC_WORD:
+		case REG_DIO_MAPPING1:
+		case REG_DIO_MAPPING2:
+		case REG_VERSION:
+		case REG_TCXO:
+		case REG_PA_DAC:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ Function: Updates the shadow of REG_OP_MODE. TX, CAD and single RX go
+ back to standby by themselves, so only sleep, standby and continuous RX
+ are shadowed. Switching between LoRa and FSK drops the whole shadow.
+ Returns: Nothing
+ Parameters:
+   value: REG_OP_MODE value written or read
+*/
+void SX1278::cacheOpMode(uint8_t value)
+{
+	uint8_t mode = value & 0x07;
+
+	if( (value ^ _cacheOpMode) & 0x80 )
+	{
+		invalidateCache();
+	}
+	_cacheOpMode = value;
+
+	if( (mode == 0x00) || (mode == 0x01) || (mode == 0x05) )
+	{
+		// sleep, standby or continuous RX
+		_shadow[REG_OP_MODE] = value;
+		bitSet(_shadowValid[REG_OP_MODE >> 3], REG_OP_MODE & 0x07);
+		bitSet(_shadowVerified[REG_OP_MODE >> 3], REG_OP_MODE & 0x07);
+	}
+	else
+	{
+		bitClear(_shadowValid[REG_OP_MODE >> 3], REG_OP_MODE & 0x07);
+	}
+}
+
+/*
+ Function: Writes a block of bytes in the FIFO with a single chip select.
+ Returns: Nothing
+ Parameters:
+   data: bytes to write
+   length: number of bytes to write
+*/
+void SX1278::writeFifo(uint8_t *data, uint8_t length)
+{
+	spi_write(REG_FIFO, length, data);
+	_fifoValid = false;	// 'packet_sent' may have been overwritten
+}
+
+/*
+ Function: Reads a block of bytes from the FIFO with a single chip select.
+ Returns: Nothing
+ Parameters:
+   data: buffer to store the bytes read
+   length: number of bytes to read
+*/
+void SX1278::readFifo(uint8_t *data, uint8_t length)
+{
+	spi_read(REG_FIFO, length, data);
+}
+
 /*
  * Function: Clears the interruption flags
  *
@@ -189,6 +546,7 @@ void SX1278::clearFlags()
 		writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
 		// LoRa mode flags register
 		writeRegister(REG_IRQ_FLAGS, 0xFF);
+		_irqPending = 0;
 		// Getting back to previous status
 		writeRegister(REG_OP_MODE, st0);
 
@@ -214,6 +572,92 @@ void SX1278::clearFlags()
 	}
 }
 
+/*
+ Function: Routes the LoRa interruptions to the DIO lines.
+ Returns: Nothing
+ Parameters:
+   mapping: value for REG_DIO_MAPPING1
+*/
+void SX1278::setDioMapping(uint8_t mapping)
+{
+	writeRegister(REG_DIO_MAPPING1, mapping);
+	_dioMapping = mapping;
+}
+
+/*
+ Function: Latches the interruption flag signalled on a DIO line. It only
+ touches RAM, so it is safe to call from the EXTI handler.
+ Returns: Nothing
+ Parameters:
+   dio: DIO line that had a rising edge (0 or 1)
+*/
+void SX1278::dioInterrupt(uint8_t dio)
+{
+	// DioXMapping = 00, 01, 10, 11
+	static const uint8_t dio0_flags[4] = { IRQ_RX_DONE, IRQ_TX_DONE, IRQ_CAD_DONE, 0 };
+	static const uint8_t dio1_flags[4] = { IRQ_RX_TIMEOUT, IRQ_FHSS_CHANGE_CHANNEL, IRQ_CAD_DETECTED, 0 };
+
+	if( dio == 0 )
+	{
+		_irqPending |= dio0_flags[(_dioMapping >> 6) & 0x03];
+	}
+	else if( dio == 1 )
+	{
+		_irqPending |= dio1_flags[(_dioMapping >> 4) & 0x03];
+	}
+}
+
+/*
+ Function: Waits until one of the flags in 'mask' is raised or the timeout
+ expires. With LORA_USE_DIO_IRQ the core sleeps with WFI until the DIO line
+ fires (systick still wakes it every tick for the timeout), so the bus stays
+ quiet for the whole time-on-air. REG_IRQ_FLAGS is read once at the end.
+ Returns: REG_IRQ_FLAGS value
+ Parameters:
+   mask: REG_IRQ_FLAGS bits to wait for
+   wait: timeout in ms
+*/
+uint8_t SX1278::waitIrq(uint8_t mask, uint32_t wait)
+{
+	uint8_t value;
+	unsigned long previous = millis();
+
+	#if LORA_USE_DIO_IRQ
+		while( ((_irqPending & mask) == 0) && (millis() - previous < wait) )
+		{
+			// WFI still wakes on an interrupt that arrives while masked, so
+			// an edge between the check and the sleep is not lost
+			disable_interrupts();
+			if( (_irqPending & mask) == 0 )
+			{
+				wait_for_interrupt();
+			}
+			enable_interrupts();
+
+			// Condition to avoid an overflow (DO NOT REMOVE)
+			if( millis() < previous )
+			{
+				previous = millis();
+			}
+		}
+		value = readRegister(REG_IRQ_FLAGS);
+	#else
+		value = readRegister(REG_IRQ_FLAGS);
+		while( ((value & mask) == 0) && (millis() - previous < wait) )
+		{
+			value = readRegister(REG_IRQ_FLAGS);
+
+			// Condition to avoid an overflow (DO NOT REMOVE)
+			if( millis() < previous )
+			{
+				previous = millis();
+			}
+		}
+	#endif
+
+	return value;
+}
+
 /*
  Function: Sets the module in LoRa mode.
  Returns:  Integer that determines if there has been any error
@@ -235,14 +679,13 @@ uint8_t SX1278::setLORA()
 	writeRegister(REG_OP_MODE, LORA_SLEEP_MODE);    // LoRa sleep mode
 	writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);	// LoRa standby mode
 
-	writeRegister(REG_MAX_PAYLOAD_LENGTH,MAX_LENGTH);
-
-	// Set RegModemConfig1 to Default values
-	writeRegister(REG_MODEM_CONFIG1, 0x72);
-	// Set RegModemConfig2 to Default values
-	writeRegister(REG_MODEM_CONFIG2, 0x70);
-	// Set RegModemConfig2 to Default values
-	writeRegister(REG_MODEM_CONFIG3, 0x00);
+	SpiBatch batch;
+	batch.write(REG_MAX_PAYLOAD_LENGTH,MAX_LENGTH);
+	// Set RegModemConfig1..3 to Default values
+	batch.write(REG_MODEM_CONFIG1, 0x72);
+	batch.write(REG_MODEM_CONFIG2, 0x70);
+	batch.write(REG_MODEM_CONFIG3, 0x00);
+	writeBatch(batch);
 
 	//wait_with_timer2(100);
 
@@ -286,6 +729,11 @@ uint8_t SX1278::setFSK()
 		Serial.println("Starting 'setFSK'");
 	#endif
 
+	#if LORA_COMPACT_HEADER
+		// The compact header takes the length from REG_RX_NB_BYTES, LoRa only
+		return 1;
+	#endif
+
 	writeRegister(REG_OP_MODE, FSK_SLEEP_MODE);	// Sleep mode (mandatory to change mode)
 	writeRegister(REG_OP_MODE, FSK_STANDBY_MODE);	// FSK standby mode
 	config1 = readRegister(REG_PACKET_CONFIG1);
@@ -382,6 +830,40 @@ uint8_t SX1278::getMode()
 	return state;
 }
 
+/*
+ Function: Sets the mode given at run time, for a mode number that is not a
+ constant (ADR, a command). Each case is setMode<mode>().
+ Returns: Integer that determines if there has been any error
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+   state = -1 --> There is no such mode
+ Parameters:
+   mode: mode number 1..16
+*/
+int8_t SX1278::setModeNum(uint8_t mode)
+{
+	switch( mode )
+	{
+		case 1: return setMode<1>();
+		case 2: return setMode<2>();
+		case 3: return setMode<3>();
+		case 4: return setMode<4>();
+		case 5: return setMode<5>();
+		case 6: return setMode<6>();
+		case 7: return setMode<7>();
+		case 8: return setMode<8>();
+		case 9: return setMode<9>();
+		case 10: return setMode<10>();
+		case 11: return setMode<11>();
+		case 12: return setMode<12>();
+		case 13: return setMode<13>();
+		case 14: return setMode<14>();
+		case 15: return setMode<15>();
+		case 16: return setMode<16>();
+		default: return -1;
+	}
+}
+
 /*
  Function: Indicates if module is configured in implicit or explicit header mode.
  Returns: Integer that determines if there has been any error
@@ -1745,9 +2227,10 @@ int8_t	SX1278::setCR(uint8_t cod)
 }
 
 /*
- Function: Checks if channel is a valid value.
- Returns: bool that's 'true' if the CR value exists and
-		  it's 'false' if the CR value does not exist.
+ Function: Checks if channel is a valid value, i.e. an FRF value in the
+ FREQ_MIN .. FREQ_MAX band.
+ Returns: bool that's 'true' if the channel is in the band and
+		  it's 'false' otherwise.
  Parameters:
    ch: frequency channel value to check.
 */
@@ -1758,65 +2241,16 @@ bool	SX1278::isChannel(uint32_t ch)
 	  Serial.println("Starting 'isChannel'");
   #endif
 
-  // Checking available values for _channel
-  switch(ch)
+  // Any FRF value of the SX1278 band, CH_* and generated plans included
+  if( (ch < freqToFrf(FREQ_MIN)) || (ch > freqToFrf(FREQ_MAX)) )
   {
-	  case CH_1_BW_500:
-	  case CH_2_BW_500: // same value that CH_7_BW_125
-	  case CH_3_BW_500:
-
-	  case CH_1_BW_250:
-	  case CH_2_BW_250:
-	  case CH_3_BW_250:
-	  case CH_4_BW_250:
-	  case CH_5_BW_250:
-	  case CH_6_BW_250:
-
-	  case CH_1_BW_125:
-	  case CH_2_BW_125:
-	  case CH_3_BW_125:
-	  case CH_4_BW_125:
-	  case CH_5_BW_125:
-	  case CH_6_BW_125:
-	  case CH_8_BW_125:
-	  case CH_9_BW_125:
-	  case CH_10_BW_125:
-	  case CH_11_BW_125:
-	  case CH_12_BW_125:
-	  case CH_13_BW_125:
-
-	  case CH_1:
-	  case CH_2:
-	  case CH_3:
-	  case CH_4:
-	  case CH_5:
-	  case CH_6:
-	  case CH_7:
-	  case CH_8:
-	  case CH_9:
-	  case CH_10:
-	  case CH_11:
-	  case CH_12:
-	  case CH_13:
-	  case CH_14:
-	  case CH_15:
-	  case CH_16:
-	  case CH_17:
-	  case CH_18:
-	  case CH_19:
-	  case CH_20:
-	  case CH_21:
-	  case CH_22:
-	  case CH_23:
-	  case CH_24:		return true;
-				break;
-
-	  default:		return false;
+	  return false;
   }
   #if (SX1278_debug_mode > 1)
 	  Serial.println("## Finished 'isChannel' ##");
 	  Serial.println();
   #endif
+  return true;
 }
 
 /*
@@ -1876,16 +2310,30 @@ int8_t SX1278::setChannel(uint32_t ch)
 {
   uint8_t st0;
   int8_t state = 2;
-  unsigned int freq3;
-  unsigned int freq2;
-  uint8_t freq1;
-  uint32_t freq;
+  uint8_t frf[3];
 
   #if (SX1278_debug_mode > 1)
 	  Serial.println();
 	  Serial.println("Starting 'setChannel'");
   #endif
 
+  // FRF values are 24 bit, anything in the band is a frequency in Hz
+  if( ch >= FREQ_MIN )
+  {
+	  ch = (ch <= FREQ_MAX) ? freqToFrf(ch) : 0;
+  }
+
+  if( not isChannel(ch) )
+  {
+	 #if (SX1278_debug_mode > 1)
+		 Serial.print("** Frequency channel ");
+		 Serial.print(ch, HEX);
+		 Serial.println("is not a correct value **");
+		 Serial.println();
+	 #endif
+	 return -1;
+  }
+
   st0 = readRegister(REG_OP_MODE);	// Save the previous status
   if( _modem == LORA )
   {
@@ -1898,28 +2346,25 @@ int8_t SX1278::setChannel(uint32_t ch)
 	  writeRegister(REG_OP_MODE, FSK_STANDBY_MODE);
   }
 
-  freq3 = ((ch >> 16) & 0x0FF);		// frequency channel MSB
-  freq2 = ((ch >> 8) & 0x0FF);		// frequency channel MIB
-  freq1 = (ch & 0xFF);				// frequency channel LSB
+  frf[0] = ((ch >> 16) & 0x0FF);		// frequency channel MSB
+  frf[1] = ((ch >> 8) & 0x0FF);		// frequency channel MIB
+  frf[2] = (ch & 0xFF);				// frequency channel LSB
 
-  writeRegister(REG_FRF_MSB, freq3);
-  writeRegister(REG_FRF_MID, freq2);
-  writeRegister(REG_FRF_LSB, freq1);
+  // REG_FRF_MSB, REG_FRF_MID and REG_FRF_LSB in a single burst
+  writeRegisters(REG_FRF_MSB, frf, 3);
+  state = 0;
 
-  // storing MSB in freq channel value
-  freq3 = (readRegister(REG_FRF_MSB));
-  freq = (freq3 << 8) & 0xFFFFFF;
-
-  // storing MID in freq channel value
-  freq2 = (readRegister(REG_FRF_MID));
-  freq = (freq << 8) + ((freq2 << 8) & 0xFFFFFF);
-
-  // storing LSB in freq channel value
-  freq = freq + ((readRegister(REG_FRF_LSB)) & 0xFFFFFF);
+  #if SX1278_VERIFY_WRITES
+	  uint8_t check[3];
+	  readRegisters(REG_FRF_MSB, check, 3);
+	  if( (check[0] != frf[0]) || (check[1] != frf[1]) || (check[2] != frf[2]) )
+	  {
+		  state = 1;
+	  }
+  #endif
 
-  if( freq == ch )
+  if( state == 0 )
   {
-    state = 0;
     _channel = ch;
     #if (SX1278_debug_mode > 1)
 		Serial.print("## Frequency channel ");
@@ -1928,21 +2373,6 @@ int8_t SX1278::setChannel(uint32_t ch)
 		Serial.println();
 	#endif
   }
-  else
-  {
-    state = 1;
-  }
-
-  if( not isChannel(ch) )
-  {
-	 state = -1;
-	 #if (SX1278_debug_mode > 1)
-		 Serial.print("** Frequency channel ");
-		 Serial.print(ch, HEX);
-		 Serial.println("is not a correct value **");
-		 Serial.println();
-	 #endif
-  }
 
   writeRegister(REG_OP_MODE, st0);	// Getting back to previous status
   return state;
@@ -2097,7 +2527,7 @@ int8_t SX1278::setPowerNum(uint8_t pow)
   }
 
   if ( (pow >= 2) && (pow <= 20) )
-  { // Pout= 17-(15-OutputPower) = OutputPower+2
+  { // PA_BOOST pin as in setPower(): Pout= 17-(15-OutputPower) = OutputPower+2
 	  if ( pow <= 17 ) {
 		writeRegister(REG_PA_DAC, 0x84);
 	  	pow = pow - 2;
@@ -2105,7 +2535,7 @@ int8_t SX1278::setPowerNum(uint8_t pow)
 		writeRegister(REG_PA_DAC, 0x87);
 		pow = 15;
 	  }
-	  _power = pow;
+	  _power = 0xF0 | pow;	// PaSelect | MaxPower | OutputPower
   }
   else
   {
@@ -2136,26 +2566,114 @@ int8_t SX1278::setPowerNum(uint8_t pow)
   return state;
 }
 
-
+#if LORA_POWER_CONTROL
 /*
- Function: Gets the preamble length from the module.
- Returns: Integer that determines if there has been any error
-   state = 2  --> The command has not been executed
-   state = 1  --> There has been an error while executing the command
-   state = 0  --> The command has been executed with no errors
+ Function: Finds the power entry of a peer. An unknown peer takes the entry
+ of the oldest one and starts at LORA_TPC_MAX_DBM.
+ Returns: The entry of the peer
+ Parameters:
+   address: node address of the peer
 */
-uint8_t SX1278::getPreambleLength()
+lora_peer *SX1278::peer(uint8_t address)
 {
-	int8_t state = 2;
-	uint8_t p_length;
-
-	#if (SX1278_debug_mode > 1)
-		Serial.println();
-		Serial.println("Starting 'getPreambleLength'");
-	#endif
+	lora_peer *p;
 
-	state = 1;
-	if( _modem == LORA )
+	for( uint8_t i = 0; i < LORA_TPC_PEERS; i++ )
+	{
+		if( _peers[i].address == address )
+		{
+			return &_peers[i];
+		}
+	}
+	p = &_peers[_peerNext];
+	_peerNext = (_peerNext + 1) % LORA_TPC_PEERS;
+	p->address = address;
+	p->power = LORA_TPC_MAX_DBM;
+	p->snr = 0;
+	p->acks = 0;
+	return p;
+}
+
+/*
+ Function: Sets the output power used towards a peer. The registers are only
+ written when the power differs from the one in use.
+ Returns: Nothing
+ Parameters:
+   address: node address of the peer
+*/
+void SX1278::powerForPeer(uint8_t address)
+{
+	uint8_t power = peer(address)->power;
+
+	if( (power != (_power & 0x0F) + 2) || ((_power & 0xF0) != 0xF0) )
+	{
+		setPowerNum(power);
+	}
+}
+
+/*
+ Function: Moves the power towards a peer from the SNR it reported in an
+ ACK. The SNR limit of the spreading factor is 2.5 dB lower per SF step
+ (SF7 -7.5 dB .. SF12 -20 dB). The power goes down to the middle of the band
+ LORA_TPC_MARGIN .. LORA_TPC_MARGIN + LORA_TPC_HYSTERESIS and up as soon as
+ the margin is lost.
+ Returns: Nothing
+ Parameters:
+   address: node address of the peer
+   snr: SNR of our packet at the peer (dB)
+*/
+void SX1278::powerControl(uint8_t address, int8_t snr)
+{
+	lora_peer *p = peer(address);
+	// dB over the margin, the limit is rounded towards 0
+	int16_t excess = snr + 5 + (5 * (_spreadingFactor - SF_6)) / 2 - LORA_TPC_MARGIN;
+	int16_t power = p->power;
+
+	p->snr = snr;
+	if( p->acks < 0xFF )
+	{
+		p->acks++;
+	}
+
+	if( excess < 0 )
+	{
+		power -= excess;
+	}
+	else if( excess > LORA_TPC_HYSTERESIS )
+	{
+		power -= excess - LORA_TPC_HYSTERESIS / 2;
+	}
+	if( power < 2 )
+	{
+		power = 2;
+	}
+	if( power > LORA_TPC_MAX_DBM )
+	{
+		power = LORA_TPC_MAX_DBM;
+	}
+	p->power = power;
+}
+#endif
+
+/*
+ Function: Gets the preamble length from the module.
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t SX1278::getPreambleLength()
+{
+	int8_t state = 2;
+	uint8_t p_length;
+
+	#if (SX1278_debug_mode > 1)
+		Serial.println();
+		Serial.println("Starting 'getPreambleLength'");
+	#endif
+
+	state = 1;
+	if( _modem == LORA )
   	{ // LORA mode
   		p_length = readRegister(REG_PREAMBLE_MSB_LORA);
   		// Saving MSB preamble length in LoRa mode
@@ -2993,6 +3511,18 @@ uint8_t SX1278::setACK()
 
 	// Setting ACK length in order to send it
 	state = setPacketLength(ACK_LENGTH);
+	#if LORA_LOW_POWER_RX
+		if( (state == 0) && (_modem == LORA) )
+		{
+			state = setPreambleLength(LORA_PREAMBLE);	// Rx used the long one
+		}
+	#endif
+	#if LORA_IMPLICIT_ACK
+		if( (state == 0) && (_modem == LORA) )
+		{
+			setImplicitHeader(true);	// the sender waits for ACK_LENGTH bytes
+		}
+	#endif
 	if( state == 0 )
 	{
 		// Setting ACK
@@ -3000,8 +3530,16 @@ uint8_t SX1278::setACK()
 		ACK.dst = packet_received.src; // ACK destination is packet source
 		ACK.src = packet_received.dst; // ACK source is packet destination
 		ACK.packnum = packet_received.packnum; // packet number that has been correctly received
-		ACK.length = 0;		  // length = 0 to show that's an ACK
+		ACK.length = ACK_MARK;		  // length = 0 (flags = ACK_MARK) to show that's an ACK
 		ACK.data[0] = _reception;	// CRC of the received packet
+		#if LORA_ADR
+			ACK.data[0] |= adr_encode(_adrOffer) << ACK_ADR_SHIFT;	// mode for the next packets
+		#endif
+		#if LORA_POWER_CONTROL
+			getSNR();
+			ACK.data[1] = (uint8_t)_SNR;	// the sender sets its power from it
+			powerForPeer(ACK.dst);
+		#endif
 
 		// Setting address pointer in FIFO data buffer
 		writeRegister(REG_FIFO_ADDR_PTR, 0x00);
@@ -3010,11 +3548,16 @@ uint8_t SX1278::setACK()
 		state = 1;
 
 		// Writing ACK to send in FIFO
-		writeRegister(REG_FIFO, ACK.dst); 		// Writing the destination in FIFO
-		writeRegister(REG_FIFO, ACK.src);		// Writing the source in FIFO
-		writeRegister(REG_FIFO, ACK.packnum);	// Writing the packet number in FIFO
-		writeRegister(REG_FIFO, ACK.length); 	// Writing the packet length in FIFO
-		writeRegister(REG_FIFO, ACK.data[0]);	// Writing the ACK in FIFO
+		uint8_t ack_buf[ACK_LENGTH];
+		ack_buf[0] = ACK.dst; 		// destination
+		ack_buf[1] = ACK.src;		// source
+		ack_buf[2] = ACK.packnum;	// packet number
+		ack_buf[3] = ACK.length; 	// packet length
+		ack_buf[4] = ACK.data[0];	// ACK
+		#if LORA_POWER_CONTROL
+			ack_buf[5] = ACK.data[1];	// SNR
+		#endif
+		writeFifo(ack_buf, ACK_LENGTH);
 
 		#if (SX1278_debug_mode > 0)
 			Serial.println("## ACK set and written in FIFO ##");
@@ -3035,12 +3578,201 @@ uint8_t SX1278::setACK()
 
 		state = 0;
 		_reception = CORRECT_PACKET;		// Updating value to next packet
+	}
+	return state;
+}
+
+/*
+ Function: It sets a block ACK in FIFO in order to send it. The block ACK is
+ an ACK with one more byte: bit i of it is set if packet 'packnum - i' of the
+ source has been received, so the sender only repeats the missing packets.
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t SX1278::setBlockACK()
+{
+	uint8_t state = 2;
+	uint8_t offset;
+	uint8_t ack_buf[ACK_LENGTH + 1];
+
+	clearFlags();	// Initializing flags
+	writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);	// Stdby LoRa mode to write in FIFO
+
+	// Setting block ACK length in order to send it
+	state = setPacketLength(ACK_LENGTH + 1);
+	#if LORA_LOW_POWER_RX
+		if( state == 0 )
+		{
+			state = setPreambleLength(LORA_PREAMBLE);	// Rx used the long one
+		}
+	#endif
+	#if LORA_IMPLICIT_ACK
+		if( (state == 0) && (_modem == LORA) )
+		{
+			setImplicitHeader(true);	// the sender waits for ACK_LENGTH + 1 bytes
+		}
+	#endif
+	if( state == 0 )
+	{
+		memset( &ACK, 0x00, sizeof(ACK) );
+		ACK.dst = packet_received.src;
+		ACK.src = packet_received.dst;
+		ACK.packnum = packet_received.packnum;
+		ACK.length = ACK_MARK;
+		ACK.data[0] = _reception | ACK_BLOCK;	// its size, for a walk of the RX FIFO
+		#if LORA_ADR
+			ACK.data[0] |= adr_encode(_adrOffer) << ACK_ADR_SHIFT;
+		#endif
+		#if LORA_POWER_CONTROL
+			getSNR();
+			ACK.data[1] = (uint8_t)_SNR;
+			powerForPeer(ACK.dst);
+		#endif
+		offset = _winHigh - packet_received.packnum;
+		if( offset < 16 )
+		{
+			ACK.data[ACK_LENGTH - 4] = (uint8_t)(_winSeen >> offset);
+		}
+
+		writeRegister(REG_FIFO_ADDR_PTR, 0x00);
+		writeRegister(REG_FIFO_TX_BASE_ADDR, 0x00);
+
+		ack_buf[0] = ACK.dst;
+		ack_buf[1] = ACK.src;
+		ack_buf[2] = ACK.packnum;
+		ack_buf[3] = ACK.length;
+		ack_buf[4] = ACK.data[0];
+		#if LORA_POWER_CONTROL
+			ack_buf[5] = ACK.data[1];	// SNR
+		#endif
+		ack_buf[ACK_LENGTH] = ACK.data[ACK_LENGTH - 4];	// bitmap
+		writeFifo(ack_buf, ACK_LENGTH + 1);
 
-		wait_with_timer2(500);
+		#if (SX1278_debug_mode > 0)
+			Serial.print("## Block ACK set: ");
+			Serial.print(ACK.packnum, HEX);
+			Serial.print("|");
+			Serial.print(ACK.data[ACK_LENGTH - 4], HEX);
+			Serial.println(" ##");
+		#endif
+		_reception = CORRECT_PACKET;		// Updating value to next packet
 	}
 	return state;
 }
 
+/*
+ Function: Records a windowed packet in the reception history. The history
+ keeps the last 16 packet numbers of one source, enough for a window of
+ MAX_WINDOW packets and its retransmissions.
+ Returns: true if the packet is new, false if it has already been received
+ Parameters:
+   src: packet source
+   packnum: packet number
+*/
+bool SX1278::windowReceived(uint8_t src, uint8_t packnum)
+{
+	uint8_t d;
+
+	d = packnum - _winHigh;
+	if( (src != _winPeer) || ((d != 0) && (d < 0x80)) )
+	{ // Newer than any packet received
+		if( src != _winPeer )
+		{ // Another sender, its message starts over
+			_winMsgFilled = 0;
+			_winMsgLength = 0;
+		}
+		_winSeen = ((src == _winPeer) && (d < 16)) ? (uint16_t)(_winSeen << d) : 0;
+		_winSeen |= 1;
+		_winHigh = packnum;
+		_winPeer = src;
+		return true;
+	}
+
+	d = _winHigh - packnum;
+	if( d >= 16 )
+	{ // Out of the history (sender restarted), restart it
+		_winMsgFilled = 0;
+		_winMsgLength = 0;
+		_winSeen = 1;
+		_winHigh = packnum;
+		return true;
+	}
+	if( _winSeen & (1 << d) )
+	{ // Already received
+		return false;
+	}
+	_winSeen |= (1 << d);
+	return true;
+}
+
+/*
+ Function: Copies the payload of a new windowed packet at its offset in the
+ message buffer. The first packet after a complete message starts the next
+ one, windowReceived() starts it over for another source.
+ Returns: Nothing
+*/
+void SX1278::windowStore()
+{
+	uint16_t offset;
+	uint8_t length;
+
+	if( (_winMsgLength != 0) && (_winMsgFilled == _winMsgLength) )
+	{
+		_winMsgFilled = 0;
+		_winMsgLength = 0;
+	}
+	if( _payloadlength < WINDOW_HEADER )
+	{
+		return;
+	}
+	offset = ((uint16_t)packet_received.data[0] << 8) | packet_received.data[1];
+	length = _payloadlength - WINDOW_HEADER;
+	if( (_winMsg == 0) || (offset + length > _winMsgSize) )
+	{
+		return;	// the message never completes
+	}
+	for(uint8_t i = 0; i < length; i++)
+	{
+		_winMsg[offset + i] = packet_received.data[WINDOW_HEADER + i];
+	}
+	_winMsgFilled += length;
+	if( packet_received.retry & WINDOW_LAST )
+	{
+		_winMsgLength = offset + length;
+	}
+}
+
+/*
+ Function: Sets the buffer windowed messages are reassembled into.
+ Returns: Nothing
+ Parameters:
+   buffer: message buffer
+   size: buffer size in bytes
+*/
+void SX1278::setWindowBuffer(uint8_t *buffer, uint16_t size)
+{
+	_winMsg = buffer;
+	_winMsgSize = size;
+	_winMsgFilled = 0;
+	_winMsgLength = 0;
+}
+
+/*
+ Function: Gets the length of the windowed message reassembled in the buffer
+ of setWindowBuffer().
+ Returns: Message length, 0 while packets are missing
+*/
+uint16_t SX1278::windowMessage()
+{
+	if( (_winMsgLength == 0) || (_winMsgFilled != _winMsgLength) )
+	{
+		return 0;
+	}
+	return _winMsgLength;
+}
+
 /*
  Function: Configures the module to receive information.
  Returns: Integer that determines if there has been any error
@@ -3050,35 +3782,100 @@ uint8_t SX1278::setACK()
 */
 uint8_t SX1278::receive()
 {
-	uint8_t state = 1;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'receive'");
 	#endif
 
-	// Initializing packet_received struct
-	memset( &packet_received, 0x00, sizeof(packet_received) );
+	// Initializing packet_received struct, the payload buffer is kept
+	packet_received.dst = 0;
+	packet_received.src = 0;
+	packet_received.packnum = 0;
+	packet_received.length = 0;
+	packet_received.retry = 0;
 
-	// Setting Testmode
-	writeRegister(0x31,0x43);
-	// Set LowPnTxPllOff
-	writeRegister(REG_PA_RAMP, 0x09);
 	// Set LNA gain: Highest gain. LnaBoost:Improved sensitivity
 	writeRegister(REG_LNA, 0x23);
-	// Setting address pointer in FIFO data buffer
-	writeRegister(REG_FIFO_ADDR_PTR, 0x00);
-	// change RegSymbTimeoutLsb
-	writeRegister(REG_SYMB_TIMEOUT_LSB, 0xFF);
 	// Setting current value of reception buffer pointer
 	writeRegister(REG_FIFO_RX_BYTE_ADDR, 0x00);
 
+	return rearm();
+}
+
+/*
+ Function: Puts the module back in receive mode after a packet. Only the
+ FIFO pointer and the flags are reset; the configuration registers are
+ rewritten through the register shadow, so they cost nothing unless they
+ changed. 'packet_received' is left as is, the next packet overwrites it.
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   length: 0 to receive any packet, otherwise the length of a frame sent
+   with an implicit header (ACK with LORA_IMPLICIT_ACK)
+   ack: true when waiting for an ACK, sent with the short preamble
+*/
+uint8_t SX1278::rearm(uint8_t length, bool ack)
+{
+	uint8_t state = 1;
+	bool in_rx = (readRegister(REG_OP_MODE) == LORA_RX_MODE);
+
+	SpiBatch batch;
+
+	// Setting Testmode
+	batch.write(0x31,0x43);
+	// Set LowPnTxPllOff
+	batch.write(REG_PA_RAMP, 0x09);
+	// Setting address pointer in FIFO data buffer
+	batch.write(REG_FIFO_ADDR_PTR, 0x00);
+	// change RegSymbTimeoutLsb
+	batch.write(REG_SYMB_TIMEOUT_LSB, 0xFF);
+
 	// Proceed depending on the protocol selected
 	if( _modem == LORA )
 	{
 		/// LoRa mode
-		// With MAX_LENGTH gets all packets with length < MAX_LENGTH
-		state = setPacketLength(MAX_LENGTH);
+		// With MAX_LENGTH gets all packets with length < MAX_LENGTH. Only
+		// touched when it changed, setPacketLength goes through standby
+		// In implicit header mode the length is the one of the frame expected
+		state = 0;
+		if( readRegister(REG_PAYLOAD_LENGTH_LORA) != ((length != 0) ? length : MAX_LENGTH) )
+		{
+			state = setPacketLength((length != 0) ? length : MAX_LENGTH);
+			in_rx = false;
+		}
+		#if LORA_LOW_POWER_RX
+			// Data packets come with the long preamble, it must be expected
+			// in full; only ACKs have the short one
+			uint16_t preamble = ack ? LORA_PREAMBLE : wakePreamble();
+			if( (readRegister(REG_PREAMBLE_MSB_LORA) != (preamble >> 8)) || (readRegister(REG_PREAMBLE_LSB_LORA) != (preamble & 0xFF)) )
+			{
+				state |= setPreambleLength(preamble);
+				in_rx = false;
+			}
+		#else
+			(void)ack;
+		#endif
+		if( bitRead(readRegister(REG_MODEM_CONFIG1), 0) != ((length != 0) || (_header == HEADER_OFF)) )
+		{
+			writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+			setImplicitHeader(length != 0);
+			in_rx = false;
+		}
+		// Entering RX from another mode restarts the write pointer at the
+		// RX base; when already receiving, the unread frames are kept
+		batch.write(REG_FIFO_RX_BASE_ADDR, 0x00);
+		if( !in_rx )
+		{
+			_rxTail = 0x00;
+		}
+		// Initializing flags
+		batch.write(REG_IRQ_FLAGS, 0xFF);
+		writeBatch(batch);
+		// RxDone on DIO0, RxTimeout on DIO1
+		setDioMapping(DIO_MAPPING_RX);
+		_irqPending = 0;
 		// Set LORA mode - Rx
 		writeRegister(REG_OP_MODE, LORA_RX_MODE);
 
@@ -3090,6 +3887,7 @@ uint8_t SX1278::receive()
 	else
 	{
 		/// FSK mode
+		writeBatch(batch);
 		state = setPacketLength();
 		// FSK mode - Rx
 		writeRegister(REG_OP_MODE, FSK_RX_MODE);
@@ -3099,12 +3897,90 @@ uint8_t SX1278::receive()
 		#endif
 	}
 
-	#if (SX1278_debug_mode > 1)
-		//showRxRegisters();
+	return state;
+}
+
+/*
+ Function: Switches the header of the next frames. An implicit header saves
+ the PHY header symbols of frames whose length both sides know (ACKs).
+ REG_MODEM_CONFIG1 can only be changed in sleep or standby mode.
+ Returns: Nothing
+ Parameters:
+   implicit: true for an implicit header, false for the header set by
+   setHeaderON/OFF
+*/
+void SX1278::setImplicitHeader(bool implicit)
+{
+	uint8_t config1 = readRegister(REG_MODEM_CONFIG1) & 0xFE;
+
+	if( implicit || (_header == HEADER_OFF) )
+	{
+		config1 |= 0x01;
+	}
+	writeRegister(REG_MODEM_CONFIG1, config1);
+}
+
+#if LORA_ADR
+/*
+ Function: Feeds the RSSI of the latest packet or ACK to the ADR estimate and
+ marks the link as alive.
+ Returns: Nothing
+*/
+void SX1278::adrSample()
+{
+	if( getRSSIpacket() == 0 )
+	{
+		adr_sample(&_adr, _RSSIpacket);
+	}
+	_adrHeard = millis();
+}
+
+/*
+ Function: Switches to another mode, the ADR estimate starts over in it.
+ The frames already in the FIFO are moved to the RX queue first: the switch
+ goes through standby and a module back in Rx writes from the RX base again.
+ Returns: Nothing
+ Parameters:
+   mode: mode number 1..16
+*/
+void SX1278::adrSwitch(uint8_t mode)
+{
+	if( mode == _adr.mode )
+	{
+		return;
+	}
+	serviceRx();
+	if( setModeNum(mode) != 0 )
+	{
+		return;
+	}
+	_rxTail = 0x00;
+	adr_switch(&_adr, mode);
+	_adrHeard = millis();
+
+	#if (SX1278_debug_mode > 0)
+		Serial.print("## ADR mode ");
+		Serial.print(mode, DEC);
+		Serial.println(" ##");
 	#endif
+}
 
-	return state;
+/*
+ Function: Goes back to LORA_MODE when nothing has been heard for
+ LORA_ADR_FALLBACK_MS. It is the way out when only one side switched or the
+ mode in use does not reach the peer any more.
+ Returns: true if the mode changed
+*/
+bool SX1278::adrFallback()
+{
+	if( (_adr.mode == LORA_MODE) || (millis() - _adrHeard < LORA_ADR_FALLBACK_MS) )
+	{
+		return false;
+	}
+	adrSwitch(LORA_MODE);
+	return true;
 }
+#endif
 
 /*
  Function: Configures the module to receive information.
@@ -3208,93 +4084,29 @@ uint8_t SX1278::receivePacketTimeoutACK()
 */
 uint8_t SX1278::receivePacketTimeoutACK(uint32_t wait, bool set_state)
 {
-	uint8_t state = 2;
-	uint8_t state_f = 2;
-
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'receivePacketTimeoutACK'");
 	#endif
 
-	// set RX mode
-	if(set_state)
-		state = receive();
-	else state = 0;
-
-	// if RX mode is set correctly then wait for data
-	if( state == 0 )
-	{
-		// Wait for a new packet for 'wait' time
-		if( availableData(wait) )
-		{
-			// If packet received, getPacket
-			state = getPacket();
-		}
-		else
-		{
-			state = 1;
-			state_f = 3;  // There is no packet received
-		}
-	}
-	else
+	if( receivePacketAsync(wait, set_state) == 0 )
 	{
-		state = 1;
-		state_f = 1; // There has been an error with the 'receive' function
+		return 1;	// Another operation is in progress
 	}
+	return waitAsync();
+}
 
-
-	if( (state == 0) || (state == 3) )
-	{
-		if( _reception == INCORRECT_PACKET )
-		{
-			state_f = 4;  // The packet has been incorrectly received
-		}
-		else
-		{
-			state_f = 1;  // The packet has been correctly received
-		}
-		state = setACK();
-		if( state == 0 )
-		{
-			state = sendWithTimeout();
-			if( state == 0 )
-			{
-			state_f = 0;
-			#if (SX1278_debug_mode > 1)
-				Serial.println("This last packet was an ACK, so ...");
-				Serial.println("ACK successfully sent");
-				Serial.println();
-			#endif
-			}
-			else
-			{
-				state_f = 1; // There has been an error with the 'sendWithTimeout' function
-			}
-		}
-		else
-		{
-			state_f = 1; // There has been an error with the 'setACK' function
-		}
-	}
-	else
-	{
-		state_f = 1;
-	}
-	return state_f;
-}
-
-/*
- Function: Configures the module to receive all the information on air, before MAX_TIMEOUT expires.
- Returns: Integer that determines if there has been any error
-   state = 2  --> The command has not been executed
-   state = 1  --> There has been an error while executing the command
-   state = 0  --> The command has been executed with no errors
-*/
-uint8_t	SX1278::receiveAll()
-{
-	return receiveAll(MAX_TIMEOUT);
-}
+/*
+ Function: Configures the module to receive all the information on air, before MAX_TIMEOUT expires.
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t	SX1278::receiveAll()
+{
+	return receiveAll(MAX_TIMEOUT);
+}
 
 /*
  Function: Configures the module to receive all the information on air.
@@ -3375,32 +4187,22 @@ bool	SX1278::availableData(uint32_t wait)
 	if( _modem == LORA )
 	{
 		/// LoRa mode
-		// read REG_IRQ_FLAGS
-		value = readRegister(REG_IRQ_FLAGS);
-
-		// Wait to ValidHeader interrupt in REG_IRQ_FLAGS
-		while( (bitRead(value, 4) == 0) && (millis()-previous < (unsigned long)wait) )
-		{
-			// read REG_IRQ_FLAGS
-			value = readRegister(REG_IRQ_FLAGS);
-
-			// Condition to avoid an overflow (DO NOT REMOVE)
-			if( millis() < previous )
-			{
-				previous = millis();
-			}
-		}
+		// Wait to ValidHeader interrupt in REG_IRQ_FLAGS. ValidHeader is not
+		// routed to DIO0/DIO1, so with interrupts RxDone ends the wait (it
+		// implies ValidHeader)
+		value = waitIrq(IRQ_VALID_HEADER | IRQ_RX_DONE, wait);
 
-		// Check if ValidHeader was received
-		if( bitRead(value, 4) == 1 )
+		// Check if ValidHeader was received (RxDone alone for an implicit header frame)
+		if( (value & (IRQ_VALID_HEADER | IRQ_RX_DONE)) != 0 )
 		{
 			#if (SX1278_debug_mode > 0)
 				Serial.println("## Valid Header received in LoRa mode ##");
 			#endif
 			_hreceived = true;
+			// Wait for the increment of the RX buffer pointer
+			header = readRegister(REG_FIFO_RX_BYTE_ADDR);
 			while( (header == 0) && (millis()-previous < (unsigned long)wait) )
 			{
-				// Wait for the increment of the RX buffer pointer
 				header = readRegister(REG_FIFO_RX_BYTE_ADDR);
 
 				// Condition to avoid an overflow (DO NOT REMOVE)
@@ -3413,6 +4215,11 @@ bool	SX1278::availableData(uint32_t wait)
 			// If packet received: Read first byte of the received packet
 			if( header != 0 )
 			{
+				if( bitRead(value, 6) == 1 )
+				{
+					// Whole packet there, it starts at FifoRxCurrentAddr
+					writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_CURRENT_ADDR));
+				}
 				_destination = readRegister(REG_FIFO);
 			}
 		}
@@ -3577,20 +4384,8 @@ int8_t SX1278::getPacket(uint32_t wait)
 	if( _modem == LORA )
 	{
 		/// LoRa mode
-		// read REG_IRQ_FLAGS
-		value = readRegister(REG_IRQ_FLAGS);
-
 		// Wait until the packet is received (RxDone flag) or the timeout expires
-		while( (bitRead(value, 6) == 0) && (millis()-previous < (unsigned long)wait) )
-		{
-			value = readRegister(REG_IRQ_FLAGS);
-
-			// Condition to avoid an overflow (DO NOT REMOVE)
-			if( millis() < previous )
-			{
-				previous = millis();
-			}
-		}
+		value = waitIrq(IRQ_RX_DONE | IRQ_RX_TIMEOUT, wait);
 
 		// Check if 'RxDone' is true and 'PayloadCrcError' is correct
 		if( (bitRead(value, 6) == 1) && (bitRead(value, 5) == 0) )
@@ -3693,10 +4488,55 @@ int8_t SX1278::getPacket(uint32_t wait)
 			if( _modem == LORA )
 			{
 				/// LoRa
-				// Setting address pointer in FIFO data buffer
-				writeRegister(REG_FIFO_ADDR_PTR, 0x00);
-				// Storing first byte of the received packet
-				packet_received.dst = readRegister(REG_FIFO);
+				// Setting address pointer at the start of the last packet,
+				// in RXCONTINUOUS mode it is not always the start of the FIFO
+				writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_CURRENT_ADDR));
+
+				// The whole packet is read in a single burst: the header
+				// first, then the payload once its length is known
+				uint8_t header[4];
+				#if LORA_COMPACT_HEADER
+					// No length byte, the retry number is the flags byte
+					packet_received.length = readRegister(REG_RX_NB_BYTES);
+				#endif
+				spi_read_start(REG_FIFO);
+				spi_burst_read(4, header);
+				packet_received.dst = header[0];
+				packet_received.src = header[1];
+				packet_received.packnum = header[2];
+				#if LORA_COMPACT_HEADER
+					packet_received.retry = header[3];
+					if( packet_received.retry & ACK_MARK )
+					{
+						packet_received.length = 0;	// an ACK, not a packet
+					}
+				#else
+					packet_received.length = header[3];
+				#endif
+
+				// calculate the payload length
+				_payloadlength = packet_received.length - OFFSET_PAYLOADLENGTH;
+
+				// check if length is incorrect
+				if( (packet_received.length < OFFSET_PAYLOADLENGTH) || (_payloadlength > MAX_PAYLOAD)
+					|| (_payloadlength > _rxBufferSize) )
+				{
+					spi_burst_end();
+					_payloadlength = 0;
+					#if (SX1278_debug_mode > 0)
+						Serial.println("Corrupted packet, wrong length or RX buffer too small");
+					#endif
+				}
+				else
+				{
+					// Store payload in 'data' and 'retry'
+					spi_burst_read(_payloadlength, packet_received.data);
+					#if !LORA_COMPACT_HEADER
+						spi_burst_read(1, &packet_received.retry);
+					#endif
+					spi_burst_end();
+					state_f = 0;
+				}
 			}
 			else
 			{
@@ -3712,37 +4552,37 @@ int8_t SX1278::getPacket(uint32_t wait)
 					// Storing first byte of the received packet
 					packet_received.dst = _destination;
 				}
-			}
 
-			// Reading second byte of the received packet
-			// Reading third byte of the received packet
-			// Reading fourth byte of the received packet
-			packet_received.src = readRegister(REG_FIFO);
-			packet_received.packnum = readRegister(REG_FIFO);
-			packet_received.length = readRegister(REG_FIFO);
-
-			// calculate the payload length
-			if( _modem == LORA )
-			{
+				// Reading second byte of the received packet
+				// Reading third byte of the received packet
+				// Reading fourth byte of the received packet
+				packet_received.src = readRegister(REG_FIFO);
+				packet_received.packnum = readRegister(REG_FIFO);
+				packet_received.length = readRegister(REG_FIFO);
 				_payloadlength = packet_received.length - OFFSET_PAYLOADLENGTH;
-			}
 
-			// check if length is incorrect
-			if( packet_received.length > (MAX_LENGTH + 1) )
-			{
-				#if (SX1278_debug_mode > 0)
-					Serial.println("Corrupted packet, length must be less than 256");
-				#endif
-			}
-			else
-			{
-				// Store payload in 'data'
-				for(unsigned int i = 0; i < _payloadlength; i++)
+				// check if length is incorrect
+				if( (packet_received.length < OFFSET_PAYLOADLENGTH) || (_payloadlength > _rxBufferSize) )
+				{
+					#if (SX1278_debug_mode > 0)
+						Serial.println("Corrupted packet, length must be less than 256");
+					#endif
+				}
+				else
 				{
-					packet_received.data[i] = readRegister(REG_FIFO);
+					// Store payload in 'data'
+					for(unsigned int i = 0; i < _payloadlength; i++)
+					{
+						packet_received.data[i] = readRegister(REG_FIFO);
+					}
+					// Store 'retry'
+					packet_received.retry = readRegister(REG_FIFO);
+					state_f = 0;
 				}
-				// Store 'retry'
-				packet_received.retry = readRegister(REG_FIFO);
+			}
+
+			if( state_f == 0 )
+			{
 
 				// Print the packet if debug_mode
 				#if (SX1278_debug_mode > 1)
@@ -3764,7 +4604,6 @@ int8_t SX1278::getPacket(uint32_t wait)
 					Serial.println(" ##");
 					Serial.println();
 				#endif
-				state_f = 0;
 			}
 		}
 		else{ // incorrect but in LoRa mode, the packet is stored!!
@@ -3896,24 +4735,17 @@ uint8_t SX1278::setTimeout()
 	state = 1;
 	if( _modem == LORA )
 	{
-		// calculate 'delay'
-		delay = ((0.1*_sendTime) + 1);
+		uint16_t Tpacket = timeOnAir();
 
-		float Tpacket = timeOnAir();
+		// calculate 'delay', 1/8 of the time-on-air for clock tolerance
+		delay = (Tpacket >> 3) + 1;
 
-		// calculate final send/receive timeout adding an offset and a random value
-		//_sendTime = (uint16_t) Tpacket + (rand() % delay) + 1000;// TODO: maybe add rand() ??
-		_sendTime = (uint16_t) Tpacket + (delay - 1) + 1000;
+		// calculate final send/receive timeout adding the guard time
+		_sendTime = Tpacket + delay + LORA_ACK_GUARD_MS;
 
 		#if (SX1278_debug_mode > 2)
-			Serial.print("Tsym (ms):");
-			Serial.println(Tsym);
-			Serial.print("Tpreamble (ms):");
-			Serial.println(Tpreamble);
-			Serial.print("payloadSymbNb:");
-			Serial.println(payloadSymbNb);
-			Serial.print("Tpacket:");
-			Serial.println(Tpacket);
+			Serial.print("Tpacket (ms):");
+			Serial.println(Tpacket, DEC);
 		#endif
 
 		// update state
@@ -3940,9 +4772,9 @@ uint8_t SX1278::setTimeout()
 /*
  Function: It gets the theoretical value of the time-on-air of the packet
  Link: http://www.semtech.com/images/datasheet/sx1276.pdf
- Returns: Float that determines the time-on-air
+ Returns: Time-on-air in ms, rounded up
 */
-float SX1278::timeOnAir()
+uint16_t SX1278::timeOnAir()
 {
 	return timeOnAir( _payloadlength );
 }
@@ -3950,49 +4782,323 @@ float SX1278::timeOnAir()
 /*
  Function: It gets the theoretical value of the time-on-air of the packet
  Link: http://www.semtech.com/images/datasheet/sx1276.pdf
- Returns: Float that determines the time-on-air
+ Returns: Time-on-air in ms, rounded up
+ Parameters:
+   payloadlength: payload length, the 5 bytes of header and retry are added
+*/
+uint16_t SX1278::timeOnAir( uint16_t payloadlength )
+{
+	return (uint16_t)((timeOnAirUs( payloadlength ) + 999) / 1000);
+}
+
+/*
+ Function: It gets the theoretical value of the time-on-air of the packet
+ with the current modulation, header, CRC, LowDataRateOptimize and preamble
+ settings. Integer arithmetic only, see loraTimeOnAirUs().
+ Link: http://www.semtech.com/images/datasheet/sx1276.pdf
+ Returns: Time-on-air in us
+ Parameters:
+   payloadlength: payload length, the 5 bytes of header and retry are added
 */
-float SX1278::timeOnAir( uint16_t payloadlength )
+uint32_t SX1278::timeOnAirUs( uint16_t payloadlength )
 {
-	float BW;
-	float DE = 0;
-	uint8_t SF = _spreadingFactor;
-	float PL = payloadlength + OFFSET_PAYLOADLENGTH;
-	float H = _header;
-	float CR = _codingRate;
+	return timeOnAirUs(payloadlength, _header == HEADER_ON);
+}
 
-	// Dara rate optimization enabled if SF is 11 or 12
-	if( SF > 10) DE = 1.0;
-	else DE = 0.0;
+/*
+ Function: Same as timeOnAirUs(payloadlength), with or without the PHY header
+ whatever setHeaderON/OFF set. ACKs with LORA_IMPLICIT_ACK have no header.
+ Returns: Time-on-air in us
+ Parameters:
+   payloadlength: payload length, the header bytes of the frame are added
+   explicit_header: false for an implicit header frame
+*/
+uint32_t SX1278::timeOnAirUs( uint16_t payloadlength, bool explicit_header )
+{
+	uint16_t PL = payloadlength + OFFSET_PAYLOADLENGTH;
+	uint16_t preamble;
 
 	// payload correction
 	if( payloadlength == 0 ) PL = 255;
 
-	// Bandwidth value setting
-	if( _bandwidth == BW_125 ) 		BW = 125.0;
-	else if( _bandwidth == BW_250 ) BW = 250.0;
-	else if( _bandwidth == BW_500 ) BW = 500.0;
-	else BW = 125.0;
+	// Registers served by the shadow, no SPI transaction after the first call
+	preamble = ((uint16_t)readRegister(REG_PREAMBLE_MSB_LORA) << 8) | readRegister(REG_PREAMBLE_LSB_LORA);
+
+	return loraTimeOnAirUs(_spreadingFactor,
+							_bandwidth,
+							_codingRate,
+							PL,
+							explicit_header,
+							_CRC == CRC_ON,
+							bitRead(readRegister(REG_MODEM_CONFIG3), 3),
+							preamble);
+}
+
+/*
+ Function: It gets the delay between a packet received and its ACK. It only
+ has to cover the switch of the sender from Tx to Rx mode, which does not
+ depend on the modulation.
+ Returns: Delay in ms
+*/
+uint16_t SX1278::ackDelay()
+{
+	return LORA_ACK_GUARD_MS;
+}
+
+/*
+ Function: It gets the time to wait for an ACK, from the end of the packet
+ sent: ACK delay of the receiver, time-on-air of the ACK and the guard time
+ for the processing on both sides. A block ACK (ACK_LENGTH + 1 bytes, the
+ bitmap after the ACK) is the longest ACK, so it is used for both kinds.
+ Returns: Time in ms
+*/
+uint16_t SX1278::ackWaitTime()
+{
+	uint16_t Tack = (uint16_t)((timeOnAirUs(ACK_LENGTH + 1 - OFFSET_PAYLOADLENGTH, !LORA_IMPLICIT_ACK) + 999) / 1000) + 1;
+
+	return ackDelay() + Tack + (Tack >> 3) + 2 * LORA_ACK_GUARD_MS;
+}
+
+/*
+ Function: It gets the longest time a CAD can take: about two symbols of the
+ current modulation, plus the guard time.
+ Returns: Time in ms
+*/
+uint16_t SX1278::cadTime()
+{
+	return (uint16_t)(((uint32_t)2000 << _spreadingFactor) / loraBandwidthHz(_bandwidth)) + 1 + LORA_ACK_GUARD_MS;
+}
+
+#if LORA_DUTY_CYCLE
+// Airtime budget of the sliding window and length of one bucket
+static const uint32_t DUTY_BUDGET_US = (uint32_t)LORA_DUTY_WINDOW_S * LORA_DUTY_PERMILLE * 1000;
+static const uint32_t DUTY_BUCKET_MS = (uint32_t)LORA_DUTY_WINDOW_S * 1000 / LORA_DUTY_BUCKETS;
+
+/*
+ Function: Charges the frame being put on air to the airtime ledger: the
+ frame length and the header mode are read from the module (served by the
+ register shadow), so data packets, ACKs and block ACKs are all counted.
+ Returns: Nothing
+*/
+void SX1278::chargeAirtime()
+{
+	uint16_t preamble = ((uint16_t)readRegister(REG_PREAMBLE_MSB_LORA) << 8) | readRegister(REG_PREAMBLE_LSB_LORA);
+	uint32_t us = loraTimeOnAirUs(_spreadingFactor,
+								_bandwidth,
+								_codingRate,
+								readRegister(REG_PAYLOAD_LENGTH_LORA),
+								!bitRead(readRegister(REG_MODEM_CONFIG1), 0),
+								_CRC == CRC_ON,
+								bitRead(readRegister(REG_MODEM_CONFIG3), 3),
+								preamble);
+
+	advanceAirtime();
+	_airtime.bucket[_airtime.head] += us;
+	_airtime.totalMs += (us + 999) / 1000;
+}
+
+/*
+ Function: Moves the head of the ledger to the current bucket. The ledger
+ holds one bucket more than the window: the slot the head moves to is the
+ bucket that ended a whole window ago, its airtime is freed.
+ Returns: Nothing
+*/
+void SX1278::advanceAirtime()
+{
+	uint32_t now = millis();
+
+	if( now - _airtime.headStart >= DUTY_BUCKET_MS * DUTY_SLOTS )
+	{ // Silent since the end of the head bucket for a whole window
+		for( uint8_t i = 0; i < DUTY_SLOTS; i++ )
+		{
+			_airtime.bucket[i] = 0;
+		}
+		_airtime.headStart = now;
+		return;
+	}
+	while( now - _airtime.headStart >= DUTY_BUCKET_MS )
+	{
+		_airtime.head = (_airtime.head + 1) % DUTY_SLOTS;
+		_airtime.bucket[_airtime.head] = 0;
+		_airtime.headStart += DUTY_BUCKET_MS;
+	}
+}
+
+/*
+ Function: Gets the airtime left in the budget of the sliding window.
+ Returns: Time in ms
+*/
+uint32_t SX1278::airtimeLeft()
+{
+	uint32_t used = 0;
+
+	advanceAirtime();
+	for( uint8_t i = 0; i < DUTY_SLOTS; i++ )
+	{
+		used += _airtime.bucket[i];
+	}
+	return (used < DUTY_BUDGET_US) ? (DUTY_BUDGET_US - used) / 1000 : 0;
+}
+
+/*
+ Function: Gets the wait until a packet fits in the budget. The oldest
+ bucket is freed at the end of the current one, when its own end is
+ LORA_DUTY_WINDOW_S old, the next one a bucket later and so on. Airtime is
+ kept between one window and one window plus a bucket: never less.
+ Returns: Time in ms, 0 to send now, 0xFFFFFFFF if the packet is longer
+ than the whole budget
+ Parameters:
+   payloadlength: payload length of the packet
+*/
+uint32_t SX1278::nextTxTime(uint16_t payloadlength)
+{
+	uint32_t need = timeOnAirUs(payloadlength);
+	uint32_t used = 0;
+	uint32_t now = millis();
+
+	if( need > DUTY_BUDGET_US )
+	{
+		return 0xFFFFFFFF;
+	}
+	advanceAirtime();
+	for( uint8_t i = 0; i < DUTY_SLOTS; i++ )
+	{
+		used += _airtime.bucket[i];
+	}
+	for( uint8_t k = 1; used + need > DUTY_BUDGET_US; k++ )
+	{ // k-th oldest bucket, freed k buckets after the current one started
+		used -= _airtime.bucket[(_airtime.head + k) % DUTY_SLOTS];
+		if( used + need <= DUTY_BUDGET_US )
+		{
+			return _airtime.headStart + k * DUTY_BUCKET_MS - now;
+		}
+	}
+	return 0;
+}
+#endif
+
+#if LORA_LOW_POWER_RX
+/*
+ Function: It gets the preamble of a data packet for a receiver in low-power
+ listening: the symbols of its sleep interval and of one CAD, on top of the
+ usual preamble.
+ Returns: Preamble length in symbols, up to 65535
+*/
+uint16_t SX1278::wakePreamble()
+{
+	uint32_t symbols = (uint32_t)(((uint64_t)(LORA_LPRX_INTERVAL_MS + cadTime()) * loraBandwidthHz(_bandwidth) / 1000) >> _spreadingFactor);
+
+	symbols += 1 + LORA_PREAMBLE;
+	return (symbols > 0xFFFF) ? 0xFFFF : (uint16_t)symbols;
+}
+
+/*
+ Function: Ends low-power listening before a data packet is written in
+ FIFO, and stretches the preamble of the packet over the sleep interval of
+ the receiver. The ACK wait, rearm(length, true), gives the short preamble
+ back.
+ Returns: Op mode to go back to after writing the FIFO: standby instead of
+ the listening modes, the FIFO is lost in sleep mode
+ Parameters:
+   st0: op mode saved by the caller, the module is in standby
+*/
+uint8_t SX1278::wakePacket(uint8_t st0)
+{
+	setPreambleLength(wakePreamble());
+	if( _listen != LISTEN_OFF )
+	{
+		_listen = LISTEN_OFF;
+		return LORA_STANDBY_MODE;
+	}
+	return st0;
+}
 
-	// Calculation steps:
-	//Tsym = pow(2,SF)/(BW); // ms
-	Tsym = (1 << SF) / (BW); // ms
-	Tpreamble = (8+4.25)*Tsym;// ms
-	float arg1 = (8.0*PL-4.0*SF+28.0+16.0-20.0*H)/(4.0*(SF-2.0*DE));
-	if (arg1 < 0)
-		payloadSymbNb = 8;
-	else{
-		uint32_t flr = arg1;
-		payloadSymbNb = (flr+1)*(CR+4.0) + 8;
+/*
+ Function: Puts the radio to sleep and starts low-power listening. Frames
+ already in the Rx queue are kept.
+ Returns: Nothing
+*/
+void SX1278::startListening()
+{
+	if( _modem != LORA )
+	{
+		return;
 	}
-	//float argument1 = ceil( (8.0*PL-4.0*SF+28.0+16.0-20.0*H)/(4.0*(SF-2.0*DE)) )*(CR+4.0);
-	//float argument2 = 0;
-	//payloadSymbNb = 8 + max(argument1, argument2);
-	float Tpayload = payloadSymbNb * Tsym;
-	float Tpacket = Tpreamble + Tpayload;
+	clearFlags();
+	writeRegister(REG_OP_MODE, LORA_SLEEP_MODE);
+	_listen = LISTEN_SLEEP;
+	_listenSince = millis();
+}
+
+/*
+ Function: Runs one step of low-power listening. The radio sleeps for
+ LORA_LPRX_INTERVAL_MS, then runs a CAD; only a CAD that hears a preamble
+ puts it in Rx, for the rest of the preamble and the longest packet. A false
+ detection costs that Rx time. Before startListening() (LISTEN_OFF) the
+ module is in continuous Rx and only its flags are checked.
+ Returns: true if a packet may be waiting, to receive it
+*/
+bool SX1278::lowPowerListen()
+{
+	uint32_t now = millis();
+	bool flags;
+
+	#if LORA_USE_DIO_IRQ
+		flags = (_irqPending != 0);
+	#else
+		flags = (readRegister(REG_IRQ_FLAGS) != 0);
+	#endif
+
+	switch( _listen )
+	{
+		case LISTEN_SLEEP:
+			if( now - _listenSince >= LORA_LPRX_INTERVAL_MS )
+			{
+				writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+				clearFlags();
+				// CadDone on DIO0, CadDetected on DIO1
+				setDioMapping(DIO_MAPPING_CAD);
+				writeRegister(REG_OP_MODE, LORA_CAD_MODE);
+				_listen = LISTEN_CAD;
+				_listenSince = now;
+			}
+			return (rx_queue_count() != 0);
+
+		case LISTEN_CAD:
+			if( !flags && (now - _listenSince < cadTime()) )
+			{
+				return (rx_queue_count() != 0);
+			}
+			if( readRegister(REG_IRQ_FLAGS) & IRQ_CAD_DETECTED )
+			{ // Preamble on air, Rx expecting the long preamble
+				rearm();
+				_listen = LISTEN_RX;
+				_listenSince = now;
+			}
+			else
+			{
+				startListening();
+			}
+			return (rx_queue_count() != 0);
+
+		case LISTEN_RX:
+			if( flags || (rx_queue_count() != 0) )
+			{
+				return true;
+			}
+			// The preamble set by rearm() is the long one: the time-on-air
+			// covers the rest of the preamble and the longest packet
+			if( now - _listenSince >= (uint32_t)cadTime() + timeOnAir(MAX_PAYLOAD) )
+			{
+				startListening();
+			}
+			return false;
 
-	return Tpacket;
+		default:
+			return flags || (rx_queue_count() != 0);
+	}
 }
+#endif
 
 
 
@@ -4020,11 +5126,8 @@ uint8_t SX1278::setPayload(char *payload)
 	state = truncPayload(length16);
 	if( state == 0 )
 	{
-		// fill data field until the end of the string
-		for(unsigned int i = 0; i < _payloadlength; i++)
-		{
-			packet_sent.data[i] = payload[i];
-		}
+		// the string is sent from where it is, not copied
+		packet_sent.data = (uint8_t *)payload;
 	}
 	else
 	{
@@ -4041,6 +5144,9 @@ uint8_t SX1278::setPayload(char *payload)
 			Serial.println();
 		#endif
 	}
+	_iov[0].data = (uint8_t *)payload;
+	_iov[0].length = _payloadlength;
+	_iovCount = 1;
 
 	// Set length with the actual counter value
 	// Setting packet length in packet structure
@@ -4056,41 +5162,99 @@ uint8_t SX1278::setPayload(char *payload)
    state = 0  --> The command has been executed with no errors
 */
 uint8_t SX1278::setPayload(uint8_t *payload)
+{
+	lora_iovec iov;
+
+	iov.data = payload;
+	iov.length = _payloadlength;
+	return setPayload(&iov, 1);
+}
+
+/*
+ Function: It sets the payload of the packet to send from several fragments.
+ Only the descriptors are kept, writePacketFifo() streams the bytes from the
+ caller's buffers. In FSK mode the payload is truncated to MAX_PAYLOAD_FSK.
+ Returns:  Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   iov: payload fragments, in order
+   count: number of fragments, up to MAX_IOV
+*/
+uint8_t SX1278::setPayload(lora_iovec *iov, uint8_t count)
 {
 	uint8_t state = 2;
+	uint8_t max_payload = (_modem == FSK) ? MAX_PAYLOAD_FSK : MAX_PAYLOAD;
+	uint8_t length;
 
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'setPayload'");
 	#endif
 
-	state = 1;
-	if( ( _modem == FSK ) && ( _payloadlength > MAX_PAYLOAD_FSK ) )
+	if( (count == 0) || (count > MAX_IOV) )
 	{
-		_payloadlength = MAX_PAYLOAD_FSK;
-		state = 1;
-		#if (SX1278_debug_mode > 1)
-			Serial.println("In FSK, payload length must be less than 60 bytes.");
-			Serial.println();
-		#endif
+		return 1;
 	}
-	for(unsigned int i = 0; i < _payloadlength; i++)
+
+	_payloadlength = 0;
+	for(uint8_t i = 0; i < count; i++)
 	{
-		packet_sent.data[i] = payload[i];	// Storing payload in packet structure
+		length = iov[i].length;
+		if( length > max_payload - _payloadlength )
+		{
+			length = max_payload - _payloadlength;
+			#if (SX1278_debug_mode > 1)
+				Serial.println("Payload truncated to the maximum length.");
+			#endif
+		}
+		_iov[i].data = iov[i].data;
+		_iov[i].length = length;
+		_payloadlength += length;
 	}
+	_iovCount = count;
+	packet_sent.data = _iov[0].data;
+
 	// set length with the actual counter value
-    state = setPacketLength();	// Setting packet length in packet structure
+	state = setPacketLength();	// Setting packet length in packet structure
 	return state;
 }
 
 /*
- Function: It sets a packet struct in FIFO in order to send it.
- Returns:  Integer that determines if there has been any error
-   state = 2  --> The command has not been executed
-   state = 1  --> There has been an error while executing the command
-   state = 0  --> The command has been executed with no errors
+ Function: Sets the flags carried in the retry byte of the next packets, for
+ the receiver to know how to read the payload.
+ Returns: Nothing
+ Parameters:
+   flags: PAYLOAD_COMPRESSED or 0
 */
-uint8_t SX1278::setPacket(uint8_t dest, char *payload)
+void SX1278::setPayloadFlags(uint8_t flags)
+{
+	_payloadFlags = flags;
+}
+
+/*
+ Function: Sets the buffer the payload of received packets is read into.
+ packet_received.data points to it, nothing else holds a copy.
+ Returns: Nothing
+ Parameters:
+   buffer: payload buffer
+   size: buffer size in bytes
+*/
+void SX1278::setRxBuffer(uint8_t *buffer, uint8_t size)
+{
+	packet_received.data = buffer;
+	_rxBufferSize = size;
+}
+
+/*
+ Function: It sets a packet struct in FIFO in order to send it.
+ Returns:  Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t SX1278::setPacket(uint8_t dest, char *payload)
 {
 	int8_t state = 2;
 	uint8_t st0;
@@ -4104,6 +5268,13 @@ uint8_t SX1278::setPacket(uint8_t dest, char *payload)
 	st0 = readRegister(REG_OP_MODE);
 	// Initializing flags
 	clearFlags();
+	#if LORA_LOW_POWER_RX
+		if( _modem == LORA )
+		{
+			writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+			st0 = wakePacket(st0);
+		}
+	#endif
 
 	// Updating incorrect value
 	_reception = CORRECT_PACKET;
@@ -4114,6 +5285,7 @@ uint8_t SX1278::setPacket(uint8_t dest, char *payload)
 		// Updating these values only if it is the first try
 		// Setting destination in packet structure
 		state = setDestination(dest);
+		packet_sent.retry = _payloadFlags;
 		if( state == 0 )
 		{
 			state = setPayload(payload);
@@ -4122,7 +5294,7 @@ uint8_t SX1278::setPacket(uint8_t dest, char *payload)
 	else
 	{
 		state = setPacketLength();
-		packet_sent.retry = _retries;
+		packet_sent.retry = _retries | _payloadFlags;
 		#if (SX1278_debug_mode > 0)
 			Serial.print("** Retrying to send last packet ");
 			Serial.print(_retries, DEC);
@@ -4130,22 +5302,14 @@ uint8_t SX1278::setPacket(uint8_t dest, char *payload)
 		#endif
 	}
 
-	// Setting address pointer in FIFO data buffer
-	writeRegister(REG_FIFO_TX_BASE_ADDR, 0x00);
-	writeRegister(REG_FIFO_ADDR_PTR, 0x00);
 	if( state == 0 )
 	{
 		state = 1;
-		// Writing packet to send in FIFO
-		writeRegister(REG_FIFO, packet_sent.dst); 		// Writing the destination in FIFO
-		writeRegister(REG_FIFO, packet_sent.src);		// Writing the source in FIFO
-		writeRegister(REG_FIFO, packet_sent.packnum);	// Writing the packet number in FIFO
-		writeRegister(REG_FIFO, packet_sent.length); 	// Writing the packet length in FIFO
-		for( uint16_t i = 0; i < _payloadlength; i++)
+		// Writing packet to send in FIFO, a retry only patches its retry number
+		if( (_retries == 0) || (patchRetryFifo() != 0) )
 		{
-			writeRegister(REG_FIFO, packet_sent.data[i]);  // Writing the payload in FIFO
+			writePacketFifo();
 		}
-		writeRegister(REG_FIFO, packet_sent.retry);		// Writing the number retry in FIFO
 		state = 0;
 		#if (SX1278_debug_mode > 0)
 			Serial.println("## Packet set and written in FIFO ##");
@@ -4180,6 +5344,27 @@ uint8_t SX1278::setPacket(uint8_t dest, char *payload)
    state = 0  --> The command has been executed with no errors
 */
 uint8_t SX1278::setPacket(uint8_t dest, uint8_t *payload)
+{
+	lora_iovec iov;
+
+	iov.data = payload;
+	iov.length = _payloadlength;
+	return setPacket(dest, &iov, 1);
+}
+
+/*
+ Function: It writes a packet made of several payload fragments in FIFO. The
+ header, the fragments and the retry number go out in a single burst.
+ Returns:  Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   dest: packet destination
+   iov: payload fragments, in order (ignored for a retry)
+   count: number of fragments, up to MAX_IOV
+*/
+uint8_t SX1278::setPacket(uint8_t dest, lora_iovec *iov, uint8_t count)
 {
 	int8_t state = 2;
 	uint8_t st0;
@@ -4195,6 +5380,9 @@ uint8_t SX1278::setPacket(uint8_t dest, uint8_t *payload)
 	if( _modem == LORA )
 	{ // LoRa mode
 		writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);	// Stdby LoRa mode to write in FIFO
+		#if LORA_LOW_POWER_RX
+			st0 = wakePacket(st0);
+		#endif
 	}
 	else
 	{ // FSK mode
@@ -4205,36 +5393,30 @@ uint8_t SX1278::setPacket(uint8_t dest, uint8_t *payload)
 	if(_retries == 0)
 	{ // Sending new packet
 		state = setDestination(dest);	// Setting destination in packet structure
+		packet_sent.retry = _payloadFlags;
 		if( state == 0 )
 		{
-			state = setPayload(payload);
+			state = setPayload(iov, count);
 		}
 	}
 	else
 	{
 		state = setPacketLength();
-		packet_sent.retry = _retries;
+		packet_sent.retry = _retries | _payloadFlags;
 		#if (SX1278_debug_mode > 0)
 			Serial.print("** Retrying to send last packet ");
 			Serial.print(_retries, DEC);
 			Serial.println(" time **");
 		#endif
 	}
-	writeRegister(REG_FIFO_TX_BASE_ADDR, 0x00);
-	writeRegister(REG_FIFO_ADDR_PTR, 0x00);  // Setting address pointer in FIFO data buffer
 	if( state == 0 )
 	{
 		state = 1;
-		// Writing packet to send in FIFO
-		writeRegister(REG_FIFO, packet_sent.dst); 		// Writing the destination in FIFO
-		writeRegister(REG_FIFO, packet_sent.src);		// Writing the source in FIFO
-		writeRegister(REG_FIFO, packet_sent.packnum);	// Writing the packet number in FIFO
-		writeRegister(REG_FIFO, packet_sent.length); 	// Writing the packet length in FIFO
-		for(unsigned int i = 0; i < _payloadlength; i++)
+		// Writing packet to send in FIFO, a retry only patches its retry number
+		if( (_retries == 0) || (patchRetryFifo() != 0) )
 		{
-			writeRegister(REG_FIFO, packet_sent.data[i]);  // Writing the payload in FIFO
+			writePacketFifo();
 		}
-		writeRegister(REG_FIFO, packet_sent.retry);		// Writing the number retry in FIFO
 		state = 0;
 		#if (SX1278_debug_mode > 0)
 			Serial.println("## Packet set and written in FIFO ##");
@@ -4248,10 +5430,13 @@ uint8_t SX1278::setPacket(uint8_t dest, uint8_t *payload)
 			Serial.print("|");
 			Serial.print(packet_sent.length, HEX);			// Printing packet length
 			Serial.print("|");
-			for(unsigned int i = 0; i < _payloadlength; i++)
+			for(uint8_t f = 0; f < _iovCount; f++)
 			{
-				Serial.print(packet_sent.data[i], HEX);		// Printing payload
-				Serial.print("|");
+				for(unsigned int i = 0; i < _iov[f].length; i++)
+				{
+					Serial.print(_iov[f].data[i], HEX);		// Printing payload
+					Serial.print("|");
+				}
 			}
 			Serial.print(packet_sent.retry, HEX);			// Printing retry number
 			Serial.println(" ##");
@@ -4261,6 +5446,86 @@ uint8_t SX1278::setPacket(uint8_t dest, uint8_t *payload)
 	return state;
 }
 
+/*
+ Function: It writes 'packet_sent' in FIFO. Header, payload and retry number
+ go out in one burst, so the whole packet costs a single chip select and a
+ single address byte instead of one of each per byte.
+ In LoRa mode the packet is written at the end of the FIFO, away from the
+ frames received from address 0, so that it survives an ACK reception and a
+ retry can send it again from there (see patchRetryFifo()).
+ Returns: Nothing
+*/
+void SX1278::writePacketFifo()
+{
+	uint8_t header[4];
+
+	_fifoTxBase = 0x00;
+	if( _modem == LORA )
+	{
+		_fifoTxBase = (uint8_t)(0x100 - packet_sent.length);
+	}
+	writeRegister(REG_FIFO_TX_BASE_ADDR, _fifoTxBase);
+	writeRegister(REG_FIFO_ADDR_PTR, _fifoTxBase);  // Setting address pointer in FIFO data buffer
+
+	header[0] = packet_sent.dst;		// destination
+	header[1] = packet_sent.src;		// source
+	header[2] = packet_sent.packnum;	// packet number
+	#if LORA_COMPACT_HEADER
+		header[3] = packet_sent.retry;	// flags, the length is implicit
+	#else
+		header[3] = packet_sent.length;	// packet length
+	#endif
+
+	spi_write_start(REG_FIFO);
+	spi_burst_write(4, header);
+	for(uint8_t i = 0; i < _iovCount; i++)
+	{
+		spi_burst_write(_iov[i].length, _iov[i].data);	// payload fragments
+	}
+	#if !LORA_COMPACT_HEADER
+		spi_burst_write(1, &packet_sent.retry);			// retry number
+	#endif
+	spi_burst_end();
+
+	_fifoValid = true;
+}
+
+/*
+ Function: Prepares a retry of 'packet_sent' reusing the copy already in
+ FIFO: only the TX base is rewound and the retry number patched in place.
+ The FIFO keeps its contents in standby, but not in sleep mode nor when
+ another frame has been written over it (ACK sent, or a frame received
+ reaching the end of the FIFO).
+ Returns: Integer that determines if there has been any error
+   state = 1  --> The FIFO copy is not valid, the packet must be written again
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t SX1278::patchRetryFifo()
+{
+	if( !_fifoValid || (_modem != LORA) )
+	{
+		return 1;
+	}
+
+	// Last byte written by the receiver, frames are received from address 0
+	if( readRegister(REG_FIFO_RX_BYTE_ADDR) >= _fifoTxBase )
+	{
+		_fifoValid = false;
+		return 1;
+	}
+
+	writeRegister(REG_FIFO_TX_BASE_ADDR, _fifoTxBase);
+	#if LORA_COMPACT_HEADER
+		writeRegister(REG_FIFO_ADDR_PTR, _fifoTxBase + 3);	// flags byte
+	#else
+		writeRegister(REG_FIFO_ADDR_PTR, _fifoTxBase + 4 + _payloadlength);
+	#endif
+	writeFifo(&packet_sent.retry, 1);	// retry number
+	_fifoValid = true;
+
+	return 0;
+}
+
 /*
  Function: Configures the module to transmit information.
  Returns: Integer that determines if there has been any error
@@ -4295,7 +5560,6 @@ uint8_t SX1278::sendWithTimeout()
 */
 uint8_t SX1278::sendWithTimeout(uint32_t wait)
 {
-	uint8_t state = 2;
 	uint8_t value = 0x00;
 	unsigned long previous;
 
@@ -4304,35 +5568,47 @@ uint8_t SX1278::sendWithTimeout(uint32_t wait)
 		Serial.println("Starting 'sendWithTimeout'");
 	#endif
 
+	#if LORA_DUTY_CYCLE
+		if( _modem == LORA )
+		{
+			uint32_t duty_wait = nextTxTime(_payloadlength);
+
+			if( duty_wait > LORA_DUTY_MAX_DEFER_MS )
+			{
+				_airtime.rejected++;
+				return 11;	// No budget
+			}
+			if( duty_wait > 0 )
+			{
+				_airtime.deferred++;
+				previous = millis();
+				while( millis() - previous < duty_wait )
+				{
+					wait_for_interrupt();	// systick wakes the core every ms
+				}
+			}
+		}
+	#endif
+	#if LORA_CSMA
+		if( (_modem == LORA) && !listenBeforeTalk() )
+		{
+			writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+			return 10;	// The channel stayed busy
+		}
+	#endif
+
 	// wait to TxDone flag
 	previous = millis();
+	startSend();
 	if( _modem == LORA )
 	{
 		/// LoRa mode
-		// Initializing flags
-		clearFlags();
-		// LORA mode - Tx
-		writeRegister(REG_OP_MODE, LORA_TX_MODE);
-
-		value = readRegister(REG_IRQ_FLAGS);
-
 		// Wait until the packet is sent (TX Done flag) or the timeout expires
-		while ((bitRead(value, 3) == 0) && (millis() - previous < wait))
-		{
-			value = readRegister(REG_IRQ_FLAGS);
-			// Condition to avoid an overflow (DO NOT REMOVE)
-			if( millis() < previous )
-			{
-				previous = millis();
-			}
-		}
-		state = 1;
+		value = waitIrq(IRQ_TX_DONE, wait);
 	}
 	else
 	{
 		/// FSK mode
-		writeRegister(REG_OP_MODE, FSK_TX_MODE);  // FSK mode - Tx
-
 		value = readRegister(REG_IRQ_FLAGS2);
 		// Wait until the packet is sent (Packet Sent flag) or the timeout expires
 		while ((bitRead(value, 3) == 0) && (millis() - previous < wait))
@@ -4345,9 +5621,50 @@ uint8_t SX1278::sendWithTimeout(uint32_t wait)
 				previous = millis();
 			}
 		}
-		state = 1;
 	}
-	if( bitRead(value, 3) == 1 )
+	return finishSend(bitRead(value, 3) == 1);
+}
+
+/*
+ Function: Starts sending the packet stored in FIFO. It does not wait for
+ the transmission to end, see finishSend().
+ Returns: Nothing
+*/
+void SX1278::startSend()
+{
+	if( _modem == LORA )
+	{
+		/// LoRa mode
+		// Initializing flags
+		clearFlags();
+		// TxDone on DIO0
+		setDioMapping(DIO_MAPPING_TX);
+		#if LORA_DUTY_CYCLE
+			chargeAirtime();
+		#endif
+		// LORA mode - Tx
+		writeRegister(REG_OP_MODE, LORA_TX_MODE);
+	}
+	else
+	{
+		/// FSK mode
+		writeRegister(REG_OP_MODE, FSK_TX_MODE);  // FSK mode - Tx
+	}
+}
+
+/*
+ Function: Ends a transmission started with startSend().
+ Returns: Integer that determines if there has been any error
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   sent: TxDone (PacketSent in FSK) flag was raised before the timeout
+*/
+uint8_t SX1278::finishSend(bool sent)
+{
+	uint8_t state = 1;
+
+	if( sent )
 	{
 		state = 0;	// Packet successfully sent
 		#if (SX1278_debug_mode > 1)
@@ -4357,20 +5674,10 @@ uint8_t SX1278::sendWithTimeout(uint32_t wait)
 	}
 	else
 	{
-		if( state == 1 )
-		{
-			#if (SX1278_debug_mode > 1)
-				Serial.println("** Timeout has expired **");
-				Serial.println();
-			#endif
-		}
-		else
-		{
-			#if (SX1278_debug_mode > 1)
-				Serial.println("** There has been an error and packet has not been sent **");
-				Serial.println();
-			#endif
-		}
+		#if (SX1278_debug_mode > 1)
+			Serial.println("** Timeout has expired **");
+			Serial.println();
+		#endif
 	}
 
 	// Initializing flags
@@ -4378,6 +5685,32 @@ uint8_t SX1278::sendWithTimeout(uint32_t wait)
 	return state;
 }
 
+/*
+ Function: Checks without blocking if one of the flags in 'mask' is raised.
+ In FSK mode only IRQ_TX_DONE (PacketSent) and IRQ_RX_DONE (PayloadReady)
+ are checked.
+ Returns: true if raised, false otherwise
+ Parameters:
+   mask: REG_IRQ_FLAGS bits to check
+*/
+bool SX1278::irqRaised(uint8_t mask)
+{
+	uint8_t value;
+
+	if( _modem == LORA )
+	{
+		#if LORA_USE_DIO_IRQ
+			return (_irqPending & mask) != 0;
+		#else
+			return (readRegister(REG_IRQ_FLAGS) & mask) != 0;
+		#endif
+	}
+
+	value = readRegister(REG_IRQ_FLAGS2);
+	return ((mask & IRQ_TX_DONE) && (bitRead(value, 3) == 1))
+		|| ((mask & IRQ_RX_DONE) && (bitRead(value, 2) == 1));
+}
+
 /*
  Function: Configures the module to transmit information.
  Returns: Integer that determines if there has been any error
@@ -4554,6 +5887,7 @@ uint8_t SX1278::sendPacketMAXTimeoutACK(uint8_t dest,
 /*
  Function: Configures the module to transmit information and receive an ACK.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -4567,45 +5901,22 @@ uint8_t SX1278::sendPacketMAXTimeoutACK(uint8_t dest,
 */
 uint8_t SX1278::sendPacketTimeoutACK(uint8_t dest, char *payload)
 {
-	uint8_t state = 2;
-	uint8_t state_f = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACK'");
 	#endif
 
-	state = sendPacketTimeout(dest, payload);	// Sending packet to 'dest' destination
-	if( state == 0 )
-	{
-		state = receive();	// Setting Rx mode to wait an ACK
-	}
-	else
+	if( sendPacketAsync(dest, (uint8_t *)payload, strlen(payload), 0, false) == 0 )
 	{
-		state_f = state;
-	}
-	if( state == 0 )
-	{
-		if( availableData() )
-		{
-			state_f = getACK();	// Getting ACK
-		}
-		else
-		{
-			state_f = 9;
-		}
-	}
-	else
-	{
-		state_f = state;
+		return 1;	// Another operation is in progress
 	}
-
-	return state_f;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information and receive an ACK.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -4622,48 +5933,22 @@ uint8_t SX1278::sendPacketTimeoutACK(	uint8_t dest,
 											uint8_t *payload,
 											uint16_t length16)
 {
-	uint8_t state = 2;
-	uint8_t state_f = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACK'");
 	#endif
 
-	// Sending packet to 'dest' destination
-	state = sendPacketTimeout(dest, payload, length16);
-
-	// Trying to receive the ACK
-	if( state == 0 )
-	{
-		state = receive();	// Setting Rx mode to wait an ACK
-	}
-	else
-	{
-		state_f = state;
-	}
-	if( state == 0 )
-	{
-		if( availableData() )
-		{
-			state_f = getACK();	// Getting ACK
-		}
-		else
-		{
-			state_f = 9;
-		}
-	}
-	else
+	if( sendPacketAsync(dest, payload, length16, 0, false) == 0 )
 	{
-		state_f = state;
+		return 1;	// Another operation is in progress
 	}
-
-	return state_f;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information and receive an ACK.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -4680,45 +5965,22 @@ uint8_t SX1278::sendPacketTimeoutACK(	uint8_t dest,
 											char *payload,
 											uint32_t wait)
 {
-	uint8_t state = 2;
-	uint8_t state_f = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACK'");
 	#endif
 
-	state = sendPacketTimeout(dest, payload, wait);	// Sending packet to 'dest' destination
-	if( state == 0 )
-	{
-		state = receive();	// Setting Rx mode to wait an ACK
-	}
-	else
-	{
-		state_f = 1;
-	}
-	if( state == 0 )
-	{
-		if( availableData() )
-		{
-			state_f = getACK();	// Getting ACK
-		}
-		else
-		{
-			state_f = 9;
-		}
-	}
-	else
+	if( sendPacketAsync(dest, (uint8_t *)payload, strlen(payload), wait, false) == 0 )
 	{
-		state_f = 1;
+		return 1;	// Another operation is in progress
 	}
-
-	return state_f;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information and receive an ACK.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -4735,40 +5997,43 @@ uint8_t SX1278::sendPacketTimeoutACK(	uint8_t dest,
 											uint16_t length16,
 											uint32_t wait)
 {
-	uint8_t state = 2;
-	uint8_t state_f = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACK'");
 	#endif
 
-	state = sendPacketTimeout(dest, payload, length16, wait);	// Sending packet to 'dest' destination
-	if( state == 0 )
+	if( sendPacketAsync(dest, payload, length16, wait, false) == 0 )
 	{
-		state = receive();	// Setting Rx mode to wait an ACK
+		return 1;	// Another operation is in progress
 	}
-	else
+	return waitAsync();
+}
+
+/*
+ Function: Sends a packet made of several payload fragments and waits for
+ its ACK. The fragments go straight from the caller's buffers to the FIFO.
+ Returns: same codes as sendPacketTimeoutACK()
+ Parameters:
+   dest: packet destination
+   iov: payload fragments, in order
+   count: number of fragments, up to MAX_IOV
+   wait: time to wait to send the packet, 0 for _sendTime
+*/
+uint8_t SX1278::sendPacketTimeoutACK(	uint8_t dest,
+											lora_iovec *iov,
+											uint8_t count,
+											uint32_t wait)
+{
+	#if (SX1278_debug_mode > 1)
+		Serial.println();
+		Serial.println("Starting 'sendPacketTimeoutACK'");
+	#endif
+
+	if( sendPacketAsync(dest, iov, count, wait, false) == 0 )
 	{
-		state_f = 1;
+		return 1;	// Another operation is in progress
 	}
-	if( state == 0 )
-	{
-		if( availableData() )
-		{
-			state_f = getACK();	// Getting ACK
-		}
-		else
-		{
-			state_f = 9;
-		}
-	}
-	else
-	{
-		state_f = 1;
-	}
-
-	return state_f;
+	return waitAsync();
 }
 
 /*
@@ -4777,7 +6042,7 @@ uint8_t SX1278::sendPacketTimeoutACK(	uint8_t dest,
 */
 uint8_t SX1278::getACK()
 {
-	return getACK(MAX_TIMEOUT);
+	return getACK(ackWaitTime());
 }
 
 /*
@@ -4811,16 +6076,8 @@ uint8_t SX1278::getACK(uint32_t wait)
 
 	if( _modem == LORA )
 	{ // LoRa mode
-	    value = readRegister(REG_IRQ_FLAGS);
 		// Wait until the ACK is received (RxDone flag) or the timeout expires
-		while ((bitRead(value, 6) == 0) && (millis() - previous < wait))
-		{
-			value = readRegister(REG_IRQ_FLAGS);
-			if( millis() < previous )
-			{
-				previous = millis();
-			}
-		}
+		value = waitIrq(IRQ_RX_DONE | IRQ_RX_TIMEOUT, wait);
 		if( bitRead(value, 6) == 1 )
 		{ // ACK received
 			a_received = true;
@@ -4852,11 +6109,16 @@ uint8_t SX1278::getACK(uint32_t wait)
 	{
 //----	writeRegister(REG_FIFO_ADDR_PTR, 0x00);  // Setting address pointer in FIFO data buffer
 		// Storing the received ACK
+		uint8_t ack_buf[ACK_LENGTH - 1];
+		readFifo(ack_buf, ACK_LENGTH - 1);
 		ACK.dst = _destination;
-		ACK.src = readRegister(REG_FIFO);
-		ACK.packnum = readRegister(REG_FIFO);
-		ACK.length = readRegister(REG_FIFO);
-		ACK.data[0] = readRegister(REG_FIFO);
+		ACK.src = ack_buf[0];
+		ACK.packnum = ack_buf[1];
+		ACK.length = ack_buf[2];
+		ACK.data[0] = ack_buf[3];
+		#if LORA_POWER_CONTROL
+			ACK.data[1] = ack_buf[4];
+		#endif
 
 		// Checking the received ACK
 		if( ACK.dst == packet_sent.src )
@@ -4865,9 +6127,9 @@ uint8_t SX1278::getACK(uint32_t wait)
 			{
 				if( ACK.packnum == packet_sent.packnum )
 				{
-					if( ACK.length == 0 )
+					if( ACK.length == ACK_MARK )
 					{
-						if( ACK.data[0] == CORRECT_PACKET )
+						if( (ACK.data[0] & ACK_STATUS_MASK) == CORRECT_PACKET )
 						{
 							state = 0;
 							#if (SX1278_debug_mode > 0)
@@ -4973,6 +6235,7 @@ uint8_t SX1278::sendPacketMAXTimeoutACKRetries(	uint8_t dest,
 /*
  Function: Configures the module to transmit information with retries in case of error.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -4986,28 +6249,22 @@ uint8_t SX1278::sendPacketMAXTimeoutACKRetries(	uint8_t dest,
 */
 uint8_t SX1278::sendPacketTimeoutACKRetries(uint8_t dest, char *payload)
 {
-	uint8_t state = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACKRetries'");
 	#endif
 
-	// Sending packet to 'dest' destination and waiting an ACK response.
-	state = 1;
-	while( (state != 0) && (_retries <= _maxRetries) )
+	if( sendPacketAsync(dest, (uint8_t *)payload, strlen(payload), 0, true) == 0 )
 	{
-		state = sendPacketTimeoutACK(dest, payload);
-		_retries++;
+		return 1;	// Another operation is in progress
 	}
-	_retries = 0;
-
-	return state;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information with retries in case of error.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -5023,28 +6280,22 @@ uint8_t SX1278::sendPacketTimeoutACKRetries(uint8_t dest,
 												uint8_t *payload,
 												uint16_t length16)
 {
-	uint8_t state = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACKRetries'");
 	#endif
 
-	// Sending packet to 'dest' destination and waiting an ACK response.
-	state = 1;
-	while( (state != 0) && (_retries <= _maxRetries) )
+	if( sendPacketAsync(dest, payload, length16, 0, true) == 0 )
 	{
-		state = sendPacketTimeoutACK(dest, payload, length16);
-		_retries++;
+		return 1;	// Another operation is in progress
 	}
-	_retries = 0;
-
-	return state;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information with retries in case of error.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -5060,28 +6311,22 @@ uint8_t SX1278::sendPacketTimeoutACKRetries(uint8_t dest,
 												char *payload,
 												uint32_t wait)
 {
-	uint8_t state = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACKRetries'");
 	#endif
 
-	// Sending packet to 'dest' destination and waiting an ACK response.
-	state = 1;
-	while( (state != 0) && (_retries <= _maxRetries) )
+	if( sendPacketAsync(dest, (uint8_t *)payload, strlen(payload), wait, true) == 0 )
 	{
-		state = sendPacketTimeoutACK(dest, payload, wait);
-		_retries++;
+		return 1;	// Another operation is in progress
 	}
-	_retries = 0;
-
-	return state;
+	return waitAsync();
 }
 
 /*
  Function: Configures the module to transmit information with retries in case of error.
  Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
    state = 9  --> The ACK lost (no data available)
    state = 8  --> The ACK lost
    state = 7  --> The ACK destination incorrectly received
@@ -5098,149 +6343,1262 @@ uint8_t SX1278::sendPacketTimeoutACKRetries(uint8_t dest,
 												uint16_t length16,
 												uint32_t wait)
 {
-	uint8_t state = 2;
-
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
 		Serial.println("Starting 'sendPacketTimeoutACKRetries'");
 	#endif
 
-	// Sending packet to 'dest' destination and waiting an ACK response.
-	state = 1;
-	while( (state != 0) && (_retries <= _maxRetries) )
+	if( sendPacketAsync(dest, payload, length16, wait, true) == 0 )
 	{
-		state = sendPacketTimeoutACK(dest, payload, length16, wait);
-		_retries++;
+		return 1;	// Another operation is in progress
 	}
-	_retries = 0;
+	return waitAsync();
+}
 
-	return state;
+/*
+ Function: Moves the packets received in RXCONTINUOUS mode to the RX queue
+ without leaving reception. The radio FIFO is used as a 256-byte ring: the
+ module keeps writing each new packet after the previous one and only the
+ last one is reported (REG_FIFO_RX_CURRENT_ADDR, REG_RX_NB_BYTES). Packets
+ that arrived before it are found from '_rxTail' with their length byte, or
+ with ACK_LENGTH for an ACK (its length byte is ACK_MARK).
+ PayloadCrcError stays set from the first failed packet until it is cleared
+ here, so without it all of them passed their CRC. With it, the failed one
+ is not known: all are dropped, the last one counted in '_rxCrcErrors' and
+ the ones before it in '_rxLost'. The compact header has no length byte:
+ those packets are skipped and counted in '_rxLost' too.
+ Returns: Number of frames in the RX queue
+*/
+uint8_t SX1278::serviceRx()
+{
+	uint8_t value;
+	uint8_t current;
+	uint8_t last;
+	#if !LORA_COMPACT_HEADER
+		uint8_t sz;
+		uint8_t header[OFFSET_PAYLOADLENGTH];
+	#endif
+
+	if( (_modem != LORA) || !irqRaised(IRQ_RX_DONE) )
+	{
+		return rx_queue_count();
+	}
+
+	// The packet pointers are read before the flags are cleared: a packet
+	// ending after them is found from '_rxTail' on the next RxDone
+	value = readRegister(REG_IRQ_FLAGS);
+	current = readRegister(REG_FIFO_RX_CURRENT_ADDR);
+	last = readRegister(REG_RX_NB_BYTES);
+	// Only the reception flags are cleared, the module stays in RX
+	writeRegister(REG_IRQ_FLAGS, IRQ_RX_DONE | IRQ_PAYLOAD_CRC_ERROR | IRQ_VALID_HEADER);
+	disable_interrupts();
+	_irqPending &= ~IRQ_RX_DONE;
+	enable_interrupts();
+
+	// Packets not signalled separately
+	#if LORA_COMPACT_HEADER
+		if( _rxTail != current )
+		{ // Only the last frame has a known length (REG_RX_NB_BYTES)
+			_rxLost++;
+			#if (SX1278_debug_mode > 0)
+				Serial.println("** Packets before the last one have no length, skipping them **");
+			#endif
+		}
+	#else
+	if( (bitRead(value, 5) == 1) && (_rxTail != current) )
+	{ // One of them failed its CRC, none can be trusted
+		_rxLost++;
+		_rxTail = current;
+	}
+	while( _rxTail != current )
+	{
+		writeRegister(REG_FIFO_ADDR_PTR, _rxTail);
+		readFifo(header, OFFSET_PAYLOADLENGTH);
+		sz = header[3];
+		if( sz == ACK_MARK )
+		{ // An ACK overheard, or the one waited for
+			sz = (header[4] & ACK_BLOCK) ? ACK_LENGTH + 1 : ACK_LENGTH;
+		}
+		if( (sz < OFFSET_PAYLOADLENGTH) || (sz > (uint8_t)(current - _rxTail)) )
+		{
+			#if (SX1278_debug_mode > 0)
+				Serial.println("** Lost track of the FIFO, skipping to the last packet **");
+			#endif
+			break;
+		}
+		queueFrame(_rxTail, sz);
+		_rxTail = (uint8_t)(_rxTail + sz);
+	}
+	#endif
+
+	// Last packet
+	if( bitRead(value, 5) == 0 )
+	{
+		queueFrame(current, last);
+	}
+	else
+	{
+		_rxCrcErrors++;
+		#if (SX1278_debug_mode > 0)
+			Serial.println("** The CRC is incorrect **");
+		#endif
+	}
+	_rxTail = (uint8_t)(current + last);
+
+	return rx_queue_count();
 }
 
 /*
- Function: It gets the temperature from the measurement block module.
+ Function: Copies a frame of the radio FIFO to the RX queue. The FIFO
+ address pointer wraps from 0xFF to 0x00, so a frame crossing the end of
+ the FIFO is still read in a single burst. Frames longer than RX_FRAME_MAX
+ are not copied.
+ Returns: Nothing
+ Parameters:
+   addr: FIFO address of the first byte
+   sz: frame size
+*/
+void SX1278::queueFrame(uint8_t addr, uint8_t sz)
+{
+	rx_frame *frame = rx_queue_push(sz);
+
+	if( frame == 0 )
+	{
+		return;	// queue full or frame too long, counted in rx_queue_dropped
+	}
+	writeRegister(REG_FIFO_ADDR_PTR, addr);
+	readFifo(frame->data, sz);
+	frame->sz = sz;
+	rx_queue_commit();
+}
+
+/*
+ Function: Moves the oldest frame of the RX queue to 'packet_received'.
  Returns: Integer that determines if there has been any error
-   state = 2  --> The command has not been executed
-   state = 1  --> There has been an error while executing the command
+   state = 1  --> Queue empty, frame corrupted or not for this node
    state = 0  --> The command has been executed with no errors
 */
-uint8_t SX1278::getTemp()
+uint8_t SX1278::takePacket()
 {
-	uint8_t st0;
-	uint8_t state = 2;
+	uint8_t state = 1;
+	rx_frame *frame = rx_queue_front();
 
-	#if (SX1278_debug_mode > 1)
-		Serial.println();
-		Serial.println("Starting 'getTemp'");
+	if( frame == 0 )
+	{
+		return 1;
+	}
+
+	#if LORA_COMPACT_HEADER
+		// Frame size is the length, ACKs are told apart by their flags
+		bool valid = (frame->sz >= OFFSET_PAYLOADLENGTH) && !(frame->data[3] & ACK_MARK);
+	#else
+		// Frame size must match the length byte of the header
+		bool valid = (frame->sz >= OFFSET_PAYLOADLENGTH) && (frame->data[3] == frame->sz);
 	#endif
+	if( valid && (frame->sz - OFFSET_PAYLOADLENGTH <= _rxBufferSize) )
+	{
+		packet_received.dst = frame->data[0];
+		packet_received.src = frame->data[1];
+		packet_received.packnum = frame->data[2];
+		packet_received.length = frame->sz;
+		_payloadlength = packet_received.length - OFFSET_PAYLOADLENGTH;
+		for(unsigned int i = 0; i < _payloadlength; i++)
+		{
+			packet_received.data[i] = frame->data[4 + i];
+		}
+		#if LORA_COMPACT_HEADER
+			packet_received.retry = frame->data[3];
+		#else
+			packet_received.retry = frame->data[frame->sz - 1];
+		#endif
 
-	st0 = readRegister(REG_OP_MODE);	// Save the previous status
+		// Checking destination
+		_destination = packet_received.dst;
+		if( (_destination == _nodeAddress) || (_destination == BROADCAST_0) )
+		{
+			_reception = CORRECT_PACKET;
+			state = 0;
+		}
+		else
+		{
+			_reception = INCORRECT_PACKET;
+		}
+	}
+	rx_queue_pop();
 
-	if( _modem == LORA )
-	{ // Allowing access to FSK registers while in LoRa standby mode
-		writeRegister(REG_OP_MODE, LORA_STANDBY_FSK_REGS_MODE);
+	return state;
+}
+
+/*
+ Function: Starts sending a packet and waiting for its ACK. It returns as
+ soon as the packet is on air; poll() drives the rest of the exchange.
+ Returns: Handle of the operation, 0 if another one is in progress
+ Parameters:
+   dest: packet destination
+   payload: packet payload, not copied: keep it until completion
+   length16: payload length
+   wait: time to wait to send the packet, 0 to compute it with setTimeout()
+   retries: retry up to '_maxRetries' times if the ACK is not received
+   callback: called once when the operation completes (can be 0)
+*/
+lora_async *SX1278::sendPacketAsync(uint8_t dest,
+									uint8_t *payload,
+									uint16_t length16,
+									uint32_t wait,
+									bool retries,
+									lora_async_callback callback)
+{
+	lora_iovec iov;
+
+	if( (_async.step != ASYNC_IDLE) && (_async.step != ASYNC_DONE) )
+	{
+		return 0;
 	}
 
-	state = 1;
-	// Saving temperature value
-	_temp = readRegister(REG_TEMP);
-	if( _temp & 0x80 ) // The SNR sign bit is 1
+	truncPayload(length16);
+	iov.data = payload;
+	iov.length = _payloadlength;
+	return sendPacketAsync(dest, &iov, 1, wait, retries, callback);
+}
+
+/*
+ Function: Starts sending a packet made of several payload fragments and
+ waiting for its ACK. The fragments are streamed into the FIFO, the caller's
+ buffers must stay valid until the operation completes.
+ Returns: handle of the operation, 0 if another one is in progress
+ Parameters:
+   dest: packet destination
+   iov: payload fragments, in order
+   count: number of fragments, up to MAX_IOV
+   wait: time to wait to send the packet, 0 for _sendTime
+   retries: retry up to '_maxRetries' times if no ACK
+   callback: called on completion (can be 0)
+*/
+lora_async *SX1278::sendPacketAsync(uint8_t dest,
+									lora_iovec *iov,
+									uint8_t count,
+									uint32_t wait,
+									bool retries,
+									lora_async_callback callback)
+{
+	if( (_async.step != ASYNC_IDLE) && (_async.step != ASYNC_DONE) )
 	{
-		// Invert and divide by 4
-		_temp = ( ( ~_temp + 1 ) & 0xFF );
-    }
-    else
-    {
-		// Divide by 4
-		_temp = ( _temp & 0xFF );
+		return 0;
 	}
 
+	_async.op = ASYNC_SEND;
+	_async.retries = retries;
+	_async.wait = wait;
+	_async.callback = callback;
 
-	#if (SX1278_debug_mode > 1)
-		Serial.print("## Temperature is: ");
-		Serial.print(_temp);
-		Serial.println(" ##");
-		Serial.println();
-	#endif
+	startAsyncTx(dest, iov, count);
+	return &_async;
+}
 
-	if( _modem == LORA )
+/*
+ Function: Starts waiting for a packet to reply with an ACK. poll() drives
+ the reception, the ACK delay and the ACK transmission.
+ Returns: Handle of the operation, 0 if another one is in progress
+ Parameters:
+   wait: time to wait for the packet
+   set_state: set Rx mode first
+   callback: called once when the operation completes (can be 0)
+*/
+lora_async *SX1278::receivePacketAsync(uint32_t wait,
+										bool set_state,
+										lora_async_callback callback)
+{
+	if( (_async.step != ASYNC_IDLE) && (_async.step != ASYNC_DONE) )
 	{
-		writeRegister(REG_OP_MODE, st0);	// Getting back to previous status
+		return 0;
 	}
 
-	state = 0;
-	return state;
+	_async.op = ASYNC_RECEIVE;
+	_async.retries = false;
+	_async.callback = callback;
+
+	// set RX mode
+	if( set_state && (receive() != 0) )
+	{
+		completeAsync(1);	// There has been an error with the 'receive' function
+		return &_async;
+	}
+
+	_async.step = ASYNC_RX;
+	_async.wait = wait;
+	_async.previous = millis();
+	return &_async;
 }
 
 /*
- Function: It prints the registers related to RX
- Returns: Integer that determines if there has been any error
-   state = 2  --> The command has not been executed
-   state = 1  --> There has been an error while executing the command
-   state = 0  --> The command has been executed with no errors
+ Function: Writes the packet of an asynchronous send in FIFO and puts it on
+ air. Retries only rewrite the length and the retry number.
+ Returns: Nothing
 */
-void SX1278::showRxRegisters()
+void SX1278::startAsyncTx(uint8_t dest, lora_iovec *iov, uint8_t count)
 {
-	Serial.println("\n--- Show RX register ---");
+	uint8_t state;
 
-	// variable
-	uint8_t reg;
+	#if LORA_POWER_CONTROL
+		powerForPeer(dest);
+	#endif
+	state = setPacket(dest, iov, count);
+	if( state != 0 )
+	{
+		endAsyncTx(state);
+		return;
+	}
 
-	for(int i = 0x00; i < 0x80; i++)
+	if( _async.wait == 0 )
 	{
-		reg = readRegister(i);
-		Serial.print("Reg 0x");
-		Serial.print(i, HEX);
-		Serial.print(":");
-		Serial.print(reg, HEX);
-		Serial.println();
-		wait_with_timer2(100);
+		setTimeout();
+		_async.wait = _sendTime;
 	}
+	startTransmit(ASYNC_TX, true);
+}
 
-	Serial.println("------------------------");
+/*
+ Function: Puts the packet written in FIFO on air for the step given. With
+ LORA_CSMA and 'listen' the channel is checked first: the packet waits in
+ FIFO, through ASYNC_CAD and ASYNC_BACKOFF, until a CAD finds it free.
+ Returns: Nothing
+ Parameters:
+   step: step of the transmission (ASYNC_TX or ASYNC_WIN_TX), '_async.wait'
+   is its timeout
+   listen: true to check the channel first
+*/
+void SX1278::startTransmit(uint8_t step, bool listen)
+{
+	#if !LORA_CSMA && !LORA_DUTY_CYCLE
+		(void)listen;
+	#endif
+	#if LORA_DUTY_CYCLE
+		if( _modem == LORA )
+		{
+			uint32_t wait = nextTxTime(_payloadlength);
 
+			if( wait > LORA_DUTY_MAX_DEFER_MS )
+			{
+				_airtime.rejected++;
+				failTransmit(step, 11);
+				return;
+			}
+			if( wait > 0 )
+			{ // The packet waits in FIFO for the budget
+				_airtime.deferred++;
+				_airtime.next = step;
+				_airtime.wait = _async.wait;
+				_airtime.listen = listen;
+				_async.step = ASYNC_DUTY_WAIT;
+				_async.wait = wait;
+				_async.previous = millis();
+				return;
+			}
+		}
+	#endif
+	#if LORA_CSMA
+		if( listen && (_modem == LORA) )
+		{
+			_csma.next = step;
+			_csma.wait = _async.wait;
+			_csma.slot = timeOnAir() + 1;
+			_csma.attempt = 0;
+			startCad();
+			return;
+		}
+	#endif
+	_async.step = step;
+	_async.previous = millis();
+	startSend();
 }
 
 /*
- Function: It sets the CAD mode to search Channel Activity Detection
- Returns: Integer that determines if there has been any error
-   state = true   --> Channel Activity Detected
-   state = false  --> Channel Activity NOT Detected
+ Function: Ends an operation whose packet could not be put on air. A single
+ packet send goes through its retries, a windowed send completes.
+ Returns: Nothing
+ Parameters:
+   step: step of the transmission (ASYNC_TX or ASYNC_WIN_TX)
+   state: state code of the operation
 */
-bool SX1278::cadDetected()
+void SX1278::failTransmit(uint8_t step, uint8_t state)
 {
-	uint8_t val = 0;
+	writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+	if( step == ASYNC_TX )
+	{
+		endAsyncTx(state);
+	}
+	else
+	{
+		completeAsync(state);
+	}
+}
 
-	// get actual time
-	unsigned long time = millis();
+#if LORA_CSMA
+/*
+ Function: Starts a channel activity detection. CadDone ends ASYNC_CAD, the
+ CadDetected flag tells if a preamble was heard.
+ Returns: Nothing
+*/
+void SX1278::startCad()
+{
+	clearFlags();
+	// CadDone on DIO0, CadDetected on DIO1
+	setDioMapping(DIO_MAPPING_CAD);
+	writeRegister(REG_OP_MODE, LORA_CAD_MODE);
+	_csma.cads++;
+
+	_async.step = ASYNC_CAD;
+	_async.wait = cadTime();
+	_async.previous = millis();
+}
 
-	// set LNA
-	sx1278.writeRegister(REG_LNA,0x23);
-	sx1278.clearFlags();
+/*
+ Function: Draws the wait after a busy CAD: a random number of slots,
+ 0 .. 2^attempt - 1 (binary exponential backoff, the exponent is limited to
+ LORA_CSMA_MAX_BE). A slot is the time-on-air of the packet waiting, about
+ the time the other transmission needs to end.
+ Returns: Wait in ms
+*/
+uint32_t SX1278::backoffTime()
+{
+	uint8_t be = (_csma.attempt < LORA_CSMA_MAX_BE) ? _csma.attempt : LORA_CSMA_MAX_BE;
+	uint32_t x = _csma.random;
 
-    sx1278.getRSSI();
+	if( x == 0 )
+	{ // Seeded once from the noise in the wideband RSSI, so two nodes that
+	  // found the channel busy together do not pick the same slots
+		for( uint8_t i = 0; i < 32; i++ )
+		{
+			x = (x << 1) | (readRegister(REG_RSSI_WIDEBAND) & 0x01);
+		}
+		x ^= ((uint32_t)_nodeAddress << 24) ^ millis();
+		if( x == 0 )
+		{
+			x = 1;
+		}
+	}
+	// xorshift32
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	_csma.random = x;
 
-	#if (SX1278_debug_mode > 1)
-		Serial.print("Inside CAD DETECTION -> RSSI: ");
-		Serial.println(sx1278._RSSI);
-	#endif
+	x = (x & ((1UL << be) - 1)) * _csma.slot;
+	_csma.backoffMs += x;
+	return x;
+}
 
-	if( _modem == LORA )
-	{
-		#if (SX1278_debug_mode > 1)
-			Serial.println("Set CAD mode");
-		#endif
+/*
+ Function: Checks the channel before a blocking send, with a random backoff
+ while it is busy.
+ Returns: true if the channel is free, false after LORA_CSMA_ATTEMPTS busy CADs
+*/
+bool SX1278::listenBeforeTalk()
+{
+	uint32_t wait;
+	unsigned long previous;
 
-		// Setting LoRa CAD mode
-		sx1278.writeRegister(REG_OP_MODE,0x87);
+	_csma.slot = timeOnAir() + 1;
+	_csma.attempt = 0;
+	while( cadDetected() )
+	{
+		_csma.busy++;
+		_csma.attempt++;
+		if( _csma.attempt >= LORA_CSMA_ATTEMPTS )
+		{
+			_csma.dropped++;
+			return false;
+		}
+		wait = backoffTime();
+		previous = millis();
+		while( millis() - previous < wait )
+		{
+			wait_for_interrupt();	// systick wakes the core every ms
+		}
 	}
+	return true;
+}
+#endif
 
-	// Wait for IRQ CadDone
-    val = sx1278.readRegister(REG_IRQ_FLAGS);
-    while((bitRead(val,2) == 0) && (millis()-time)<10000 )
-    {
-      val = sx1278.readRegister(REG_IRQ_FLAGS);
+/*
+ Function: Ends an attempt of an asynchronous send. On failure the packet is
+ sent again while retries are allowed, otherwise the operation completes.
+ Returns: Nothing
+ Parameters:
+   state: state code of the attempt, same as sendPacketTimeoutACK
+*/
+void SX1278::endAsyncTx(uint8_t state)
+{
+	#if LORA_ADR
+		if( state != 0 )
+		{ // Silent for too long: the next attempt goes in LORA_MODE
+			adrFallback();
+		}
+	#endif
+	#if LORA_POWER_CONTROL
+		if( state != 0 )
+		{ // Not acknowledged, the next attempt goes at full power
+			peer(packet_sent.dst)->power = LORA_TPC_MAX_DBM;
+		}
+	#endif
+	#if LORA_CSMA
+		if( (state == 8) || (state == 9) )
+		{ // Sent but not acknowledged: mostly a collision at the receiver
+			_csma.collisions++;
+		}
+	#endif
+	if( !_async.retries )
+	{
+		completeAsync(state);
+		return;
+	}
+
+	_retries++;
+	if( (state != 0) && (_retries <= _maxRetries) )
+	{
+		startAsyncTx(packet_sent.dst, _iov, _iovCount);
+		return;
+	}
+	_retries = 0;
+	completeAsync(state);
+}
+
+/*
+ Function: Sets the number of packets in flight in windowed mode.
+ Returns: Integer that determines if there has been any error
+   state = 1  --> Size out of range, not changed
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   size: window size, 1 .. MAX_WINDOW
+*/
+uint8_t SX1278::setWindowSize(uint8_t size)
+{
+	if( (size == 0) || (size > MAX_WINDOW) )
+	{
+		return 1;
+	}
+	_windowSize = size;
+	return 0;
+}
+
+/*
+ Function: Starts sending a message split in packets of 'chunk' bytes, with
+ up to '_windowSize' packets in flight (selective repeat). Each burst sends
+ the packets of the window not acknowledged yet and only the last one asks
+ for a block ACK, so the ACK delay is paid once per burst instead of once per
+ packet. poll() drives the rest of the transfer.
+ Returns: Handle of the operation, 0 if another one is in progress
+ Parameters:
+   dest: message destination
+   data: message, not copied: it must stay valid until completion
+   length: message length
+   chunk: payload bytes per packet
+   callback: called once when the operation completes (can be 0)
+*/
+lora_async *SX1278::sendWindowAsync(uint8_t dest,
+									uint8_t *data,
+									uint16_t length,
+									uint8_t chunk,
+									lora_async_callback callback)
+{
+	uint16_t count;
+
+	if( (_async.step != ASYNC_IDLE) && (_async.step != ASYNC_DONE) )
+	{
+		return 0;
+	}
+
+	_async.op = ASYNC_SEND_WINDOW;
+	_async.retries = true;
+	_async.wait = 0;
+	_async.callback = callback;
+
+	count = (chunk == 0) ? 0 : (length + chunk - 1) / chunk;
+	if( (_modem != LORA) || (chunk > MAX_PAYLOAD - WINDOW_HEADER) || (count == 0) || (count > 0xFF) )
+	{
+		completeAsync(1);
+		return &_async;
+	}
+
+	_win.data = data;
+	_win.length = length;
+	_win.dest = dest;
+	_win.chunk = chunk;
+	_win.count = count;
+	_win.seq = _packetNumber;
+	_win.base = 0;
+	_win.acked = 0;
+	_win.rounds = 0;
+	_packetNumber += count;
+
+	startWindowBurst();
+	return &_async;
+}
+
+/*
+ Function: Sends a message split in a window of packets and waits for all of
+ them to be acknowledged.
+ Returns: Integer that determines if there has been any error
+   state = 10 --> The channel stayed busy (LORA_CSMA)
+   state = 9  --> A window got no ACK after '_maxRetries' bursts
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+ Parameters:
+   dest: message destination
+   data: message
+   length: message length
+   chunk: payload bytes per packet
+*/
+uint8_t SX1278::sendPacketWindow(uint8_t dest,
+								uint8_t *data,
+								uint16_t length,
+								uint8_t chunk)
+{
+	if( sendWindowAsync(dest, data, length, chunk) == 0 )
+	{
+		return 1;
+	}
+	return waitAsync();
+}
+
+/*
+ Function: Finds the next packet of the window not acknowledged yet.
+ Returns: Packet index, '_win.count' if there is none
+ Parameters:
+   from: first packet index to check
+*/
+uint8_t SX1278::nextWindowPacket(uint8_t from)
+{
+	uint16_t end = _win.base + _windowSize;
+
+	if( end > _win.count )
+	{
+		end = _win.count;
+	}
+	for( ; from < end; from++ )
+	{
+		if( !(_win.acked & (1 << (from - _win.base))) )
+		{
+			return from;
+		}
+	}
+	return _win.count;
+}
+
+/*
+ Function: Starts a burst with the packets of the window not acknowledged
+ yet. The last one of them carries the block ACK request.
+ Returns: Nothing
+*/
+void SX1278::startWindowBurst()
+{
+	uint8_t idx = nextWindowPacket(_win.base);
+
+	#if LORA_POWER_CONTROL
+		powerForPeer(_win.dest);
+	#endif
+	_win.pos = idx;
+	while( idx != _win.count )
+	{
+		_win.last = idx;
+		idx = nextWindowPacket(idx + 1);
+	}
+	sendWindowPacket(_win.pos, true);
+}
+
+/*
+ Function: Writes a packet of the windowed message in FIFO and puts it on
+ air. Its packet number is given by its place in the message, so a
+ retransmission carries the same number as the first attempt. The payload
+ is sent after its offset in the message, for the receiver to put it back
+ in place whatever the order the packets arrive in.
+ Returns: Nothing
+ Parameters:
+   idx: packet index in the message
+*/
+void SX1278::sendWindowPacket(uint8_t idx, bool listen)
+{
+	uint16_t offset = idx * _win.chunk;
+	uint8_t header[WINDOW_HEADER];
+
+	clearFlags();	// Initializing flags
+	writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);	// Stdby LoRa mode to write in FIFO
+	#if LORA_LOW_POWER_RX
+		wakePacket(LORA_STANDBY_MODE);
+	#endif
+
+	header[0] = offset >> 8;
+	header[1] = offset & 0xFF;
+	_iov[0].data = header;
+	_iov[0].length = WINDOW_HEADER;
+	_iov[1].data = _win.data + offset;
+	_iov[1].length = _win.chunk;
+	if( _win.length - offset < _win.chunk )
+	{
+		_iov[1].length = _win.length - offset;
+	}
+	_iovCount = 2;
+	_payloadlength = WINDOW_HEADER + _iov[1].length;
+	packet_sent.dst = _win.dest;
+	packet_sent.src = _nodeAddress;
+	packet_sent.packnum = _win.seq + idx;
+	packet_sent.data = _iov[1].data;
+	packet_sent.retry = WINDOW_FRAME | (_win.rounds & WINDOW_RETRY_MASK);
+	if( idx == _win.last )
+	{
+		packet_sent.retry |= WINDOW_ACK_REQUEST;
+	}
+	if( idx == _win.count - 1 )
+	{
+		packet_sent.retry |= WINDOW_LAST;
+	}
+
+	if( setPacketLength() != 0 )
+	{
+		completeAsync(1);
+		return;
+	}
+	writePacketFifo();
+
+	setTimeout();
+	_async.wait = _sendTime;
+	startTransmit(ASYNC_WIN_TX, listen);
+}
+
+/*
+ Function: Applies a block ACK to the window and slides it over the leading
+ packets acknowledged.
+ Returns: true if a packet has been acknowledged for the first time
+ Parameters:
+   packnum: packet number acknowledged by the block ACK
+   bitmap: bit i set if packet 'packnum - i' has been received
+*/
+bool SX1278::windowAck(uint8_t packnum, uint8_t bitmap)
+{
+	bool progress = false;
+	uint8_t idx;
+	uint8_t bit;
+
+	for( uint8_t i = 0; i < MAX_WINDOW; i++ )
+	{
+		if( !(bitmap & (1 << i)) )
+		{
+			continue;
+		}
+		idx = packnum - i - _win.seq;
+		if( (idx < _win.base) || (idx >= _win.count) || (idx - _win.base >= MAX_WINDOW) )
+		{
+			continue;	// not in the window
+		}
+		bit = 1 << (idx - _win.base);
+		if( !(_win.acked & bit) )
+		{
+			_win.acked |= bit;
+			progress = true;
+		}
+	}
+
+	while( (_win.acked & 1) && (_win.base < _win.count) )
+	{
+		_win.acked >>= 1;
+		_win.base++;
+	}
+	return progress;
+}
+
+/*
+ Function: Ends the operation in progress and calls its callback.
+ Returns: Nothing
+ Parameters:
+   result: state code of the operation
+*/
+void SX1278::completeAsync(uint8_t result)
+{
+	_async.result = result;
+	_async.step = ASYNC_DONE;
+	if( _async.callback != 0 )
+	{
+		_async.callback(&_async);
+	}
+}
+
+/*
+ Function: Advances the operation in progress by at most one step. It never
+ waits: each step only checks its completion flag or its timeout.
+ Returns: true while the operation is in progress, false otherwise
+*/
+bool SX1278::poll()
+{
+	uint8_t state = 1;
+	bool progress = false;
+	rx_frame *frame;
+	uint8_t i;
+	bool expired = (millis() - _async.previous >= _async.wait);
+	#if LORA_ADR
+		uint8_t adr_mode = 0;
+	#endif
+
+	switch( _async.step )
+	{
+		case ASYNC_TX:
+			if( irqRaised(IRQ_TX_DONE) )
+			{
+				state = finishSend(true);
+			}
+			else if( expired )
+			{
+				state = finishSend(false);
+			}
+			else
+			{
+				break;
+			}
+
+			// Setting Rx mode to wait an ACK
+			if( (state == 0) && (rearm(LORA_IMPLICIT_ACK ? ACK_LENGTH : 0, true) == 0) )
+			{
+				_async.step = ASYNC_ACK_WAIT;
+				_async.wait = ackWaitTime();
+				_async.previous = millis();
+			}
+			else
+			{
+				endAsyncTx(1);
+			}
+			break;
+
+		case ASYNC_ACK_WAIT:
+			if( !irqRaised(IRQ_RX_DONE | IRQ_RX_TIMEOUT) && !expired )
+			{
+				break;
+			}
+			if( availableData(0) )
+			{
+				state = getACK(0);	// Getting ACK
+			}
+			else
+			{
+				state = 9;	// The ACK lost (no data available)
+			}
+			#if LORA_IMPLICIT_ACK
+				// A retry is sent with the normal header
+				writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+				setImplicitHeader(false);
+			#endif
+			#if LORA_ADR
+				if( state == 0 )
+				{ // The receiver switches after this ACK, so do we
+					adrSample();
+					adrSwitch(adr_decode(ACK.data[0] >> ACK_ADR_SHIFT));
+				}
+			#endif
+			#if LORA_POWER_CONTROL
+				if( state == 0 )
+				{
+					powerControl(ACK.src, (int8_t)ACK.data[1]);
+				}
+			#endif
+			endAsyncTx(state);
+			break;
+
+		case ASYNC_RX:
+			serviceRx();
+			if( rx_queue_count() == 0 )
+			{
+				if( expired )
+				{
+					completeAsync(1);	// There is no packet received
+				}
+				break;
+			}
+			if( takePacket() != 0 )
+			{
+				completeAsync(1);
+				break;
+			}
+			_async.duplicate = false;
+			#if LORA_ADR
+				// Mode offered in the ACK, taken once the ACK is sent
+				adrSample();
+				_adrOffer = adr_pick(&_adr);
+				if( _adrOffer == _adr.mode )
+				{
+					_adrOffer = 0;
+				}
+			#endif
+			if( packet_received.retry & WINDOW_FRAME )
+			{ // Windowed packet, only the last one of a burst is acknowledged
+				_async.duplicate = !windowReceived(packet_received.src, packet_received.packnum);
+				if( !_async.duplicate )
+				{
+					windowStore();
+				}
+				if( !(packet_received.retry & WINDOW_ACK_REQUEST) )
+				{
+					completeAsync(_async.duplicate ? 5 : 0);
+					break;
+				}
+				state = setBlockACK();
+			}
+			else
+			{
+				state = setACK();
+			}
+			if( state == 0 )
+			{
+				// Give the sender time to switch to Rx mode
+				_async.step = ASYNC_ACK_DELAY;
+				_async.wait = ackDelay();
+				_async.previous = millis();
+			}
+			else
+			{
+				completeAsync(1);
+			}
+			break;
+
+		case ASYNC_ACK_DELAY:
+			if( expired )
+			{
+				setTimeout();
+				_async.step = ASYNC_ACK_TX;
+				_async.wait = _sendTime;
+				_async.previous = millis();
+				startSend();
+			}
+			break;
+
+		case ASYNC_ACK_TX:
+			if( irqRaised(IRQ_TX_DONE) )
+			{
+				state = finishSend(true);
+			}
+			else if( expired )
+			{
+				state = finishSend(false);
+			}
+			else
+			{
+				break;
+			}
+			#if LORA_IMPLICIT_ACK
+				writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+				setImplicitHeader(false);
+			#endif
+			#if LORA_ADR
+				if( (state == 0) && (_adrOffer != 0) )
+				{
+					adrSwitch(_adrOffer);
+				}
+				_adrOffer = 0;
+			#endif
+			completeAsync(((state == 0) && _async.duplicate) ? 5 : state);
+			break;
+
+		case ASYNC_WIN_TX:
+			if( irqRaised(IRQ_TX_DONE) )
+			{
+				state = finishSend(true);
+			}
+			else if( expired )
+			{
+				state = finishSend(false);
+			}
+			else
+			{
+				break;
+			}
+
+			if( state != 0 )
+			{
+				completeAsync(state);
+			}
+			else if( _win.pos != _win.last )
+			{ // Next packet of the burst, no ACK in between
+				_win.pos = nextWindowPacket(_win.pos + 1);
+				sendWindowPacket(_win.pos, false);	// the channel is still ours
+			}
+			else if( rearm(LORA_IMPLICIT_ACK ? ACK_LENGTH + 1 : 0, true) == 0 )
+			{ // Burst sent, setting Rx mode to wait the block ACK
+				_async.step = ASYNC_WIN_ACK_WAIT;
+				_async.wait = ackWaitTime();
+				_async.previous = millis();
+			}
+			else
+			{
+				completeAsync(1);
+			}
+			break;
+
+		case ASYNC_WIN_ACK_WAIT:
+			serviceRx();
+			// Other frames stay queued for the next receive
+			for( i = 0; (frame = rx_queue_at(i)) != 0; i++ )
+			{
+				if( (frame->sz == ACK_LENGTH + 1)
+					&& (frame->data[0] == _nodeAddress)
+					&& (frame->data[1] == _win.dest)
+					&& (frame->data[3] == ACK_MARK)
+					&& ((frame->data[4] & ACK_STATUS_MASK) == CORRECT_PACKET) )
+				{
+					break;
+				}
+			}
+			if( frame != 0 )
+			{
+				progress = windowAck(frame->data[2], frame->data[ACK_LENGTH]);
+				#if LORA_POWER_CONTROL
+					powerControl(_win.dest, (int8_t)frame->data[5]);
+				#endif
+				#if LORA_ADR
+					adrSample();
+					adr_mode = adr_decode(frame->data[4] >> ACK_ADR_SHIFT);
+				#endif
+				rx_queue_remove(i);
+			}
+			else if( !expired )
+			{
+				break;
+			}
+
+			#if LORA_IMPLICIT_ACK
+				// The next burst is sent with the normal header
+				writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
+				setImplicitHeader(false);
+			#endif
+			#if LORA_ADR
+				// The receiver switched after its block ACK
+				if( adr_mode != 0 )
+				{
+					adrSwitch(adr_mode);
+				}
+			#endif
+			if( _win.base == _win.count )
+			{
+				completeAsync(0);	// Whole message acknowledged
+				break;
+			}
+			_win.rounds = progress ? 0 : _win.rounds + 1;
+			#if LORA_POWER_CONTROL
+				if( !progress )
+				{ // Nothing got through, the next burst goes at full power
+					peer(_win.dest)->power = LORA_TPC_MAX_DBM;
+				}
+			#endif
+			#if LORA_CSMA
+				if( !progress )
+				{
+					_csma.collisions++;
+				}
+			#endif
+			if( _win.rounds > _maxRetries )
+			{
+				#if LORA_ADR
+					adrFallback();
+				#endif
+				completeAsync(9);	// The window got no ACK
+				break;
+			}
+			startWindowBurst();
+			break;
+
+#if LORA_CSMA
+		case ASYNC_CAD:
+			if( !irqRaised(IRQ_CAD_DONE) && !expired )
+			{
+				break;
+			}
+			if( irqRaised(IRQ_CAD_DONE) && !(readRegister(REG_IRQ_FLAGS) & IRQ_CAD_DETECTED) )
+			{ // Channel free: the packet is still in FIFO
+				_async.step = _csma.next;
+				_async.wait = _csma.wait;
+				_async.previous = millis();
+				startSend();
+				break;
+			}
+			// Preamble heard, or no CadDone: the channel is taken as busy
+			_csma.busy++;
+			_csma.attempt++;
+			if( _csma.attempt >= LORA_CSMA_ATTEMPTS )
+			{
+				_csma.dropped++;
+				failTransmit(_csma.next, 10);
+				break;
+			}
+			_async.step = ASYNC_BACKOFF;
+			_async.wait = backoffTime();
+			_async.previous = millis();
+			break;
+
+		case ASYNC_BACKOFF:
+			if( expired )
+			{
+				startCad();
+			}
+			break;
+#endif
+
+#if LORA_DUTY_CYCLE
+		case ASYNC_DUTY_WAIT:
+			if( expired )
+			{
+				_async.wait = _airtime.wait;
+				startTransmit(_airtime.next, _airtime.listen);
+			}
+			break;
+#endif
+
+		default:
+			break;
+	}
+
+	return (_async.step != ASYNC_IDLE) && (_async.step != ASYNC_DONE);
+}
+
+/*
+ Function: Drives the operation in progress until it completes. With
+ LORA_USE_DIO_IRQ the core sleeps between steps, every step ends on a DIO
+ interrupt or on a timeout counted by systick.
+ Returns: Result of the operation
+*/
+uint8_t SX1278::waitAsync()
+{
+	while( poll() )
+	{
+		#if LORA_USE_DIO_IRQ
+			disable_interrupts();
+			if( _irqPending == 0 )
+			{
+				wait_for_interrupt();
+			}
+			enable_interrupts();
+		#endif
+	}
+	return _async.result;
+}
+
+/*
+ Function: It gets the temperature from the measurement block module.
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+uint8_t SX1278::getTemp()
+{
+	uint8_t st0;
+	uint8_t state = 2;
+
+	#if (SX1278_debug_mode > 1)
+		Serial.println();
+		Serial.println("Starting 'getTemp'");
+	#endif
+
+	st0 = readRegister(REG_OP_MODE);	// Save the previous status
+
+	if( _modem == LORA )
+	{ // Allowing access to FSK registers while in LoRa standby mode
+		writeRegister(REG_OP_MODE, LORA_STANDBY_FSK_REGS_MODE);
+	}
+
+	state = 1;
+	// Saving temperature value
+	_temp = readRegister(REG_TEMP);
+	if( _temp & 0x80 ) // The SNR sign bit is 1
+	{
+		// Invert and divide by 4
+		_temp = ( ( ~_temp + 1 ) & 0xFF );
     }
+    else
+    {
+		// Divide by 4
+		_temp = ( _temp & 0xFF );
+	}
+
+
+	#if (SX1278_debug_mode > 1)
+		Serial.print("## Temperature is: ");
+		Serial.print(_temp);
+		Serial.println(" ##");
+		Serial.println();
+	#endif
+
+	if( _modem == LORA )
+	{
+		writeRegister(REG_OP_MODE, st0);	// Getting back to previous status
+	}
+
+	state = 0;
+	return state;
+}
+
+/*
+ Function: It prints the registers related to RX
+ Returns: Integer that determines if there has been any error
+   state = 2  --> The command has not been executed
+   state = 1  --> There has been an error while executing the command
+   state = 0  --> The command has been executed with no errors
+*/
+void SX1278::showRxRegisters()
+{
+	Serial.println("\n--- Show RX register ---");
+
+	// variable
+	uint8_t reg;
+
+	for(int i = 0x00; i < 0x80; i++)
+	{
+		reg = readRegister(i);
+		Serial.print("Reg 0x");
+		Serial.print(i, HEX);
+		Serial.print(":");
+		Serial.print(reg, HEX);
+		Serial.println();
+		wait_with_timer2(100);
+	}
+
+	Serial.println("------------------------");
+
+}
+
+/*
+ Function: It sets the CAD mode to search Channel Activity Detection
+ Returns: Integer that determines if there has been any error
+   state = true   --> Channel Activity Detected
+   state = false  --> Channel Activity NOT Detected
+*/
+bool SX1278::cadDetected()
+{
+	uint8_t val = 0;
+
+	// set LNA
+	sx1278.writeRegister(REG_LNA,0x23);
+	sx1278.clearFlags();
+
+    sx1278.getRSSI();
+
+	#if (SX1278_debug_mode > 1)
+		Serial.print("Inside CAD DETECTION -> RSSI: ");
+		Serial.println(sx1278._RSSI);
+	#endif
+
+	if( _modem == LORA )
+	{
+		#if (SX1278_debug_mode > 1)
+			Serial.println("Set CAD mode");
+		#endif
+
+		// CadDone on DIO0, CadDetected on DIO1
+		sx1278.setDioMapping(DIO_MAPPING_CAD);
+		// Setting LoRa CAD mode
+		sx1278.writeRegister(REG_OP_MODE, LORA_CAD_MODE);
+		#if LORA_CSMA
+			_csma.cads++;
+		#endif
+	}
+
+	// Wait for IRQ CadDone, a CAD takes about two symbols
+	val = sx1278.waitIrq(IRQ_CAD_DONE, cadTime());
 
 	// After waiting or detecting CadDone
 	// check 'CadDetected' bit in 'RegIrqFlags' register
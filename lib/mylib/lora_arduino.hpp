@@ -42,6 +42,8 @@
 #include "spi.hpp"
 #include "uart.hpp"
 #include "definitions.hpp"
+#include "rx_queue.hpp"
+#include "adr.hpp"
 
 //#ifndef inttypes_h
 //	#include <inttypes.h>
@@ -171,6 +173,60 @@
 #define        REG_IRQ_FLAGS1	  			0x3E
 #define        REG_IRQ_FLAGS2	  			0x3F
 
+// Frequency synthesizer: FRF = Fcenter * 2^19 / FXOSC, SX1278 band 410..525 MHz
+const uint32_t FXOSC = 32000000;
+const uint32_t FREQ_MIN = 410000000;
+const uint32_t FREQ_MAX = 525000000;
+
+/*
+ Function: FRF register value of a center frequency, rounded to the nearest
+ step (61.035 Hz).
+ Returns: 24 bit FRF value
+ Parameters:
+   hz: center frequency in Hz
+*/
+constexpr uint32_t freqToFrf(uint32_t hz)
+{
+	return (uint32_t)((((uint64_t)hz << 19) + (FXOSC / 2)) / FXOSC);
+}
+
+/*
+ Function: Center frequency of an FRF register value.
+ Returns: Frequency in Hz, rounded to the nearest Hz
+ Parameters:
+   frf: 24 bit FRF value
+*/
+constexpr uint32_t frfToFreq(uint32_t frf)
+{
+	return (uint32_t)(((uint64_t)frf * FXOSC + (1UL << 18)) >> 19);
+}
+
+//! Structure : channel plan generated at compile time.
+/*!
+	Channels of BW_HZ hertz, SPACING_HZ apart, fitting in [START_HZ, END_HZ].
+	Channel 1 starts at START_HZ, like the CH_* tables below.
+	Ex: ChannelPlan<433050000, 434790000, 125000>::frf(3)
+ */
+template<uint32_t START_HZ, uint32_t END_HZ, uint32_t BW_HZ, uint32_t SPACING_HZ = BW_HZ>
+struct ChannelPlan{
+  static_assert((START_HZ >= FREQ_MIN) && (END_HZ <= FREQ_MAX), "ChannelPlan: out of the SX1278 band");
+  static_assert((SPACING_HZ > 0) && (START_HZ + BW_HZ <= END_HZ), "ChannelPlan: no channel fits");
+
+  static const uint16_t count = (END_HZ - START_HZ - BW_HZ) / SPACING_HZ + 1;
+
+  //! Center frequency in Hz of channel 'n' (1 .. count).
+  static constexpr uint32_t center(uint16_t n)
+  {
+    return START_HZ + BW_HZ / 2 + (uint32_t)(n - 1) * SPACING_HZ;
+  }
+
+  //! FRF value of channel 'n' (1 .. count), to pass to setChannel().
+  static constexpr uint32_t frf(uint16_t n)
+  {
+    return freqToFrf(center(n));
+  }
+};
+
 // LPD433 (low power device 433 MHz) is a part of ITU region 1 ISM band
 /*!
 	From 433.050 MHz to 434.790 MHz: BW: 1.74 MHz
@@ -178,6 +234,8 @@
  */
 
 const uint32_t CH_DEFAULT = 0x6c8000; // default channel, center frequency = 434.000MHz
+static_assert(freqToFrf(434000000) == CH_DEFAULT, "FRF of 434.000MHz");
+static_assert(frfToFreq(CH_DEFAULT) == 434000000, "frequency of CH_DEFAULT");
 
 // FREQUENCY CHANNELS (BANDWIDTH 500KHz):
 const uint32_t CH_1_BW_500 = 0x6c5345; // channel 1, bandwidth 500KHz, center frequency = 433.3MHz ( 433.050MHz - 433.550MHz )
@@ -245,8 +303,16 @@ const uint8_t BW_125 = 0x07;
 const uint8_t BW_250 = 0x08;
 const uint8_t BW_500 = 0x09;
 
+// log10 of the bandwidth in Hz, indexed by BW_7_8 .. BW_500
 const double SignalBwLog[] =
 {
+    3.8920946026904804,
+    4.0170333392987803,
+    4.1931245983544616,
+    4.3180633349627615,
+    4.4948500216800940,
+    4.6201360549737576,
+    4.7958800173440752,
     5.0969100130080564143587833158265,
     5.397940008672037609572522210551,
     5.6989700043360188047862611052755
@@ -272,8 +338,24 @@ const uint8_t LORA_SLEEP_MODE = 0x80;
 const uint8_t LORA_STANDBY_MODE = 0x81;
 const uint8_t LORA_TX_MODE = 0x83;
 const uint8_t LORA_RX_MODE = 0x85;
+const uint8_t LORA_CAD_MODE = 0x87;
 const uint8_t LORA_STANDBY_FSK_REGS_MODE = 0xC1;
 
+//LORA IRQ FLAGS (REG_IRQ_FLAGS):
+const uint8_t IRQ_RX_TIMEOUT = 0x80;
+const uint8_t IRQ_RX_DONE = 0x40;
+const uint8_t IRQ_PAYLOAD_CRC_ERROR = 0x20;
+const uint8_t IRQ_VALID_HEADER = 0x10;
+const uint8_t IRQ_TX_DONE = 0x08;
+const uint8_t IRQ_CAD_DONE = 0x04;
+const uint8_t IRQ_FHSS_CHANGE_CHANNEL = 0x02;
+const uint8_t IRQ_CAD_DETECTED = 0x01;
+
+//LORA DIO MAPPINGS (REG_DIO_MAPPING1):
+const uint8_t DIO_MAPPING_RX = 0x00;	// DIO0 = RxDone, DIO1 = RxTimeout
+const uint8_t DIO_MAPPING_TX = 0x40;	// DIO0 = TxDone
+const uint8_t DIO_MAPPING_CAD = 0xA0;	// DIO0 = CadDone, DIO1 = CadDetected
+
 //FSK MODES:
 const uint8_t FSK_SLEEP_MODE = 0x00;
 const uint8_t FSK_STANDBY_MODE = 0x01;
@@ -295,8 +377,20 @@ const uint8_t MAX_LENGTH = 255;
 const uint8_t MAX_PAYLOAD = 251;
 const uint8_t MAX_LENGTH_FSK = 64;
 const uint8_t MAX_PAYLOAD_FSK = 60;
-const uint8_t ACK_LENGTH = 5;
-const uint8_t OFFSET_PAYLOADLENGTH = 5;
+#if LORA_POWER_CONTROL
+const uint8_t ACK_LENGTH = 6;			// dst, src, packnum, length, status, SNR at the receiver
+#else
+const uint8_t ACK_LENGTH = 5;			// dst, src, packnum, length, status
+#endif
+const uint8_t MAX_IOV = 4;				// payload fragments of a scatter-gather send
+const uint8_t REG_CACHE_SIZE = 0x50;	// registers 0x00..0x4F can be shadowed
+#if LORA_COMPACT_HEADER
+const uint8_t OFFSET_PAYLOADLENGTH = 4;	// dst, src, packnum, flags; length from REG_RX_NB_BYTES
+const uint8_t ACK_MARK = 0x20;			// flags byte of an ACK
+#else
+const uint8_t OFFSET_PAYLOADLENGTH = 5;	// dst, src, packnum, length, retry
+const uint8_t ACK_MARK = 0;				// length byte of an ACK
+#endif
 const uint8_t OFFSET_RSSI = 137;
 const uint8_t NOISE_FIGURE = 6.0;
 const uint8_t NOISE_ABSOLUTE_ZERO = 174.0;
@@ -306,6 +400,42 @@ const uint32_t MESH_TIMEOUT = 3600000;  //3600000 msec = 3600 sec = 1 hour
 const uint8_t MAX_RETRIES = 5;
 const uint8_t CORRECT_PACKET = 0;
 const uint8_t INCORRECT_PACKET = 1;
+const uint8_t MAX_WINDOW = 8;			// packets in flight in windowed mode (block ACK bitmap width)
+const uint8_t WINDOW_FRAME = 0x80;		// 'retry' byte: packet sent in windowed mode
+const uint8_t WINDOW_ACK_REQUEST = 0x40;	// 'retry' byte: last packet of a burst, reply with a block ACK
+const uint8_t PAYLOAD_COMPRESSED = 0x10;	// 'retry' byte: payload coded with text_compress()
+const uint8_t WINDOW_LAST = 0x08;		// 'retry' byte: last packet of a windowed message
+const uint8_t WINDOW_RETRY_MASK = 0x07;	// 'retry' byte: burst number of a windowed packet
+const uint8_t WINDOW_HEADER = 2;		// windowed packet: message offset of the payload (MSB, LSB) before it
+const uint8_t ACK_STATUS_MASK = 0x07;	// ACK byte: CORRECT_PACKET/INCORRECT_PACKET
+const uint8_t ACK_BLOCK = 0x08;			// ACK byte: block ACK, one bitmap byte after the ACK
+const uint8_t ACK_ADR_SHIFT = 4;		// ACK byte: adr_encode() of the mode to switch to, 0 to stay
+const uint8_t DUTY_SLOTS = LORA_DUTY_BUCKETS + 1;	// airtime buckets kept: a bucket is freed once its end is a window old
+
+//ASYNC OPERATIONS:
+const uint8_t ASYNC_SEND = 0;		// send a packet and wait for its ACK
+const uint8_t ASYNC_RECEIVE = 1;	// receive a packet and reply with an ACK
+const uint8_t ASYNC_SEND_WINDOW = 2;	// send a message in a window of packets (selective repeat)
+
+//ASYNC STEPS:
+const uint8_t ASYNC_IDLE = 0;
+const uint8_t ASYNC_TX = 1;			// packet on air, waiting for TxDone
+const uint8_t ASYNC_ACK_WAIT = 2;	// waiting for the ACK of the packet sent
+const uint8_t ASYNC_RX = 3;			// waiting for a packet
+const uint8_t ASYNC_ACK_DELAY = 4;	// packet received, waiting before replying
+const uint8_t ASYNC_ACK_TX = 5;		// ACK on air, waiting for TxDone
+const uint8_t ASYNC_DONE = 6;
+const uint8_t ASYNC_WIN_TX = 7;		// windowed packet on air, waiting for TxDone
+const uint8_t ASYNC_WIN_ACK_WAIT = 8;	// burst sent, waiting for the block ACK
+const uint8_t ASYNC_CAD = 9;		// packet in FIFO, channel activity detection before sending it
+const uint8_t ASYNC_BACKOFF = 10;	// channel busy, random wait before the next CAD
+const uint8_t ASYNC_DUTY_WAIT = 11;	// packet in FIFO, waiting for airtime budget
+
+//LOW POWER LISTEN STEPS (LORA_LOW_POWER_RX):
+const uint8_t LISTEN_OFF = 0;		// continuous Rx, or an operation in progress
+const uint8_t LISTEN_SLEEP = 1;		// radio in sleep mode until the next CAD
+const uint8_t LISTEN_CAD = 2;		// channel activity detection, waiting for CadDone
+const uint8_t LISTEN_RX = 3;		// preamble heard, Rx until the packet or a timeout
 
 //! Structure :
 /*!
@@ -332,10 +462,12 @@ struct pack
  	*/
 	uint8_t length;
 
-	//! Structure Variable : Packet payload
+	//! Structure Variable : Packet payload, not copied
 	/*!
+	Sent packet: the caller's buffer, valid until the send completes.
+	Received packet: the buffer given to setRxBuffer().
  	*/
-	uint8_t data[MAX_PAYLOAD];
+	uint8_t *data;
 
 	//! Structure Variable : Retry number
 	/*!
@@ -343,6 +475,303 @@ struct pack
 	uint8_t retry;
 };
 
+//! Structure : payload fragment of a scatter-gather send
+/*!
+ */
+struct lora_iovec
+{
+	//! Structure Variable : Fragment bytes, not copied
+	/*!
+ 	*/
+	uint8_t *data;
+
+	//! Structure Variable : Fragment length
+	/*!
+ 	*/
+	uint8_t length;
+};
+
+//! Structure : ACK, the header and one status byte (plus the bitmap of a block ACK)
+/*!
+ */
+struct ack_pack
+{
+	//! Structure Variable : ACK destination
+	/*!
+ 	*/
+	uint8_t dst;
+
+	//! Structure Variable : ACK source
+	/*!
+ 	*/
+	uint8_t src;
+
+	//! Structure Variable : Number of the packet acknowledged
+	/*!
+ 	*/
+	uint8_t packnum;
+
+	//! Structure Variable : Always 0 for an ACK
+	/*!
+ 	*/
+	uint8_t length;
+
+	//! Structure Variable : CORRECT_PACKET/INCORRECT_PACKET, the SNR of the
+	//! packet with LORA_POWER_CONTROL, then the block ACK bitmap
+	/*!
+ 	*/
+	uint8_t data[ACK_LENGTH - 3];
+};
+
+//! Structure : transmit power used towards one peer (LORA_POWER_CONTROL).
+/*!
+ */
+struct lora_peer
+{
+	//! Structure Variable : Node address, 0 for a free entry
+	/*!
+ 	*/
+	uint8_t address;
+
+	//! Structure Variable : Output power towards this peer (dBm)
+	/*!
+ 	*/
+	uint8_t power;
+
+	//! Structure Variable : SNR of our last packet at the peer (dB)
+	/*!
+ 	*/
+	int8_t snr;
+
+	//! Structure Variable : ACKs received from the peer, saturates at 255
+	/*!
+ 	*/
+	uint8_t acks;
+};
+
+struct lora_async;
+
+//! Completion callback of an asynchronous operation.
+typedef void (*lora_async_callback)(lora_async *handle);
+
+//! Structure : asynchronous send/receive in progress.
+/*!
+ */
+struct lora_async
+{
+	//! Structure Variable : ASYNC_SEND or ASYNC_RECEIVE
+	/*!
+ 	*/
+	uint8_t op;
+
+	//! Structure Variable : Current step (ASYNC_IDLE .. ASYNC_DONE)
+	/*!
+ 	*/
+	uint8_t step;
+
+	//! Structure Variable : Same state code as the blocking call, valid on ASYNC_DONE
+	/*!
+ 	*/
+	uint8_t result;
+
+	//! Structure Variable : Send: retry up to '_maxRetries' times
+	/*!
+ 	*/
+	bool retries;
+
+	//! Structure Variable : Timeout of the current step (ms)
+	/*!
+ 	*/
+	uint32_t wait;
+
+	//! Structure Variable : millis() when the current step started
+	/*!
+ 	*/
+	uint32_t previous;
+
+	//! Structure Variable : Receive: windowed packet already delivered (result 5)
+	/*!
+ 	*/
+	bool duplicate;
+
+	//! Structure Variable : Called once on completion (can be 0)
+	/*!
+ 	*/
+	lora_async_callback callback;
+};
+
+//! Structure : windowed (selective repeat) send in progress.
+/*!
+	Packet 'i' of the message carries packnum 'seq + i' and the offset
+	'i * chunk' of its payload, the last one is flagged WINDOW_LAST. Packets
+	[base, base + window) can be in flight at the same time, only those
+	missing from the block ACK are sent again.
+ */
+struct lora_window
+{
+	//! Structure Variable : Message being sent, not copied
+	/*!
+ 	*/
+	uint8_t *data;
+
+	//! Structure Variable : Message length
+	/*!
+ 	*/
+	uint16_t length;
+
+	//! Structure Variable : Message destination
+	/*!
+ 	*/
+	uint8_t dest;
+
+	//! Structure Variable : Payload bytes per packet
+	/*!
+ 	*/
+	uint8_t chunk;
+
+	//! Structure Variable : Packets in the message
+	/*!
+ 	*/
+	uint8_t count;
+
+	//! Structure Variable : Packet number of the first packet
+	/*!
+ 	*/
+	uint8_t seq;
+
+	//! Structure Variable : First packet not acknowledged yet
+	/*!
+ 	*/
+	uint8_t base;
+
+	//! Structure Variable : ACK state of packets base .. base + 7 (bit i = base + i)
+	/*!
+ 	*/
+	uint8_t acked;
+
+	//! Structure Variable : Packet on air
+	/*!
+ 	*/
+	uint8_t pos;
+
+	//! Structure Variable : Last packet of the current burst
+	/*!
+ 	*/
+	uint8_t last;
+
+	//! Structure Variable : Bursts in a row without progress
+	/*!
+ 	*/
+	uint8_t rounds;
+};
+
+//! Structure : listen before talk state and counters (LORA_CSMA).
+/*!
+ */
+struct lora_csma
+{
+	//! Structure Variable : Step started once the channel is free (ASYNC_TX, ASYNC_WIN_TX)
+	/*!
+ 	*/
+	uint8_t next;
+
+	//! Structure Variable : Busy CADs for the packet waiting
+	/*!
+ 	*/
+	uint8_t attempt;
+
+	//! Structure Variable : Timeout of step 'next'
+	/*!
+ 	*/
+	uint32_t wait;
+
+	//! Structure Variable : Backoff slot, time-on-air of the packet waiting (ms)
+	/*!
+ 	*/
+	uint16_t slot;
+
+	//! Structure Variable : xorshift32 state of the backoff, seeded from the wideband RSSI
+	/*!
+ 	*/
+	uint32_t random;
+
+	//! Structure Variable : CADs done
+	/*!
+ 	*/
+	uint16_t cads;
+
+	//! Structure Variable : CADs that found the channel busy
+	/*!
+ 	*/
+	uint16_t busy;
+
+	//! Structure Variable : Packets given up after LORA_CSMA_ATTEMPTS busy CADs
+	/*!
+ 	*/
+	uint16_t dropped;
+
+	//! Structure Variable : Packets or bursts sent without getting their ACK
+	/*!
+ 	*/
+	uint16_t collisions;
+
+	//! Structure Variable : Time spent in backoff (ms)
+	/*!
+ 	*/
+	uint32_t backoffMs;
+};
+
+//! Structure : airtime ledger of the duty-cycle budget (LORA_DUTY_CYCLE).
+/*!
+ */
+struct lora_airtime
+{
+	//! Structure Variable : Airtime of each bucket of the sliding window (us)
+	/*!
+ 	*/
+	uint32_t bucket[DUTY_SLOTS];
+
+	//! Structure Variable : Bucket being filled
+	/*!
+ 	*/
+	uint8_t head;
+
+	//! Structure Variable : millis() at the start of bucket 'head'
+	/*!
+ 	*/
+	uint32_t headStart;
+
+	//! Structure Variable : Airtime since power on (ms)
+	/*!
+ 	*/
+	uint32_t totalMs;
+
+	//! Structure Variable : Step started once there is budget (ASYNC_TX, ASYNC_WIN_TX)
+	/*!
+ 	*/
+	uint8_t next;
+
+	//! Structure Variable : Timeout of step 'next'
+	/*!
+ 	*/
+	uint32_t wait;
+
+	//! Structure Variable : 'listen' of the transmission waiting
+	/*!
+ 	*/
+	bool listen;
+
+	//! Structure Variable : Sends that waited for budget
+	/*!
+ 	*/
+	uint16_t deferred;
+
+	//! Structure Variable : Sends rejected, no budget within LORA_DUTY_MAX_DEFER_MS
+	/*!
+ 	*/
+	uint16_t rejected;
+};
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -392,6 +821,67 @@ public:
 	 */
 	void writeRegister(uint8_t address, uint8_t data);
 
+	//! It writes consecutive internal module registers in a single burst.
+  	/*!
+  	\param uint8_t address : first register to write in (not REG_OP_MODE).
+  	\param uint8_t *data : values to write.
+  	\param uint8_t length : number of registers.
+	 */
+	void writeRegisters(uint8_t address, uint8_t *data, uint8_t length);
+
+	//! It writes a batch of registers, one burst per run of consecutive addresses.
+  	/*!
+  	\param SpiBatch &batch : register writes, emptied on return.
+	\return the number of SPI transactions used
+	 */
+	uint8_t writeBatch(SpiBatch &batch);
+
+	//! It reads consecutive internal module registers in a single burst.
+  	/*!
+  	\param uint8_t address : first register to read from.
+  	\param uint8_t *data : buffer to store the values read.
+  	\param uint8_t length : number of registers.
+	 */
+	void readRegisters(uint8_t address, uint8_t *data, uint8_t length);
+
+	//! It writes a block of bytes in the FIFO in a single SPI transaction.
+  	/*!
+  	\param uint8_t *data : bytes to write.
+  	\param uint8_t length : number of bytes to write.
+	 */
+	void writeFifo(uint8_t *data, uint8_t length);
+
+	//! It reads a block of bytes from the FIFO in a single SPI transaction.
+  	/*!
+  	\param uint8_t *data : buffer to store the bytes read.
+  	\param uint8_t length : number of bytes to read.
+	 */
+	void readFifo(uint8_t *data, uint8_t length);
+
+	//! It forgets every shadowed register value.
+  	/*!
+	\return void
+	 */
+	void invalidateCache();
+
+	//! It tells if the shadowed value of 'address' can be used.
+  	/*!
+  	Only static configuration registers are shadowed, and the paged ones
+  	(0x0D..0x3F) only while the LoRa page is selected.
+  	\param uint8_t address : register address.
+	\return 'true' if the register is shadowed, 'false' otherwise
+	 */
+	bool regCached(uint8_t address);
+
+	//! It updates the shadow after REG_OP_MODE is written or read.
+  	/*!
+  	The mode is only shadowed for sleep, standby and continuous RX, the
+  	other modes end by themselves. Switching LoRa/FSK drops the shadow.
+  	\param uint8_t value : REG_OP_MODE value.
+	\return void
+	 */
+	void cacheOpMode(uint8_t value);
+
 	//! It clears the interruption flags.
   	/*!
 	\param void
@@ -399,6 +889,32 @@ public:
 	 */
 	void clearFlags();
 
+	//! It selects which LoRa interrupts are routed to DIO0..DIO3.
+  	/*!
+  	\param uint8_t mapping : value for REG_DIO_MAPPING1 (DIO_MAPPING_RX/TX/CAD).
+	\return void
+	 */
+	void setDioMapping(uint8_t mapping);
+
+	//! It latches the interruption flag signalled by a rising edge on a DIO line.
+  	/*!
+  	Called from the EXTI handler. The flag is decoded with the current DIO
+  	mapping, so fake interrupts can be injected by calling it directly.
+  	\param uint8_t dio : DIO line (0 or 1).
+	\return void
+	 */
+	void dioInterrupt(uint8_t dio);
+
+	//! It waits until one of the interruption flags in 'mask' is raised.
+  	/*!
+  	With LORA_USE_DIO_IRQ the MCU sleeps between interrupts, otherwise
+  	REG_IRQ_FLAGS is polled.
+  	\param uint8_t mask : REG_IRQ_FLAGS bits to wait for.
+  	\param uint32_t wait : timeout in ms.
+	\return REG_IRQ_FLAGS value after the wait
+	 */
+	uint8_t waitIrq(uint8_t mask, uint32_t wait);
+
 	//! It sets the LoRa mode on.
   	/*!
   	It stores in global '_LORA' variable '1' when success
@@ -434,6 +950,13 @@ public:
   template<uint16_t mode>
 	int8_t setMode();
 
+	//! It sets the mode given at run time.
+  	/*!
+	\param uint8_t mode : mode number 1..16, as in setMode<mode>().
+	\return '0' on success, '1' on error, '-1' if there is no such mode
+	 */
+	int8_t setModeNum(uint8_t mode);
+
 	//! It gets the header mode configured.
   	/*!
   	It stores in global '_header' variable '0' when header is sent
@@ -550,9 +1073,9 @@ public:
 	int8_t	setCR(uint8_t cod);
 
 
-	//! It is true if the channel selected exists.
+	//! It is true if the channel selected is in the band of the module.
   	/*!
-	\param uint32_t ch : frequency channel value to check.
+	\param uint32_t ch : frequency channel value (FRF) to check.
 	\return 'true' on success, 'false' otherwise
 	 */
 	bool isChannel(uint32_t ch);
@@ -566,9 +1089,10 @@ public:
 
 	//! It sets frequency channel the module is using.
   	/*!
-	It stores in global '_channel' variable the frequency channel
-	\param uint32_t ch : frequency channel value to set in the configuration.
-	\return '0' on success, '1' otherwise
+	It stores in global '_channel' variable the frequency channel (FRF)
+	\param uint32_t ch : FRF value (CH_*, ChannelPlan<>::frf()) or center
+	frequency in Hz (FREQ_MIN .. FREQ_MAX).
+	\return '0' on success, '1' otherwise, '-1' if out of the band
 	 */
 	int8_t setChannel(uint32_t ch);
 
@@ -596,6 +1120,33 @@ public:
 	 */
 	int8_t setPowerNum(uint8_t pow);
 
+#if LORA_POWER_CONTROL
+	//! It gets the power entry of a peer, a new one at LORA_TPC_MAX_DBM if unknown.
+  	/*!
+	\param uint8_t address : node address of the peer.
+	\return the entry, never 0
+	 */
+	lora_peer *peer(uint8_t address);
+
+	//! It sets the output power used towards a peer before sending to it.
+  	/*!
+	\param uint8_t address : node address of the peer.
+	\return void
+	 */
+	void powerForPeer(uint8_t address);
+
+	//! It moves the power towards a peer after it reported an SNR.
+  	/*!
+  	Down while the SNR is more than LORA_TPC_MARGIN + LORA_TPC_HYSTERESIS
+  	over the limit of the spreading factor, up as soon as it is under
+  	LORA_TPC_MARGIN.
+	\param uint8_t address : node address of the peer.
+	\param int8_t snr : SNR of our packet at the peer, from its ACK (dB).
+	\return void
+	 */
+	void powerControl(uint8_t address, int8_t snr);
+#endif
+
 	//! It gets the preamble length configured.
   	/*!
 	It stores in global '_preamblelength' variable the preamble length
@@ -733,6 +1284,29 @@ public:
 	*/
 	uint8_t setACK();
 
+	//! It writes a block ACK of windowed packets in FIFO to send it.
+	/*!
+	Bit i of the bitmap is set if packet 'packnum - i' of the source has
+	been received.
+	\return '0' on success, '1' otherwise
+	*/
+	uint8_t setBlockACK();
+
+	//! It records a windowed packet in the reception history.
+	/*!
+	\param uint8_t src : packet source.
+	\param uint8_t packnum : packet number.
+	\return 'true' if the packet is new, 'false' if already received
+	*/
+	bool windowReceived(uint8_t src, uint8_t packnum);
+
+	//! It copies the payload of a new windowed packet into the message buffer.
+	/*!
+	
+eturn void
+	*/
+	void windowStore();
+
 	//! It puts the module in reception mode.
   	/*!
   	 *
@@ -740,6 +1314,73 @@ public:
 	 */
 	uint8_t receive();
 
+	//! It puts the module back in reception mode after a packet.
+  	/*!
+  	Unlike receive() it keeps 'packet_received' and only writes the
+  	registers that changed.
+  	\param uint8_t length : 0 for any packet with the header of setHeaderON/OFF,
+  	otherwise the length of a frame received with an implicit header.
+  	\param bool ack : true to wait for an ACK (short preamble with LORA_LOW_POWER_RX).
+	\return '0' on success, '1' otherwise
+	 */
+	uint8_t rearm(uint8_t length = 0, bool ack = false);
+
+	//! It switches the header of the next frames between implicit and explicit.
+  	/*!
+  	Implicit header frames have a length known by both sides (ACKs), the
+  	module must be in sleep or standby mode.
+  	\param bool implicit : 'true' for an implicit header, 'false' for the
+  	header set by setHeaderON/OFF.
+	\return void
+	 */
+	void setImplicitHeader(bool implicit);
+
+#if LORA_ADR
+	//! It feeds the RSSI of the latest packet or ACK to the ADR estimate.
+  	/*!
+	\return void
+	 */
+	void adrSample();
+
+	//! It switches to another mode and starts the ADR estimate over.
+  	/*!
+	\param uint8_t mode : mode number 1..16.
+	\return void
+	 */
+	void adrSwitch(uint8_t mode);
+
+	//! It goes back to LORA_MODE when the link has been silent too long.
+  	/*!
+  	Nothing is heard from the peer when only one side switched (ACK lost)
+  	or when the mode in use is too fast: both sides give up after
+  	LORA_ADR_FALLBACK_MS and meet in LORA_MODE again.
+	\return 'true' if the mode changed
+	 */
+	bool adrFallback();
+#endif
+
+	//! It moves the packets received in RXCONTINUOUS mode to the RX queue.
+  	/*!
+  	Each packet is read from REG_FIFO_RX_CURRENT_ADDR with REG_RX_NB_BYTES
+  	bytes, the module is not taken out of reception.
+	\return number of frames in the RX queue
+	 */
+	uint8_t serviceRx();
+
+	//! It copies a frame of the FIFO to the RX queue.
+  	/*!
+  	\param uint8_t addr : FIFO address of the first byte.
+  	\param uint8_t sz : frame size.
+	\return void
+	 */
+	void queueFrame(uint8_t addr, uint8_t sz);
+
+	//! It moves the oldest frame of the RX queue to 'packet_received'.
+  	/*!
+	\return '0' on success, '1' if there is no valid packet for this node
+	 */
+	uint8_t takePacket();
+
 	//! It receives a packet before MAX_TIMEOUT.
   	/*!
   	 *
@@ -829,6 +1470,29 @@ public:
 	*/
 	uint8_t setPacket(uint8_t dest, uint8_t *payload);
 
+	//! It writes a packet made of several payload fragments in FIFO in one burst.
+	/*!
+	\param uint8_t dest : packet destination.
+	\param lora_iovec *iov : payload fragments, in order.
+	\param uint8_t count : number of fragments, up to MAX_IOV.
+	\return '0' on success, '1' otherwise
+	*/
+	uint8_t setPacket(uint8_t dest, lora_iovec *iov, uint8_t count);
+
+	//! It writes 'packet_sent' in FIFO in a single SPI transaction.
+	/*!
+	 *
+	\return void
+	*/
+	void writePacketFifo();
+
+	//! It prepares a retry of 'packet_sent' from the copy already in FIFO.
+	/*!
+	Only the retry number is written if the FIFO copy is still valid.
+	\return '0' on success, '1' if the packet must be written again
+	*/
+	uint8_t patchRetryFifo();
+
 	//! It reads a received packet from the FIFO, if it arrives before ending
 	//! MAX_TIMEOUT time.
 	/*!
@@ -876,6 +1540,28 @@ public:
 	*/
 	uint8_t sendWithTimeout(uint32_t wait);
 
+	//! It starts sending the packet stored in FIFO and returns at once.
+	/*!
+	\return void
+	*/
+	void startSend();
+
+	//! It ends a transmission started with startSend().
+	/*!
+	\param bool sent : TxDone flag was raised.
+	\return '0' on success, '1' otherwise
+	*/
+	uint8_t finishSend(bool sent);
+
+	//! It checks without blocking if one of the flags in 'mask' is raised.
+	/*!
+	In FSK mode IRQ_TX_DONE and IRQ_RX_DONE stand for PacketSent and
+	PayloadReady.
+	\param uint8_t mask : REG_IRQ_FLAGS bits to check.
+	\return 'true' if raised, 'false' otherwise
+	*/
+	bool irqRaised(uint8_t mask);
+
 	//! It tries to send the packet which payload is a parameter before ending
 	//! MAX_TIMEOUT.
 	/*!
@@ -1071,6 +1757,19 @@ public:
 									uint16_t length,
 									uint32_t wait);
 
+	//! It sends a packet made of several payload fragments and waits for its ACK.
+	/*!
+	\param uint8_t dest : packet destination.
+	\param lora_iovec *iov : payload fragments, in order.
+	\param uint8_t count : number of fragments, up to MAX_IOV.
+	\param uint32_t wait : time to wait to send the packet, 0 for _sendTime.
+	\return same codes as sendPacketTimeoutACK()
+	*/
+	uint8_t sendPacketTimeoutACK(uint8_t dest,
+									lora_iovec *iov,
+									uint8_t count,
+									uint32_t wait);
+
 	//! It sets the destination of a packet.
   	/*!
   	\param uint8_t dest : value to set as destination address.
@@ -1087,11 +1786,47 @@ public:
 
 	//! It gets the theoretical value of the time-on-air of the packet
   	/*! \remarks http://www.semtech.com/images/datasheet/sx1278.pdf
-   	It stores in global '_sendTime' variable the time for each mode.
-	\return float: time on air depending on module settings and packet length
+	\return time on air in ms (rounded up) depending on module settings and packet length
+	 */
+	uint16_t timeOnAir();
+	uint16_t timeOnAir( uint16_t payloadlength );
+
+	//! It gets the theoretical value of the time-on-air of the packet in us.
+  	/*!
+  	\param uint16_t payloadlength : payload length.
+	\return time on air in us depending on module settings and packet length
 	 */
-	float timeOnAir();
-	float timeOnAir( uint16_t payloadlength );
+	uint32_t timeOnAirUs( uint16_t payloadlength );
+
+	//! It gets the time-on-air of the packet in us with or without the PHY header.
+  	/*!
+  	\param uint16_t payloadlength : payload length.
+  	\param bool explicit_header : 'false' for an implicit header frame.
+	\return time on air in us
+	 */
+	uint32_t timeOnAirUs( uint16_t payloadlength, bool explicit_header );
+
+	//! It gets the delay between a packet received and its ACK.
+  	/*!
+  	Time for the sender to switch to Rx mode after its TxDone.
+	\return delay in ms
+	 */
+	uint16_t ackDelay();
+
+	//! It gets the time to wait for an ACK after a packet has been sent.
+  	/*!
+  	ACK delay plus time-on-air of a (block) ACK, plus the guard time for
+  	the processing on both sides.
+	\return time in ms
+	 */
+	uint16_t ackWaitTime();
+
+	//! It gets the longest time a CAD can take.
+  	/*!
+  	A CAD lasts about two symbols, the guard time is added.
+	\return time in ms
+	 */
+	uint16_t cadTime();
 
 	//! It sets the payload of the packet that is going to be sent.
   	/*!
@@ -1107,6 +1842,49 @@ public:
 	 */
 	uint8_t setPayload(uint8_t *payload);
 
+	//! It sets the payload of the packet that is going to be sent from fragments.
+  	/*!
+  	Only the fragment descriptors are kept, the bytes are streamed from the
+  	caller's buffers when the FIFO is written.
+  	\param lora_iovec *iov : payload fragments, in order.
+  	\param uint8_t count : number of fragments, up to MAX_IOV.
+	\return '0' on success, '1' otherwise
+	 */
+	uint8_t setPayload(lora_iovec *iov, uint8_t count);
+
+	//! It sets the flags carried in the retry byte of the next packets sent.
+  	/*!
+  	\param uint8_t flags : PAYLOAD_COMPRESSED or 0. Not used by windowed sends.
+	\return void
+	 */
+	void setPayloadFlags(uint8_t flags);
+
+	//! It sets the buffer the payload of received packets is read into.
+  	/*!
+  	Packets with a longer payload are dropped as incorrect.
+  	\param uint8_t *buffer : payload buffer, packet_received.data points to it.
+  	\param uint8_t size : buffer size in bytes.
+	\return void
+	 */
+	void setRxBuffer(uint8_t *buffer, uint8_t size);
+
+	//! It sets the buffer windowed messages are reassembled into.
+  	/*!
+  	Packets beyond its end are not copied, their message never completes.
+  	\param uint8_t *buffer : message buffer.
+  	\param uint16_t size : buffer size in bytes.
+	\return void
+	 */
+	void setWindowBuffer(uint8_t *buffer, uint16_t size);
+
+	//! It gets the length of the windowed message reassembled.
+  	/*!
+  	The message stays in the buffer until a packet of the next one is
+  	received.
+	\return message length, '0' while packets are missing
+	 */
+	uint16_t windowMessage();
+
 	//! If an ACK is received, it gets it and checks its content.
 	/*!
 	 *
@@ -1207,6 +1985,265 @@ public:
 										uint16_t length,
 										uint32_t wait);
 
+	//! It starts sending a packet and waiting for its ACK, and returns at once.
+	/*!
+	The operation is driven by poll(). The blocking send*ACK* functions are
+	wrappers over it.
+	\param uint8_t dest : packet destination.
+	\param uint8_t *payload : packet payload, not copied: keep it until completion.
+	\param uint16_t length : payload buffer length.
+	\param uint32_t wait : time to wait to send the packet, 0 for _sendTime.
+	\param bool retries : retry up to '_maxRetries' times if no ACK.
+	\param lora_async_callback callback : called on completion (can be 0).
+	\return handle of the operation, 0 if another one is in progress
+	*/
+	lora_async *sendPacketAsync(uint8_t dest,
+								uint8_t *payload,
+								uint16_t length,
+								uint32_t wait,
+								bool retries,
+								lora_async_callback callback = 0);
+
+	//! It starts sending a packet made of several fragments, and returns at once.
+	/*!
+	The fragments are streamed into the FIFO one after the other, nothing is
+	assembled in RAM. The descriptors are copied, the bytes must stay valid
+	until completion.
+	\param uint8_t dest : packet destination.
+	\param lora_iovec *iov : payload fragments, in order.
+	\param uint8_t count : number of fragments, up to MAX_IOV.
+	\param uint32_t wait : time to wait to send the packet, 0 for _sendTime.
+	\param bool retries : retry up to '_maxRetries' times if no ACK.
+	\param lora_async_callback callback : called on completion (can be 0).
+	\return handle of the operation, 0 if another one is in progress
+	*/
+	lora_async *sendPacketAsync(uint8_t dest,
+								lora_iovec *iov,
+								uint8_t count,
+								uint32_t wait,
+								bool retries,
+								lora_async_callback callback = 0);
+
+	//! It starts waiting for a packet to reply with an ACK, and returns at once.
+	/*!
+	The operation is driven by poll(). receivePacketTimeoutACK() is a wrapper
+	over it.
+	\param uint32_t wait : time to wait for the packet.
+	\param bool set_state : set Rx mode first.
+	\param lora_async_callback callback : called on completion (can be 0).
+	\return handle of the operation, 0 if another one is in progress
+	*/
+	lora_async *receivePacketAsync(uint32_t wait,
+									bool set_state,
+									lora_async_callback callback = 0);
+
+	//! It advances the operation in progress without blocking.
+	/*!
+	\return 'true' while the operation is in progress, 'false' otherwise
+	*/
+	bool poll();
+
+	//! It drives the operation in progress until it completes.
+	/*!
+	\return result of the operation
+	*/
+	uint8_t waitAsync();
+
+	//! It ends the operation in progress and calls its callback.
+	/*!
+	\param uint8_t result : state code of the operation.
+	\return void
+	*/
+	void completeAsync(uint8_t result);
+
+	//! It starts (again) the transmission of an asynchronous send.
+	/*!
+	\param uint8_t dest : packet destination.
+	\param lora_iovec *iov : payload fragments.
+	\param uint8_t count : number of fragments.
+	\return void
+	*/
+	void startAsyncTx(uint8_t dest, lora_iovec *iov, uint8_t count);
+
+	//! It puts the packet written in FIFO on air.
+	/*!
+	With LORA_CSMA and 'listen', a CAD goes first and the packet waits in
+	FIFO while the channel is busy.
+	\param uint8_t step : step of the transmission, ASYNC_TX or ASYNC_WIN_TX.
+	'_async.wait' is its timeout.
+	\param bool listen : 'true' to check the channel first.
+	\return void
+	*/
+	void startTransmit(uint8_t step, bool listen);
+
+	//! It ends an operation whose packet could not be put on air.
+	/*!
+	\param uint8_t step : step of the transmission, ASYNC_TX or ASYNC_WIN_TX.
+	\param uint8_t state : state code of the operation.
+	\return void
+	*/
+	void failTransmit(uint8_t step, uint8_t state);
+
+#if LORA_CSMA
+	//! It starts a channel activity detection for the packet waiting.
+	/*!
+	\return void
+	*/
+	void startCad();
+
+	//! It draws the random wait after a busy CAD.
+	/*!
+	Binary exponential backoff: 0 .. 2^attempt - 1 slots of one time-on-air.
+	\return wait in ms
+	*/
+	uint32_t backoffTime();
+
+	//! It checks the channel before a blocking send.
+	/*!
+	\return 'true' if the channel is free, 'false' if it stayed busy
+	*/
+	bool listenBeforeTalk();
+#endif
+
+#if LORA_DUTY_CYCLE
+	//! It charges the frame being put on air to the airtime ledger.
+	/*!
+	The time-on-air is the one of the frame length and header set in the
+	module, so ACKs and data packets are charged alike.
+	\return void
+	*/
+	void chargeAirtime();
+
+	//! It frees the airtime of the buckets that left the sliding window.
+	/*!
+	\return void
+	*/
+	void advanceAirtime();
+
+	//! It gets the airtime left in the budget of the sliding window.
+	/*!
+	\return time in ms
+	*/
+	uint32_t airtimeLeft();
+
+	//! It gets the wait until a packet fits in the budget.
+	/*!
+	\param uint16_t payloadlength : payload length of the packet.
+	\return time in ms, 0 to send now, 0xFFFFFFFF if it never fits
+	*/
+	uint32_t nextTxTime(uint16_t payloadlength);
+#endif
+
+#if LORA_LOW_POWER_RX
+	//! It gets the preamble of a data packet sent to a low-power listener.
+	/*!
+	The preamble lasts the sleep interval and one CAD of the receiver, so
+	one of its CADs falls in it whatever the phase of the two nodes.
+	\return preamble length in symbols
+	*/
+	uint16_t wakePreamble();
+
+	//! It ends low-power listening before a data packet is written in FIFO.
+	/*!
+	The FIFO is lost in sleep mode, so the module stays in standby, and the
+	preamble is stretched with wakePreamble().
+	\param uint8_t st0 : op mode saved by the caller.
+	\return op mode to go back to once the FIFO is written
+	*/
+	uint8_t wakePacket(uint8_t st0);
+
+	//! It puts the radio to sleep and starts low-power listening.
+	/*!
+	\return void
+	*/
+	void startListening();
+
+	//! It runs one step of low-power listening, without waiting.
+	/*!
+	Sleep, CAD every LORA_LPRX_INTERVAL_MS, Rx after a CAD that heard a
+	preamble. Before startListening() it only checks the module like
+	continuous Rx does.
+	\return 'true' if a packet may be waiting, to receive it
+	*/
+	bool lowPowerListen();
+#endif
+
+	//! It ends an asynchronous send attempt, retrying if allowed.
+	/*!
+	\param uint8_t state : state code of the attempt.
+	\return void
+	*/
+	void endAsyncTx(uint8_t state);
+
+	//! It sets the number of packets in flight in windowed mode.
+	/*!
+	\param uint8_t size : window size, 1 .. MAX_WINDOW.
+	\return '0' on success, '1' otherwise
+	*/
+	uint8_t setWindowSize(uint8_t size);
+
+	//! It starts sending a message split in a window of packets, and returns
+	//! at once.
+	/*!
+	The operation is driven by poll(). Each burst sends the missing packets
+	of the window, the last one asks for a block ACK.
+	\param uint8_t dest : message destination.
+	\param uint8_t *data : message, must stay valid until completion.
+	\param uint16_t length : message length.
+	\param uint8_t chunk : payload bytes per packet, 1 .. MAX_PAYLOAD - WINDOW_HEADER.
+	\param lora_async_callback callback : called on completion (can be 0).
+	\return handle of the operation, 0 if another one is in progress
+	*/
+	lora_async *sendWindowAsync(uint8_t dest,
+								uint8_t *data,
+								uint16_t length,
+								uint8_t chunk,
+								lora_async_callback callback = 0);
+
+	//! It sends a message split in a window of packets and waits for all of
+	//! them to be acknowledged.
+	/*!
+	\param uint8_t dest : message destination.
+	\param uint8_t *data : message.
+	\param uint16_t length : message length.
+	\param uint8_t chunk : payload bytes per packet, 1 .. MAX_PAYLOAD - WINDOW_HEADER.
+	\return '0' on success, '9' if a window got no ACK '_maxRetries' times
+	*/
+	uint8_t sendPacketWindow(uint8_t dest,
+							uint8_t *data,
+							uint16_t length,
+							uint8_t chunk);
+
+	//! It sends the missing packets of the window, starting a new burst.
+	/*!
+	\return void
+	*/
+	void startWindowBurst();
+
+	//! It writes a packet of the windowed message in FIFO and puts it on air.
+	/*!
+	\param uint8_t idx : packet index in the message.
+	\param bool listen : 'true' for the first packet of a burst, the
+	channel is checked before it (LORA_CSMA).
+	\return void
+	*/
+	void sendWindowPacket(uint8_t idx, bool listen);
+
+	//! It finds the next packet of the window not acknowledged yet.
+	/*!
+	\param uint8_t from : first packet index to check.
+	\return packet index, 'count' if there is none
+	*/
+	uint8_t nextWindowPacket(uint8_t from);
+
+	//! It applies a block ACK to the window and slides it.
+	/*!
+	\param uint8_t packnum : packet number acknowledged by the block ACK.
+	\param uint8_t bitmap : bit i set if packet 'packnum - i' was received.
+	\return 'true' if the window made progress, 'false' otherwise
+	*/
+	bool windowAck(uint8_t packnum, uint8_t bitmap);
+
 	//! It gets the internal temperature of the module.
 	/*!
 	It stores in global '_temp' variable the module temperature.
@@ -1220,10 +2257,9 @@ public:
 	*/
 	void showRxRegisters();
 
-	//! It sets the RTC settings with Meshlium timestamp configuration
-	/*! This function sends a special Frame to Meshlium (Meshlium's address must
-	 * be '1'), and then Meshlium returns an answer with the timestamp. This
-	 * function parses the info and sets the RTC Time and Date.
+	//! It checks the channel with a channel activity detection.
+	/*! The wait for CadDone is bounded by cadTime() and sleeps until the DIO
+	 * interrupt with LORA_USE_DIO_IRQ.
 	 * \return  'true' on cad detected, 'false' if not detected
 	*/
 	bool cadDetected();
@@ -1410,6 +2446,58 @@ public:
    	*/
 	pack packet_sent;
 
+	//! Variable : payload fragments of the packet sent, streamed into the FIFO.
+	//!
+  	/*!
+   	*/
+	lora_iovec _iov[MAX_IOV];
+
+	//! Variable : number of fragments in '_iov'.
+	//!
+  	/*!
+   	*/
+	uint8_t _iovCount;
+
+	//! Variable : flags added to the retry byte of the packets sent.
+	//!
+  	/*!
+   	*/
+	uint8_t _payloadFlags;
+
+#if LORA_ADR
+	//! Variable : signal level and mode of the link, see adr.hpp.
+	//!
+  	/*!
+   	*/
+	adr_link _adr;
+
+	//! Variable : mode offered in the ACK being sent, 0 if none.
+	//!
+  	/*!
+   	*/
+	uint8_t _adrOffer;
+
+	//! Variable : millis() of the last packet or ACK received.
+	//!
+  	/*!
+   	*/
+	uint32_t _adrHeard;
+#endif
+
+#if LORA_POWER_CONTROL
+	//! Variable : power level and last SNR report of each peer.
+	//!
+  	/*!
+   	*/
+	lora_peer _peers[LORA_TPC_PEERS];
+
+	//! Variable : entry of '_peers' given to the next new peer.
+	//!
+  	/*!
+   	*/
+	uint8_t _peerNext;
+#endif
+
 	//! Variable : array with all the information about a received packet.
 	//!
   	/*!
@@ -1420,7 +2508,13 @@ public:
 	//!
   	/*!
    	*/
-	pack ACK;
+	ack_pack ACK;
+
+	//! Variable : size of the buffer packet_received.data points to.
+	//!
+  	/*!
+   	*/
+	uint8_t _rxBufferSize;
 
 	//! Variable : temperature module.
 	//!
@@ -1434,144 +2528,338 @@ public:
    	*/
 	uint16_t _sendTime;
 
-  float Tsym;
-  float Tpreamble;
-  float payloadSymbNb;
+	//! Variable : interruption flags signalled on DIO lines and not yet cleared.
+	//!
+  	/*!
+   	*/
+	volatile uint8_t _irqPending;
+
+	//! Variable : current value of REG_DIO_MAPPING1.
+	//!
+  	/*!
+   	*/
+	uint8_t _dioMapping;
+
+	//! Variable : asynchronous operation in progress.
+	//!
+  	/*!
+   	*/
+	lora_async _async;
+
+	//! Variable : shadow copy of the configuration registers.
+	//!
+  	/*!
+   	*/
+	uint8_t _shadow[REG_CACHE_SIZE];
+
+	//! Variable : bitmap of the registers with a valid shadow value.
+	//!
+  	/*!
+   	*/
+	uint8_t _shadowValid[REG_CACHE_SIZE / 8];
+
+	//! Variable : bitmap of the registers read back since their last write.
+	//!
+  	/*!
+   	*/
+	uint8_t _shadowVerified[REG_CACHE_SIZE / 8];
+
+	//! Variable : last REG_OP_MODE value known, even if not shadowed.
+	//!
+  	/*!
+   	*/
+	uint8_t _cacheOpMode;
+
+	//! Variable : SPI transactions saved by the register shadow.
+	//!
+  	/*!
+   	*/
+	uint32_t _savedTransactions;
+
+	//! Variable : FIFO address after the last frame moved to the RX queue.
+	//!
+  	/*!
+   	*/
+	uint8_t _rxTail;
+
+	//! Variable : frames dropped in RXCONTINUOUS mode because of a CRC error.
+	//!
+  	/*!
+   	*/
+	uint16_t _rxCrcErrors;
+
+	//! Variable : times packets received before the last one were skipped
+	//! because their length was unknown (compact header) or a CRC error
+	//! was flagged among them.
+  	/*!
+   	*/
+	uint16_t _rxLost;
+
+	//! Variable : FIFO holds 'packet_sent' as last written.
+	//!
+  	/*!
+   	*/
+	bool _fifoValid;
+
+	//! Variable : FIFO address of 'packet_sent'.
+	//!
+  	/*!
+   	*/
+	uint8_t _fifoTxBase;
+
+	//! Variable : packets in flight in windowed mode.
+	//!
+  	/*!
+   	*/
+	uint8_t _windowSize;
+
+	//! Variable : windowed send in progress.
+	//!
+  	/*!
+   	*/
+	lora_window _win;
+
+#if LORA_DUTY_CYCLE
+	//! Variable : airtime ledger of the duty-cycle budget.
+	//!
+  	/*!
+   	*/
+	lora_airtime _airtime;
+#endif
+
+#if LORA_LOW_POWER_RX
+	//! Variable : low-power listening step (LISTEN_OFF .. LISTEN_RX).
+	//!
+  	/*!
+   	*/
+	uint8_t _listen;
+
+	//! Variable : millis() at the start of the listening step.
+	//!
+  	/*!
+   	*/
+	uint32_t _listenSince;
+#endif
+
+#if LORA_CSMA
+	//! Variable : listen before talk state and counters.
+	//!
+  	/*!
+   	*/
+	lora_csma _csma;
+#endif
+
+	//! Variable : source of the last windowed packet received.
+	//!
+  	/*!
+   	*/
+	uint8_t _winPeer;
+
+	//! Variable : highest packet number received from '_winPeer'.
+	//!
+  	/*!
+   	*/
+	uint8_t _winHigh;
+
+	//! Variable : packets received from '_winPeer' (bit i = '_winHigh - i').
+	//!
+  	/*!
+   	*/
+	uint16_t _winSeen;
+
+	//! Variable : buffer windowed messages are reassembled into.
+	//!
+  	/*!
+   	*/
+	uint8_t *_winMsg;
+
+	//! Variable : size of '_winMsg'.
+	//!
+  	/*!
+   	*/
+	uint16_t _winMsgSize;
+
+	//! Variable : message bytes received in '_winMsg'.
+	//!
+  	/*!
+   	*/
+	uint16_t _winMsgFilled;
+
+	//! Variable : message length, 0 until its last packet is received.
+	//!
+  	/*!
+   	*/
+	uint16_t _winMsgLength;
 };
 
 extern SX1278	sx1278;
 
 
+/*
+ Function: Bandwidth of a BW_* setting.
+ Returns: Bandwidth in Hz, as used by the Semtech LoRa calculator
+*/
+constexpr uint32_t loraBandwidthHz(uint8_t bw)
+{
+	return	(bw == BW_7_8)	? 7800 :
+			(bw == BW_10_4)	? 10400 :
+			(bw == BW_15_6)	? 15600 :
+			(bw == BW_20_8)	? 20800 :
+			(bw == BW_31_2)	? 31250 :
+			(bw == BW_41_7)	? 41700 :
+			(bw == BW_62_5)	? 62500 :
+			(bw == BW_250)	? 250000 :
+			(bw == BW_500)	? 500000 : 125000;
+}
+
+/*
+ Function: Time-on-air of a LoRa packet (Semtech formula, SX1276/77/78/79
+ datasheet 4.1.1.7) in integer arithmetic. Symbols are counted in quarters so
+ the 4.25 symbols of the preamble sync are exact.
+ Returns: Time-on-air in us, rounded down
+ Parameters:
+   sf: spreading factor (SF_6 .. SF_12)
+   bw: bandwidth (BW_7_8 .. BW_500)
+   cr: coding rate (CR_5 .. CR_8)
+   length: total packet length in bytes
+   explicit_header: explicit header mode (HEADER_ON)
+   crc: payload CRC on
+   ldro: LowDataRateOptimize on
+   preamble: programmed preamble length in symbols
+*/
+constexpr uint32_t loraTimeOnAirUs(uint8_t sf,
+									uint8_t bw,
+									uint8_t cr,
+									uint16_t length,
+									bool explicit_header,
+									bool crc,
+									bool ldro,
+									uint16_t preamble = 8)
+{
+	int32_t num = 8 * (int32_t)length - 4 * sf + 28 + (crc ? 16 : 0) - (explicit_header ? 0 : 20);
+	int32_t den = 4 * (sf - (ldro ? 2 : 0));
+	uint32_t payload_symbols = 8 + ((num > 0) ? (uint32_t)((num + den - 1) / den) * (cr + 4) : 0);
+	uint32_t quarter_symbols = 4 * (uint32_t)preamble + 17 + 4 * payload_symbols;
+
+	return (uint32_t)((((uint64_t)quarter_symbols << sf) * 250000) / loraBandwidthHz(bw));
+}
+
+//! Structure : modulation parameters of a LoraMode<N>.
+/*!
+	LowDataRateOptimize follows the driver: on for SF_11 and SF_12 up to BW_125.
+ */
+template<uint8_t BW, uint8_t CR, uint8_t SF>
+struct LoraModeParams{
+  static_assert(BW <= BW_500, "LoraMode: invalid bandwidth");
+  static_assert((CR >= CR_5) && (CR <= CR_8), "LoraMode: invalid coding rate");
+  static_assert((SF >= SF_6) && (SF <= SF_12), "LoraMode: invalid spreading factor");
+
+  static const uint8_t bandwidth = BW;
+  static const uint8_t codingrate = CR;
+  static const uint8_t spreadingfactor = SF;
+  static const bool ldro = (SF >= SF_11) && (BW <= BW_125);
+
+  // Register image written by setMode(). Bits out of '*_mask' (header, CRC,
+  // TX continuous) keep their current value.
+  // REG_MODEM_CONFIG1: Bw | CodingRate | ImplicitHeaderModeOn (mandatory with SF_6)
+  static const uint8_t config1 = (BW << 4) | (CR << 1) | ((SF == SF_6) ? 0x01 : 0x00);
+  static const uint8_t config1_mask = (SF == SF_6) ? 0xFF : 0xFE;
+  // REG_MODEM_CONFIG2: SpreadingFactor | SymbTimeout(9:8)
+  static const uint8_t config2 = (SF << 4) | 0x03;
+  static const uint8_t config2_mask = 0xF3;
+  // REG_MODEM_CONFIG3: LowDataRateOptimize | AgcAutoOn
+  static const uint8_t config3 = (ldro ? 0x08 : 0x00) | 0x04;
+  static const uint8_t config3_mask = 0x0C;
+  static const uint8_t detect_optimize = (SF == SF_6) ? 0x05 : 0x03;
+  static const uint8_t detection_threshold = (SF == SF_6) ? 0x0C : 0x0A;
+
+  //! Time-on-air in us of a packet of 'length' bytes (explicit header, CRC on).
+  static constexpr uint32_t timeOnAirUs(uint16_t length, uint16_t preamble = 8)
+  {
+    return loraTimeOnAirUs(SF, BW, CR, length, true, true, ldro, preamble);
+  }
+};
+
 template<int type>
 struct LoraMode{ };
 
 // mode 1 (better reach, medium time on air)
 template<>
-struct LoraMode<1>{
-  static const uint8_t bandwidth = BW_125;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_12;
-};
+struct LoraMode<1> : LoraModeParams<BW_125, CR_5, SF_12>{ };
 
 // mode 2 (medium reach, less time on air)
 template<>
-struct LoraMode<2>{
-  static const uint8_t bandwidth = BW_250;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_12;
-};
+struct LoraMode<2> : LoraModeParams<BW_250, CR_5, SF_12>{ };
 
 // mode 3 (worst reach, less time on air)
 template<>
-struct LoraMode<3>{
-  static const uint8_t bandwidth = BW_125;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_10;
-};
+struct LoraMode<3> : LoraModeParams<BW_125, CR_5, SF_10>{ };
 
 // mode 4 (better reach, low time on air)
 template<>
-struct LoraMode<4>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_12;
-};
+struct LoraMode<4> : LoraModeParams<BW_500, CR_5, SF_12>{ };
 
 // mode 5 (better reach, medium time on air)
 template<>
-struct LoraMode<5>{
-  static const uint8_t bandwidth = BW_250;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_10;
-};
+struct LoraMode<5> : LoraModeParams<BW_250, CR_5, SF_10>{ };
 
 // mode 6 (better reach, worst time-on-air)
 template<>
-struct LoraMode<6>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_11;
-};
+struct LoraMode<6> : LoraModeParams<BW_500, CR_5, SF_11>{ };
 
 // mode 7 (medium-high reach, medium-low time-on-air)
 template<>
-struct LoraMode<7>{
-  static const uint8_t bandwidth = BW_250;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_9;
-};
+struct LoraMode<7> : LoraModeParams<BW_250, CR_5, SF_9>{ };
 
 // mode 8 (medium reach, medium time-on-air)
 template<>
-struct LoraMode<8>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_9;
-};
+struct LoraMode<8> : LoraModeParams<BW_500, CR_5, SF_9>{ };
 
 // mode 9 (medium-low reach, medium-high time-on-air)
 template<>
-struct LoraMode<9>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_8;
-};
+struct LoraMode<9> : LoraModeParams<BW_500, CR_5, SF_8>{ };
 
 // mode 10 (worst reach, less time_on_air)
 template<>
-struct LoraMode<10>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_7;
-};
+struct LoraMode<10> : LoraModeParams<BW_500, CR_5, SF_7>{ };
 
 // mode 11 (test / TOA: 1091ms, Link Budget: 160.3dB, Max Crystal Offset: 4.5ppm) // 9byte explicit header, CRC ON, optimizer OFF, 433MHz, 20dBm TX
 template<>
-struct LoraMode<11>{
-  static const uint8_t bandwidth = BW_7_8;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_8;
-};
+struct LoraMode<11> : LoraModeParams<BW_7_8, CR_5, SF_8>{ };
 
 // mode 12 (test / TOA: 3708ms, Link Budget: 165.6dB, Max Crystal Offset: 4.5ppm) // 9byte explicit header, CRC ON, optimizer OFF, preamble 6symbol, 433MHz, 20dBm TX
 template<>
-struct LoraMode<12>{
-  static const uint8_t bandwidth = BW_7_8;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_10;
-};
+struct LoraMode<12> : LoraModeParams<BW_7_8, CR_5, SF_10>{ };
 
 // mode 13 (test / TOA: 3702ms, Link Budget: 164.1dB, Max Crystal Offset: 18ppm) // 9byte explicit header, CRC ON, optimizer OFF, preamble 6symbol, 433MHz, 20dBm TX
 template<> // NOTE: reached to my dorm room from Techneon
-struct LoraMode<13>{
-  static const uint8_t bandwidth = BW_31_2;
-  static const uint8_t codingrate = CR_5;
-  static const uint8_t spreadingfactor = SF_12;
-};
+struct LoraMode<13> : LoraModeParams<BW_31_2, CR_5, SF_12>{ };
 
 // mode 14 (test / TOA: 4489ms, Link Budget: 164.1dB, Max Crystal Offset: 18ppm) // 9byte explicit header, CRC ON, optimizer OFF, preamble 6symbol, 433MHz, 20dBm TX
 template<>
-struct LoraMode<14>{
-  static const uint8_t bandwidth = BW_31_2;
-  static const uint8_t codingrate = CR_8;
-  static const uint8_t spreadingfactor = SF_12;
-};
+struct LoraMode<14> : LoraModeParams<BW_31_2, CR_8, SF_12>{ };
 
 // mode 15 (test / TOA: 561.15ms, Link Budget: 155.5dB, Max Crystal Offset: 72.2ppm) // 9byte explicit header, CRC ON, optimizer ON, preamble 6symbol, 433MHz, 20dBm TX
 template<>
-struct LoraMode<15>{
-  static const uint8_t bandwidth = BW_125;
-  static const uint8_t codingrate = CR_8;
-  static const uint8_t spreadingfactor = SF_11;
-};
+struct LoraMode<15> : LoraModeParams<BW_125, CR_8, SF_11>{ };
 
 // mode 16 (test / TOA: 12.86ms, Link Budget: 138dB, Max Crystal Offset: 288.7ppm) // 9byte explicit header, CRC ON, optimizer OFF, preamble 6symbol, 433MHz, 20dBm TX
 template<>
-struct LoraMode<16>{
-  static const uint8_t bandwidth = BW_500;
-  static const uint8_t codingrate = CR_8;
-  static const uint8_t spreadingfactor = SF_7;
-};
+struct LoraMode<16> : LoraModeParams<BW_500, CR_8, SF_7>{ };
+
+// Checked against the TOA given above for 9 bytes and a 6 symbol preamble
+static_assert(LoraMode<16>::timeOnAirUs(9, 6) == 12864, "time-on-air of mode 16");
+static_assert(LoraMode<15>::timeOnAirUs(9, 6) == 561152, "time-on-air of mode 15");
+static_assert(loraTimeOnAirUs(SF_10, BW_7_8, CR_5, 9, true, true, false, 6) / 1000 == 3708, "time-on-air of mode 12");
+// 12 characters from main.cpp: 5-byte header and 4-byte message number, or
+// the compact header and a 1-byte varint
+static_assert(LoraMode<15>::timeOnAirUs(12 + 4 + 5, 6) == 954368, "chat message, standard header");
+static_assert(LoraMode<15>::timeOnAirUs(12 + 1 + 4, 6) == 823296, "chat message, compact header (-14%)");
+// ACK of mode 15, with and without the PHY header
+static_assert(loraTimeOnAirUs(LoraMode<15>::spreadingfactor, LoraMode<15>::bandwidth, LoraMode<15>::codingrate, ACK_LENGTH,
+	true, true, LoraMode<15>::ldro, 6) == 561152, "ACK, explicit header");
+static_assert(loraTimeOnAirUs(LoraMode<15>::spreadingfactor, LoraMode<15>::bandwidth, LoraMode<15>::codingrate, ACK_LENGTH,
+	false, true, LoraMode<15>::ldro, 6) == 430080, "ACK, implicit header (-23%)");
 
 /*
  Function: Sets the bandwidth, coding rate and spreading factor of the LoRa modulation.
@@ -1586,10 +2874,11 @@ struct LoraMode<16>{
 template<uint16_t mode>
 int8_t SX1278::setMode()
 {
+	typedef LoraMode<mode> M;
 	int8_t state = 2;
 	uint8_t st0;
-	uint8_t config1 = 0x00;
-	uint8_t config2 = 0x00;
+	uint8_t config[2];
+	SpiBatch batch;
 
 	#if (SX1278_debug_mode > 1)
 		Serial.println();
@@ -1607,21 +2896,34 @@ int8_t SX1278::setMode()
 	// LoRa standby mode
 	writeRegister(REG_OP_MODE, LORA_STANDBY_MODE);
 
-	setCR(LoraMode<mode>::codingrate);
-	setSF(LoraMode<mode>::spreadingfactor);
-	setBW(LoraMode<mode>::bandwidth);
-
-	state = 1;
-	config1 = readRegister(REG_MODEM_CONFIG1);
-	// (config1 >> 4) ---> take out bits 7-4 from REG_MODEM_CONFIG1 (=_bandwidth)
-	// ((config1 >> 1) & 0x07) ---> take out bits 3-1 from REG_MODEM_CONFIG1 (=_codingRate)
-	// (config2 >> 4) ---> take out bits 7-4 from REG_MODEM_CONFIG2 (=_spreadingFactor)
-	if( (config1 >> 4) == LoraMode<mode>::bandwidth && ((config1 >> 1) & 0x07) == LoraMode<mode>::codingrate) {
-		config2 = readRegister(REG_MODEM_CONFIG2);
-		if( (config2 >> 4) == LoraMode<mode>::spreadingfactor ) {
-			state = 0;
-		}
+	// REG_MODEM_CONFIG1 and REG_MODEM_CONFIG2 are consecutive: one burst
+	config[0] = (readRegister(REG_MODEM_CONFIG1) & ~M::config1_mask) | M::config1;
+	config[1] = (readRegister(REG_MODEM_CONFIG2) & ~M::config2_mask) | M::config2;
+	batch.write(REG_MODEM_CONFIG1, config[0]);
+	batch.write(REG_MODEM_CONFIG2, config[1]);
+	batch.write(REG_MODEM_CONFIG3, (readRegister(REG_MODEM_CONFIG3) & ~M::config3_mask) | M::config3);
+	batch.write(REG_DETECT_OPTIMIZE, M::detect_optimize);
+	batch.write(REG_DETECTION_THRESHOLD, M::detection_threshold);
+	writeBatch(batch);
+
+	_bandwidth = M::bandwidth;
+	_codingRate = M::codingrate;
+	_spreadingFactor = M::spreadingfactor;
+	if( M::spreadingfactor == SF_6 )
+	{
+		_header = HEADER_OFF;	// Mandatory headerOFF with SF = 6 (Implicit mode)
 	}
+	state = 0;
+
+	#if SX1278_VERIFY_WRITES
+		// One burst read to check the modulation bits
+		uint8_t check[2];
+		readRegisters(REG_MODEM_CONFIG1, check, 2);
+		if( (check[0] != config[0]) || (check[1] != config[1]) )
+		{
+			state = 1;
+		}
+	#endif
 
 	#if (SX1278_debug_mode > 1)
 	if( state == 0 )
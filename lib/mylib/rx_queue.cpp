@@ -0,0 +1,57 @@
+#include "rx_queue.hpp"
+
+static rx_frame rx_queue[RX_QUEUE_LEN];
+static uint8_t rx_queue_head = 0; // oldest frame
+static uint8_t rx_queue_cnt = 0;
+uint16_t rx_queue_dropped = 0;
+
+static rx_frame* rx_queue_slot(uint8_t i){
+  uint8_t idx = rx_queue_head + i;
+  if(idx >= RX_QUEUE_LEN) idx -= RX_QUEUE_LEN;
+  return &rx_queue[idx];
+}
+
+rx_frame* rx_queue_push(uint8_t sz){
+  if((rx_queue_cnt == RX_QUEUE_LEN) || (sz > RX_FRAME_MAX)){
+    rx_queue_dropped++;
+    return 0;
+  }
+  return rx_queue_slot(rx_queue_cnt);
+}
+
+void rx_queue_commit(){
+  rx_queue_cnt++;
+}
+
+rx_frame* rx_queue_front(){
+  if(rx_queue_cnt == 0) return 0;
+  return &rx_queue[rx_queue_head];
+}
+
+rx_frame* rx_queue_at(uint8_t i){
+  if(i >= rx_queue_cnt) return 0;
+  return rx_queue_slot(i);
+}
+
+void rx_queue_pop(){
+  if(rx_queue_cnt == 0) return;
+  rx_queue_head++;
+  if(rx_queue_head == RX_QUEUE_LEN) rx_queue_head = 0;
+  rx_queue_cnt--;
+}
+
+// The older frames move up one slot, the one freed is popped
+void rx_queue_remove(uint8_t i){
+  if(i >= rx_queue_cnt) return;
+  for(; i > 0; i--){
+    rx_frame *to = rx_queue_slot(i);
+    rx_frame *from = rx_queue_slot(i - 1);
+    to->sz = from->sz;
+    for(uint8_t b = 0; b < from->sz; b++) to->data[b] = from->data[b];
+  }
+  rx_queue_pop();
+}
+
+uint8_t rx_queue_count(){
+  return rx_queue_cnt;
+}
@@ -0,0 +1,24 @@
+#ifndef RX_QUEUE_HPP
+#define RX_QUEUE_HPP
+
+#include <stdint.h>
+#include "definitions.hpp"
+
+// Frames moved out of the radio FIFO while it keeps receiving in RXCONTINUOUS
+// mode. Filled and drained from the main loop, not from interrupts.
+struct rx_frame{
+  uint8_t sz;
+  uint8_t data[RX_FRAME_MAX];
+};
+
+extern uint16_t rx_queue_dropped; // frames lost because the queue was full or they were too long
+
+rx_frame* rx_queue_push(uint8_t sz); // slot for a frame of sz bytes, 0 if full or sz > RX_FRAME_MAX. Call rx_queue_commit() once filled
+void rx_queue_commit();
+rx_frame* rx_queue_front();  // oldest frame, 0 if empty
+rx_frame* rx_queue_at(uint8_t i); // i-th oldest frame, 0 if there are not that many
+void rx_queue_pop();
+void rx_queue_remove(uint8_t i); // removes the i-th oldest frame, the others keep their order
+uint8_t rx_queue_count();
+
+#endif
@@ -1,99 +1,181 @@
 #include "spi.hpp"
 
+#if SPI_BACKEND == 0 // bit-bang backend, see spi_hw.cpp for SPI1 + DMA
+
+// GPIO clocks must be enabled
+void spi_setup(){
+  gpio_mode_setup(SPI_SCK_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_SCK_PIN);
+  gpio_mode_setup(SPI_MISO_PORT, GPIO_MODE_INPUT, GPIO_PUPD_NONE, SPI_MISO_PIN);
+  gpio_mode_setup(SPI_MOSI_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_MOSI_PIN);
+  gpio_mode_setup(SPI_NSS_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_NSS_PIN);
+  gpio_set_output_options(SPI_SCK_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_HIGH, SPI_SCK_PIN);
+  gpio_set_output_options(SPI_MOSI_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_HIGH, SPI_MOSI_PIN);
+  gpio_set_output_options(SPI_NSS_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_HIGH, SPI_NSS_PIN);
+  unselect_chip();
+}
+
+// SCK half period in core cycles for the SX1278 limit, rounded up
+static const uint32_t half_period = (SPI_CORE_CLOCK_HZ + 2 * SPI_MAX_CLOCK_HZ - 1) / (2 * SPI_MAX_CLOCK_HZ);
+// Each half period ends with the store of its SCK edge, 2 cycles on the
+// Cortex-M0 (STR, TRM table 3-1). It is all the SCK high phase of a write and
+// the SCK low phase of a read hold besides the padding; the other phase also
+// updates MOSI or samples MISO and is longer. SPI_BENCHMARK gives the cycles.
+static const uint32_t half_period_work = 2;
+
+// Private Function, pads a half period to 'half_period' cycles
+template<uint32_t N>
+static inline void delay_cycles(){
+  asm volatile("nop");
+  delay_cycles<N - 1>();
+}
+template<>
+inline void delay_cycles<0>(){ }
+
+static inline void pad_half_period(){
+  delay_cycles<(half_period > half_period_work) ? half_period - half_period_work : 0>();
+}
+
+// Private Function, MSB first: bit BIT then the lower ones, fully unrolled
+template<int BIT>
+static inline void write_bits(uint32_t val){
+  SpiMosi::write(val >> BIT);
+  pad_half_period();
+  SpiSck::set();
+  pad_half_period();
+  SpiSck::clear();
+  write_bits<BIT - 1>(val);
+}
+template<>
+inline void write_bits<-1>(uint32_t){ }
+
+template<int BIT>
+static inline uint32_t read_bits(uint32_t res){
+  pad_half_period();
+  SpiSck::set();
+  res = (res << 1) | SpiMiso::level();
+  pad_half_period();
+  SpiSck::clear();
+  return read_bits<BIT - 1>(res);
+}
+template<>
+inline uint32_t read_bits<-1>(uint32_t res){ return res; }
+
 // Private Function, assumes NSS and SCK low
-void write_byte(uint8_t val){
-  for(int i = 8; i; --i){
-    if (val & 0x80)
-      set_mosi();
-    else clear_mosi();
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    set_sck();
-    val <<= 1;
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    clear_sck();
-  }
+static void write_byte(uint8_t val){
+  write_bits<7>(val);
 }
 // Private Function, assumes NSS and SCK low
-uint8_t read_byte(){
-  uint8_t res = 0;
-  for(int i = 8; i; --i){
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    set_sck();
-    res <<= 1;
-    if (get_miso())
-      res |= 1;
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    asm volatile("nop");
-    clear_sck();
-  }
-
-  return res;
+static uint8_t read_byte(){
+  return read_bits<7>(0);
 }
 
-void spi_write(uint8_t reg, uint8_t sz, uint8_t *data){
+// Opens a burst transaction: NSS stays low until spi_burst_end()
+void spi_write_start(uint8_t reg){
   clear_sck();
   select_chip();
 
   write_byte(reg | 0x80);
-  for(int i = sz; i; --i) write_byte(data[sz - i]);
-
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  unselect_chip();
 }
-
-void spi_read(uint8_t reg, uint8_t sz, uint8_t *data){
+void spi_read_start(uint8_t reg){
   clear_sck();
   select_chip();
 
   write_byte(reg & 0x7F);
   clear_mosi();
+}
+void spi_burst_write(uint8_t sz, const uint8_t *data){
+  for(int i = sz; i; --i) write_byte(data[sz - i]);
+}
+void spi_burst_read(uint8_t sz, uint8_t *data){
   for(int i = sz; i; --i) data[sz - i] = read_byte();
-
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
+}
+void spi_burst_end(){
+  pad_half_period();
   unselect_chip();
 }
 
+#endif
+
+void spi_write(uint8_t reg, uint8_t sz, uint8_t *data){
+  spi_write_start(reg);
+  spi_burst_write(sz, data);
+  spi_burst_end();
+}
+
+void spi_read(uint8_t reg, uint8_t sz, uint8_t *data){
+  spi_read_start(reg);
+  spi_burst_read(sz, data);
+  spi_burst_end();
+}
+
+SpiBatch::SpiBatch(){
+  _count = 0;
+}
+
+void SpiBatch::clear(){
+  _count = 0;
+}
+
+// Adds a register write, keeping the entries sorted by address. Returns
+// false if the batch is full.
+bool SpiBatch::write(uint8_t reg, uint8_t value){
+  uint8_t i = 0;
+
+  while(i < _count && _reg[i] < reg)
+    i++;
+
+  if(i < _count && _reg[i] == reg){
+    _value[i] = value;
+    return true;
+  }
+  if(_count == SPI_BATCH_LEN)
+    return false;
+
+  for(uint8_t j = _count; j > i; j--){
+    _reg[j] = _reg[j - 1];
+    _value[j] = _value[j - 1];
+  }
+  _reg[i] = reg;
+  _value[i] = value;
+  _count++;
+  return true;
+}
+
+void SpiBatch::remove(uint8_t i){
+  for(_count--; i < _count; i++){
+    _reg[i] = _reg[i + 1];
+    _value[i] = _value[i + 1];
+  }
+}
+
+// Number of entries from i on whose addresses follow each other.
+uint8_t SpiBatch::run(uint8_t i) const{
+  uint8_t n = 1;
+
+  while(i + n < _count && _reg[i + n] == _reg[i] + n)
+    n++;
+  return n;
+}
+
+// Sends the batch, one chip select per run, and empties it. Returns the
+// number of transactions used.
+uint8_t SpiBatch::flush(){
+  uint8_t cycles = 0;
+
+  for(uint8_t i = 0, n; i < _count; i += n){
+    n = run(i);
+    if(n == 1)
+      spi_write8(_reg[i], _value[i]);
+    else
+      spi_write(_reg[i], n, &_value[i]);
+    cycles++;
+  }
+  _count = 0;
+  return cycles;
+}
+
+#if SPI_BACKEND == 0
+
 void spi_write8(uint8_t reg, uint8_t data){
   clear_sck();
   select_chip();
@@ -101,14 +183,7 @@ void spi_write8(uint8_t reg, uint8_t data){
   write_byte(reg | 0x80);
   write_byte(data);
 
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
+  pad_half_period();
   unselect_chip();
 }
 uint8_t spi_read8(uint8_t reg){
@@ -119,14 +194,9 @@ uint8_t spi_read8(uint8_t reg){
   clear_mosi();
   uint8_t res = read_byte();
 
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
-  asm volatile("nop");
+  pad_half_period();
   unselect_chip();
   return res;
 }
+
+#endif
@@ -4,32 +4,84 @@
 #include "definitions.hpp"
 #include <libopencm3/stm32/gpio.h>
 
+// Pin known at compile time: a single store to BSRR/BRR or load from IDR,
+// instead of a call into libopencm3 with the port and pin as arguments.
+template<uint32_t PORT, uint16_t PIN>
+struct FastPin{
+  static inline void set(){ GPIO_BSRR(PORT) = PIN; }
+  static inline void clear(){ GPIO_BRR(PORT) = PIN; }
+  // bit 0 of 'level' drives the pin, no branch
+  static inline void write(uint32_t level){ GPIO_BSRR(PORT) = ((uint32_t)PIN << 16) >> ((level & 1) << 4); }
+  static inline uint32_t get(){ return GPIO_IDR(PORT) & PIN; }
+  // 0 or 1, no branch
+  static inline uint32_t level(){ return (GPIO_IDR(PORT) >> __builtin_ctz(PIN)) & 1; }
+};
+
+typedef FastPin<SPI_SCK_PORT, SPI_SCK_PIN> SpiSck;
+typedef FastPin<SPI_MISO_PORT, SPI_MISO_PIN> SpiMiso;
+typedef FastPin<SPI_MOSI_PORT, SPI_MOSI_PIN> SpiMosi;
+typedef FastPin<SPI_NSS_PORT, SPI_NSS_PIN> SpiNss;
+
 inline uint16_t get_miso(){
-  return gpio_get(SPI_MISO_PORT, SPI_MISO_PIN);
+  return SpiMiso::get();
 }
 inline void set_mosi(){
-  gpio_set(SPI_MOSI_PORT, SPI_MOSI_PIN);
+  SpiMosi::set();
 }
 inline void clear_mosi(){
-  gpio_clear(SPI_MOSI_PORT, SPI_MOSI_PIN);
+  SpiMosi::clear();
 }
 inline void set_sck(){
-  gpio_set(SPI_SCK_PORT, SPI_SCK_PIN);
+  SpiSck::set();
 }
 inline void clear_sck(){
-  gpio_clear(SPI_SCK_PORT, SPI_SCK_PIN);
+  SpiSck::clear();
 }
 inline void select_chip(){
-  gpio_clear(SPI_NSS_PORT, SPI_NSS_PIN);
+  SpiNss::clear();
 }
 inline void unselect_chip(){
-  gpio_set(SPI_NSS_PORT, SPI_NSS_PIN);
+  SpiNss::set();
 }
 
+// Bus backend, selected with SPI_BACKEND: bit-bang (spi.cpp) or SPI1 + DMA
+// (spi_hw.cpp). Both implement the functions below.
+void spi_setup();
+
+// Burst access: one NSS cycle and one address byte for any number of data
+// bytes. The SX1278 auto-increments the address (or the FIFO pointer for
+// REG_FIFO) after each byte. Always close with spi_burst_end().
+void spi_write_start(uint8_t reg);
+void spi_read_start(uint8_t reg);
+void spi_burst_write(uint8_t sz, const uint8_t *data);
+void spi_burst_read(uint8_t sz, uint8_t *data);
+void spi_burst_end();
+
 void spi_write(uint8_t reg, uint8_t sz, uint8_t *data);
 void spi_read(uint8_t reg, uint8_t sz, uint8_t *data);
 
 void spi_write8(uint8_t reg, uint8_t data);
 uint8_t spi_read8(uint8_t reg);
 
+// Collects independent register writes and sends them with one burst per
+// run of consecutive addresses. Entries are kept sorted by address, a second
+// write to the same register replaces the first. Only put registers whose
+// write order does not matter in a batch (not RegOpMode).
+#define SPI_BATCH_LEN 8
+
+class SpiBatch{
+public:
+  SpiBatch();
+
+  void clear();
+  bool write(uint8_t reg, uint8_t value);
+  void remove(uint8_t i);
+  uint8_t run(uint8_t i) const;
+  uint8_t flush();
+
+  uint8_t _reg[SPI_BATCH_LEN];
+  uint8_t _value[SPI_BATCH_LEN];
+  uint8_t _count;
+};
+
 #endif
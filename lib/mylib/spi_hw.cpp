@@ -0,0 +1,142 @@
+#include "spi.hpp"
+
+#if SPI_BACKEND == 1 // SPI1 peripheral backend, see spi.cpp for bit-bang
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+
+// SPI1 requests are fixed on the STM32F042
+#define SPI_DMA_RX_CHANNEL  DMA_CHANNEL2
+#define SPI_DMA_TX_CHANNEL  DMA_CHANNEL3
+
+static const uint8_t dma_zero = 0x00; // sent while reading
+static uint8_t dma_sink;             // received while writing
+
+// GPIO clocks must be enabled
+void spi_setup(){
+  rcc_periph_clock_enable(RCC_SPI1);
+  rcc_periph_clock_enable(RCC_DMA);
+
+  gpio_mode_setup(SPI_SCK_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, SPI_SCK_PIN);
+  gpio_mode_setup(SPI_MISO_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, SPI_MISO_PIN);
+  gpio_mode_setup(SPI_MOSI_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, SPI_MOSI_PIN);
+  gpio_set_output_options(SPI_SCK_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_HIGH, SPI_SCK_PIN);
+  gpio_set_output_options(SPI_MOSI_PORT, GPIO_OTYPE_PP, GPIO_OSPEED_HIGH, SPI_MOSI_PIN);
+  gpio_set_af(SPI_SCK_PORT, SPI_AF, SPI_SCK_PIN);
+  gpio_set_af(SPI_MISO_PORT, SPI_AF, SPI_MISO_PIN);
+  gpio_set_af(SPI_MOSI_PORT, SPI_AF, SPI_MOSI_PIN);
+
+  // NSS stays a GPIO: it must frame whole bursts, not single bytes
+  gpio_mode_setup(SPI_NSS_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, SPI_NSS_PIN);
+  unselect_chip();
+
+  // Mode 0, MSB first, 48MHz / 8 = 6MHz (SX1278 limit is 10MHz)
+  spi_reset(SPI1);
+  spi_init_master(SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_8, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+                  SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_MSBFIRST);
+  spi_set_data_size(SPI1, SPI_CR2_DS_8BIT);
+  spi_fifo_reception_threshold_8bit(SPI1); // RXNE on each byte
+  spi_enable_software_slave_management(SPI1);
+  spi_set_nss_high(SPI1);
+  spi_enable(SPI1);
+}
+
+// Private Function, one byte in each direction
+static inline uint8_t transfer_byte(uint8_t val){
+  while(!(SPI_SR(SPI1) & SPI_SR_TXE));
+  SPI_DR8(SPI1) = val;
+  while(!(SPI_SR(SPI1) & SPI_SR_RXNE));
+  return SPI_DR8(SPI1);
+}
+
+// Private Function, waits for the last byte to leave the shift register
+static inline void wait_idle(){
+  while(SPI_SR(SPI1) & SPI_SR_BSY);
+}
+
+// Private Function, 'sz' bytes in each direction with DMA. The RX channel
+// always runs so the RX FIFO never overflows; tx/rx = 0 use a dummy byte.
+static void transfer_dma(const uint8_t *tx, uint8_t *rx, uint8_t sz){
+  dma_channel_reset(DMA1, SPI_DMA_RX_CHANNEL);
+  dma_set_peripheral_address(DMA1, SPI_DMA_RX_CHANNEL, (uint32_t)(uintptr_t)&SPI_DR8(SPI1));
+  dma_set_memory_address(DMA1, SPI_DMA_RX_CHANNEL, (uint32_t)(uintptr_t)(rx ? rx : &dma_sink));
+  dma_set_number_of_data(DMA1, SPI_DMA_RX_CHANNEL, sz);
+  dma_set_read_from_peripheral(DMA1, SPI_DMA_RX_CHANNEL);
+  if(rx) dma_enable_memory_increment_mode(DMA1, SPI_DMA_RX_CHANNEL);
+  dma_set_peripheral_size(DMA1, SPI_DMA_RX_CHANNEL, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size(DMA1, SPI_DMA_RX_CHANNEL, DMA_CCR_MSIZE_8BIT);
+  dma_set_priority(DMA1, SPI_DMA_RX_CHANNEL, DMA_CCR_PL_VERY_HIGH);
+
+  dma_channel_reset(DMA1, SPI_DMA_TX_CHANNEL);
+  dma_set_peripheral_address(DMA1, SPI_DMA_TX_CHANNEL, (uint32_t)(uintptr_t)&SPI_DR8(SPI1));
+  dma_set_memory_address(DMA1, SPI_DMA_TX_CHANNEL, (uint32_t)(uintptr_t)(tx ? tx : &dma_zero));
+  dma_set_number_of_data(DMA1, SPI_DMA_TX_CHANNEL, sz);
+  dma_set_read_from_memory(DMA1, SPI_DMA_TX_CHANNEL);
+  if(tx) dma_enable_memory_increment_mode(DMA1, SPI_DMA_TX_CHANNEL);
+  dma_set_peripheral_size(DMA1, SPI_DMA_TX_CHANNEL, DMA_CCR_PSIZE_8BIT);
+  dma_set_memory_size(DMA1, SPI_DMA_TX_CHANNEL, DMA_CCR_MSIZE_8BIT);
+  dma_set_priority(DMA1, SPI_DMA_TX_CHANNEL, DMA_CCR_PL_HIGH);
+
+  // RX first, TX starts the clock
+  dma_enable_channel(DMA1, SPI_DMA_RX_CHANNEL);
+  spi_enable_rx_dma(SPI1);
+  dma_enable_channel(DMA1, SPI_DMA_TX_CHANNEL);
+  spi_enable_tx_dma(SPI1);
+
+  // Last byte received means every byte has been shifted out
+  while(!dma_get_interrupt_flag(DMA1, SPI_DMA_RX_CHANNEL, DMA_TCIF));
+
+  spi_disable_tx_dma(SPI1);
+  spi_disable_rx_dma(SPI1);
+  dma_disable_channel(DMA1, SPI_DMA_TX_CHANNEL);
+  dma_disable_channel(DMA1, SPI_DMA_RX_CHANNEL);
+  dma_clear_interrupt_flags(DMA1, SPI_DMA_TX_CHANNEL, DMA_TCIF);
+  dma_clear_interrupt_flags(DMA1, SPI_DMA_RX_CHANNEL, DMA_TCIF);
+}
+
+// Opens a burst transaction: NSS stays low until spi_burst_end()
+void spi_write_start(uint8_t reg){
+  select_chip();
+  transfer_byte(reg | 0x80);
+}
+void spi_read_start(uint8_t reg){
+  select_chip();
+  transfer_byte(reg & 0x7F);
+}
+void spi_burst_write(uint8_t sz, const uint8_t *data){
+  if(sz >= SPI_DMA_MIN){
+    transfer_dma(data, 0, sz);
+    return;
+  }
+  for(int i = sz; i; --i) transfer_byte(data[sz - i]);
+}
+void spi_burst_read(uint8_t sz, uint8_t *data){
+  if(sz >= SPI_DMA_MIN){
+    transfer_dma(0, data, sz);
+    return;
+  }
+  for(int i = sz; i; --i) data[sz - i] = transfer_byte(0x00);
+}
+void spi_burst_end(){
+  wait_idle();
+  unselect_chip();
+}
+
+void spi_write8(uint8_t reg, uint8_t data){
+  select_chip();
+  transfer_byte(reg | 0x80);
+  transfer_byte(data);
+  wait_idle();
+  unselect_chip();
+}
+uint8_t spi_read8(uint8_t reg){
+  select_chip();
+  transfer_byte(reg & 0x7F);
+  uint8_t res = transfer_byte(0x00);
+  wait_idle();
+  unselect_chip();
+  return res;
+}
+
+#endif
@@ -11,6 +11,9 @@ void init_all(){
   init_systick();
   // init_mco();        // NOTE: test done, works as expected (48MHz)
   init_timer();         // NOTE: first test done, counts with 1sec interval correctly
+#if LORA_TYPE == 1 && LORA_USE_DIO_IRQ
+  init_exti();
+#endif
 
 	#if DEBUG_MODE
 		send_debug("Init ALL Done!");
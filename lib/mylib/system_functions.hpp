@@ -17,6 +17,24 @@ inline uint32_t millis(){
   return millis_cnt;
 }
 
+#ifdef HOST_TEST
+// native tests: the fake MCU of test/host runs the radio model while it sleeps
+void disable_interrupts();
+void enable_interrupts();
+void wait_for_interrupt();
+#else
+inline void disable_interrupts(){
+  asm volatile("cpsid i" : : : "memory");
+}
+inline void enable_interrupts(){
+  asm volatile("cpsie i" : : : "memory");
+}
+// sleeps until the next interrupt (systick wakes it up at least every tick)
+inline void wait_for_interrupt(){
+  asm volatile("wfi" : : : "memory");
+}
+#endif
+
 // b[n], b[n-1], .. , b[0] // NOTE: Little Endian /// low to high
 template<typename T>
 T get_data(uint8_t *data_arr){
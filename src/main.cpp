@@ -1,6 +1,7 @@
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/exti.h>
 
 #include "version.hpp"
 #include "init.hpp"
@@ -10,6 +11,7 @@
 #include "spi.hpp"
 #include "definitions.hpp"
 #include "led.hpp"
+#include "compress.hpp"
 #if LORA_TYPE == 1
 	#include "lora_arduino.hpp"
 #elif LORA_TYPE == 2
@@ -24,7 +26,7 @@ void sys_tick_handler(void)
 
 const uint16_t data_sz = 105;
 uint8_t data_to_send[data_sz];
-uint16_t data_idx = 4;
+uint16_t data_idx = 0;
 bool uart_msg_ready = false;
 void usart1_isr(){
 	if (USART_ISR(DEBUG_USART) & USART_ISR_RXNE){ // DEBUG USART RECEIVE INTERRUPT
@@ -44,13 +46,55 @@ void usart1_isr(){
 	}
 }
 
+#if LORA_TYPE == 1 && LORA_USE_DIO_IRQ
+void exti0_1_isr(){
+	if(exti_get_flag_status(LORA_DIO0_EXTI)){
+		exti_reset_request(LORA_DIO0_EXTI);
+		sx1278.dioInterrupt(0);
+	}
+	if(exti_get_flag_status(LORA_DIO1_EXTI)){
+		exti_reset_request(LORA_DIO1_EXTI);
+		sx1278.dioInterrupt(1);
+	}
+}
+#endif
+
 void hard_fault_handler(void){
 	fatal_error_handler_with_string("hard fault\r\n");
 }
 
 #if LORA_TYPE == 1
 	int e;
-	char my_packet[100];
+	uint8_t my_packet[data_sz + 5]; // received payload, read here by the driver
+	uint8_t msg_hdr[5];             // message number, sent in front of data_to_send
+	lora_iovec tx_iov[2] = {{msg_hdr, 4}, {data_to_send, 0}};
+#if TEXT_COMPRESSION || COMPRESS_BENCHMARK
+	uint8_t text_buf[data_sz];      // text coded before sending, or decoded after receiving
+#endif
+
+#if LORA_COMPACT_HEADER
+// message number as a varint: 7 bits per byte, low bits first, bit 7 set
+// when another byte follows. Returns the bytes used
+uint8_t put_varint(uint8_t *buf, uint32_t val){
+	uint8_t n = 0;
+	while(val >= 0x80){
+		buf[n++] = (val & 0x7F) | 0x80;
+		val >>= 7;
+	}
+	buf[n++] = val;
+	return n;
+}
+
+// 0 if the varint does not end within sz bytes
+uint8_t get_varint(const uint8_t *buf, uint8_t sz, uint32_t *val){
+	*val = 0;
+	for(uint8_t n = 0; n < sz && n < 5; n++){
+		*val |= (uint32_t)(buf[n] & 0x7F) << (7 * n);
+		if(!(buf[n] & 0x80)) return n + 1;
+	}
+	return 0;
+}
+#endif
 #endif
 
 int main(){
@@ -102,6 +146,9 @@ int main(){
     Serial.println("Setting Power: ERROR ");
   }
 
+  // Payload of received packets goes straight to my_packet
+  sx1278.setRxBuffer(my_packet, sizeof(my_packet));
+
   // Set the node address and print the result
   if (sx1278.setNodeAddress(LORA_ADDRESS) == 0) {
     Serial.println("Setting node address: SUCCESS ");
@@ -111,6 +158,77 @@ int main(){
 
   // Print a success message
   Serial.println("sx1278 configured finished");
+#if SX1278_REG_CACHE
+  Serial.print("SPI reads saved by register shadow: ");
+  Serial.println(sx1278._savedTransactions, DEC);
+#endif
+  // airtime of a 12-character message with this build's header
+  Serial.print("Frame header (bytes): ");
+  Serial.println(OFFSET_PAYLOADLENGTH, DEC);
+  Serial.print("Airtime of a 12-char message (us): ");
+  Serial.println(sx1278.timeOnAirUs(12 + (LORA_COMPACT_HEADER ? 1 : 4)), DEC);
+#if COMPRESS_BENCHMARK
+  {
+    // typical chat lines; ratio in percent and time per message
+    static const char *const corpus[] = {
+      "hello, are you there?", "the battery is at 80 percent", "ok",
+      "meeting at the station in ten minutes", "lora test message number one",
+      "I sent the data, did you get it?", "going home now. see you tomorrow!",
+      "temperature is 23.5 C and rising"};
+    const uint8_t count = sizeof(corpus) / sizeof(corpus[0]);
+    uint8_t packed[data_sz];
+    uint8_t len[count];
+    uint32_t raw = 0, coded = 0;
+    for(uint8_t i = 0; i < count; i++){
+      for(len[i] = 0; corpus[i][len[i]]; len[i]++);
+      uint8_t n = text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+      raw += len[i];
+      coded += n ? n : len[i];
+    }
+    uint32_t t0 = millis();
+    for(uint16_t r = 0; r < 100; r++)
+      for(uint8_t i = 0; i < count; i++)
+        text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+    uint32_t t1 = millis();
+    for(uint16_t r = 0; r < 100; r++)
+      for(uint8_t i = 0; i < count; i++){
+        uint8_t n = text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+        text_decompress(packed, n, text_buf, sizeof(text_buf));
+      }
+    uint32_t t2 = millis();
+    Serial.print("Text compression, coded/raw (%): ");
+    Serial.println(coded * 100 / raw, DEC);
+    Serial.print("Text compression, encode (us/message): ");
+    Serial.println((t1 - t0) * 10 / count, DEC);
+    Serial.print("Text compression, decode (us/message): ");
+    Serial.println(((t2 - t1) - (t1 - t0)) * 10 / count, DEC);
+  }
+#endif
+#if SPI_BENCHMARK
+  {
+    // raw bus timings, the register shadow is bypassed
+    uint8_t buf[64];
+    uint32_t t0 = millis();
+    for(uint16_t i = 0; i < 1000; i++) spi_read8(REG_VERSION);
+    uint32_t t1 = millis();
+    for(uint16_t i = 0; i < 100; i++) spi_read(REG_FIFO, sizeof(buf), buf);
+    uint32_t t2 = millis();
+    Serial.print("SPI backend " TOSTRING(SPI_BACKEND) ", 1000 register reads (millis): ");
+    Serial.println(t1 - t0, DEC);
+    Serial.print("SPI backend " TOSTRING(SPI_BACKEND) ", 100 FIFO bursts of 64 bytes (millis): ");
+    Serial.println(t2 - t1, DEC);
+    // core cycles of a single transaction, from the systick counter (AHB clock, counts down)
+    uint32_t c0 = STK_CVR;
+    spi_read8(REG_VERSION);
+    uint32_t c1 = STK_CVR;
+    spi_read(REG_FIFO, sizeof(buf), buf);
+    uint32_t c2 = STK_CVR;
+    Serial.print("SPI backend " TOSTRING(SPI_BACKEND) ", register read (cycles): ");
+    Serial.println((c0 >= c1) ? c0 - c1 : c0 + STK_RVR + 1 - c1, DEC);
+    Serial.print("SPI backend " TOSTRING(SPI_BACKEND) ", FIFO burst of 64 bytes (cycles): ");
+    Serial.println((c1 >= c2) ? c1 - c2 : c1 + STK_RVR + 1 - c2, DEC);
+  }
+#endif
   Serial.println();
 	clearLED();
 
@@ -118,80 +236,220 @@ int main(){
   Serial.println("sx1278 module and STM32F042: send data received from serial with ack! also receive messages");
 
 	uint32_t msg_num = 0;
+	lora_async *op = 0; // send/receive in progress, UART keeps filling data_to_send meanwhile
+	uint32_t send_at = 0; // millis() from which the message ready may be sent (again)
 	sx1278.receive();
+#if LORA_LOW_POWER_RX
+	sx1278.startListening();
+#endif
 	while(true){ // TODO: there may be write while reading error!!
-		if(uart_msg_ready){
-			data_to_send[0] = msg_num & 0xFF;
-			data_to_send[1] = (msg_num >> 8) & 0xFF;
-			data_to_send[2] = (msg_num >> 16) & 0xFF;
-			data_to_send[3] = (msg_num >> 24) & 0xFF;
-			data_to_send[data_idx] = '\0';
-			Serial.println("");
-			Serial.println("starting to send!");
+#if LORA_ADR
+		if(op == 0 && sx1278.adrFallback()){
+			Serial.println("ADR: nothing heard, back to mode " TOSTRING(LORA_MODE));
+		}
+#endif
+		if(op != 0){
+			if(sx1278.poll()){
+#if LORA_USE_DIO_IRQ
+				// nothing to do until DIO, UART or systick interrupt
+				disable_interrupts();
+				if(sx1278._irqPending == 0) wait_for_interrupt();
+				enable_interrupts();
+#endif
+				continue;
+			}
 
-			// Send message1 and print the result
-			setLED();
-			e = -1;
-			while (e != 0){
-				if(e != -1){
+			if(op->op == ASYNC_SEND){
+				e = op->result;
+#if LORA_DUTY_CYCLE
+				Serial.print("Airtime used (ms): ");
+				Serial.print(sx1278._airtime.totalMs, DEC);
+				Serial.print(", left in window (ms): ");
+				Serial.print(sx1278.airtimeLeft(), DEC);
+				Serial.print(", next send in (ms): ");
+				Serial.println(sx1278.nextTxTime(data_sz), DEC);
+#endif
+#if LORA_CSMA
+				Serial.print("CSMA: CADs ");
+				Serial.print(sx1278._csma.cads);
+				Serial.print(", busy ");
+				Serial.print(sx1278._csma.busy);
+				Serial.print(", given up ");
+				Serial.print(sx1278._csma.dropped);
+				Serial.print(", not acknowledged ");
+				Serial.print(sx1278._csma.collisions);
+				Serial.print(", backoff (ms) ");
+				Serial.println(sx1278._csma.backoffMs, DEC);
+#endif
+				if(e != 0){
 				  Serial.print("Packet1 sent with error, state ");
 				  Serial.println(e, DEC);
+					// sent again from the UART branch, listening meanwhile
+					send_at = millis();
+#if LORA_CSMA
+					if(e == 10) send_at += sx1278.backoffTime(); // channel stayed busy
+#endif
+#if LORA_DUTY_CYCLE
+					if(e == 11){ // out of airtime
+						uint32_t wait = sx1278.nextTxTime(tx_iov[0].length + tx_iov[1].length);
+						if(wait == 0xFFFFFFFF){
+							Serial.println("Message longer than the airtime budget, dropped");
+							clearLED();
+							data_idx = 0;
+							uart_msg_ready = false;
+						}
+						else send_at += wait;
+					}
+#endif
+					op = 0;
+#if LORA_LOW_POWER_RX
+					sx1278.startListening();
+#else
+					sx1278.rearm();
+#endif
+					continue;
 				}
-		  	e = sx1278.sendPacketMAXTimeoutACK(LORA_SEND_TO_ADDRESS, data_to_send, data_idx + 1);
-			}
-			clearLED();
-		  Serial.print("Packet1 sent, state ");
-		  Serial.println(e, DEC);
-
-		  if (e == 0)
+				clearLED();
+			  Serial.print("Packet1 sent, state ");
+			  Serial.println(e, DEC);
 		  	Serial.println("Successful!!");
+#if LORA_POWER_CONTROL
+				// power kept towards each peer and the SNR it last reported
+				for(uint8_t i = 0; i < LORA_TPC_PEERS; i++){
+					lora_peer *peer = &sx1278._peers[i];
+					if(peer->address == BROADCAST_0) continue;
+					Serial.print("Peer ");
+					Serial.print(peer->address);
+					Serial.print(": power (dBm) ");
+					Serial.print(peer->power);
+					Serial.print(", SNR (dB) ");
+					Serial.print(peer->snr);
+					Serial.print(", ACKs ");
+					Serial.println(peer->acks);
+				}
+#endif
 
-			msg_num++;
-			data_idx = 4;
-			uart_msg_ready = false;
-			sx1278.receive();
-		}
-		else if(sx1278.readRegister(REG_IRQ_FLAGS) != 0){
-			Serial.println("starting to recv!");
-		  // Receive message for 10 seconds
-		  e = sx1278.receivePacketTimeoutACK(10000, false);
-		  if (e == 0) {
-		    Serial.println("Package received!");
+				msg_num++;
+				data_idx = 0;
+				uart_msg_ready = false;
+			}
+			else{
+				e = op->result;
+			  if (e == 0) {
+			    Serial.println("Package received!");
 
-				if(sx1278.packet_received.length < 4){
-					Serial.println("Message size is too small!!");
-					continue;
-				}
+#if LORA_COMPACT_HEADER
+					uint32_t msg_num;
+					uint8_t hdr = get_varint(my_packet, sx1278._payloadlength, &msg_num);
+#else
+					uint32_t msg_num = 0;
+					uint8_t hdr = 4;
+#endif
+					if(hdr == 0 || sx1278._payloadlength < hdr){
+						Serial.println("Message size is too small!!");
+					}
+					else{
+#if !LORA_COMPACT_HEADER
+						msg_num = my_packet[0];
+						msg_num |= (my_packet[1] << 8);
+						msg_num |= (my_packet[2] << 16);
+						msg_num |= ((uint32_t)my_packet[3] << 24);
+#endif
+						my_packet[sizeof(my_packet) - 1] = '\0';
+						char *text = (char *)&my_packet[hdr];
+#if TEXT_COMPRESSION
+						if(sx1278.packet_received.retry & PAYLOAD_COMPRESSED){
+							uint8_t n = text_decompress(&my_packet[hdr], sx1278._payloadlength - hdr, text_buf, sizeof(text_buf) - 1);
+							text_buf[n] = '\0';
+							text = (char *)text_buf;
+						}
+#endif
 
-				int msg_num = sx1278.packet_received.data[0];
-				msg_num |= (sx1278.packet_received.data[1] << 8);
-				msg_num |= (sx1278.packet_received.data[2] << 16);
-				msg_num |= (sx1278.packet_received.data[3] << 24);
-		    for (unsigned int i = 4; i < sx1278.packet_received.length; i++)
-		      my_packet[i - 4] = (char)sx1278.packet_received.data[i];
+				    Serial.print("Message No, ");
+						Serial.print(msg_num, DEC);
+						Serial.print(": ");
+				    Serial.println(text);
 
-		    Serial.print("Message No, ");
-				Serial.print(msg_num);
-				Serial.print(": ");
-		    Serial.println(my_packet);
+						setLED();
+						wait_with_timer2(1000);
+						clearLED();
+					}
+			  } else if (e == 5) {
+			    Serial.println("Package received again, already delivered");
+			  } else {
+			    Serial.print("Package received ERROR: ");
+					Serial.println(e, DEC);
 
-				setLED();
-				wait_with_timer2(1000);
-				clearLED();
-		  } else {
-		    Serial.print("Package received ERROR: ");
-				Serial.println(e, DEC);
+					setLED();
+					wait_with_timer2(400);
+					clearLED();
+					wait_with_timer2(200);
+					setLED();
+					wait_with_timer2(400);
+					clearLED();
+			  }
+			}
+#if LORA_ADR
+			Serial.print("ADR mode: ");
+			Serial.println(sx1278._adr.mode, DEC);
+#endif
+			op = 0;
+#if LORA_LOW_POWER_RX
+			sx1278.startListening();
+#else
+			sx1278.rearm();
+#endif
+		}
+		else if(uart_msg_ready && (int32_t)(millis() - send_at) >= 0){
+#if LORA_COMPACT_HEADER
+			tx_iov[0].length = put_varint(msg_hdr, msg_num);
+#else
+			msg_hdr[0] = msg_num & 0xFF;
+			msg_hdr[1] = (msg_num >> 8) & 0xFF;
+			msg_hdr[2] = (msg_num >> 16) & 0xFF;
+			msg_hdr[3] = (msg_num >> 24) & 0xFF;
+#endif
+			data_to_send[data_idx] = '\0';
+			tx_iov[1].data = data_to_send;
+			tx_iov[1].length = data_idx + 1;
+#if TEXT_COMPRESSION
+			{
+				// raw when coding does not make it shorter, the flag tells the receiver
+				uint8_t n = text_compress(data_to_send, data_idx + 1, text_buf, sizeof(text_buf));
+				if(n != 0){
+					tx_iov[1].data = text_buf;
+					tx_iov[1].length = n;
+				}
+				sx1278.setPayloadFlags(n ? PAYLOAD_COMPRESSED : 0);
+			}
+#endif
+			Serial.println("");
+			Serial.println("starting to send!");
 
-				setLED();
-				wait_with_timer2(400);
-				clearLED();
-				wait_with_timer2(200);
-				setLED();
-				wait_with_timer2(400);
-				clearLED();
-		  }
-			sx1278.receive();
+			// Send message1, the result is handled when the operation completes
+			setLED();
+			// message number and text go straight from their buffers to the FIFO
+			op = sx1278.sendPacketAsync(LORA_SEND_TO_ADDRESS, tx_iov, 2, MAX_TIMEOUT, false);
+		}
+#if LORA_LOW_POWER_RX
+		else if(sx1278.lowPowerListen()){
+#elif LORA_USE_DIO_IRQ
+		else if(sx1278._irqPending != 0 || rx_queue_count() != 0){
+#else
+		else if(sx1278.readRegister(REG_IRQ_FLAGS) != 0 || rx_queue_count() != 0){
+#endif
+			Serial.println("starting to recv!");
+		  // Receive message for 10 seconds
+		  op = sx1278.receivePacketAsync(10000, false);
 		}
+#if LORA_USE_DIO_IRQ
+		else{
+			// nothing to do until UART, DIO or systick interrupt
+			disable_interrupts();
+			if(sx1278._irqPending == 0) wait_for_interrupt(); // a message put off waits for systick
+			enable_interrupts();
+		}
+#endif
 	}
 #elif LORA_TYPE == 2
 	init_lora();
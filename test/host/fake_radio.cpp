@@ -0,0 +1,706 @@
+#include "fake_radio.hpp"
+
+#include <math.h>
+#include <vector>
+
+#include "lora_arduino.hpp"
+#include "system_functions.hpp"
+#include "timer.hpp"
+#include "uart.hpp"
+
+// RegIrqFlags bits
+static const uint8_t FLAG_RX_TIMEOUT = 0x80;
+static const uint8_t FLAG_RX_DONE = 0x40;
+static const uint8_t FLAG_CRC_ERROR = 0x20;
+static const uint8_t FLAG_VALID_HEADER = 0x10;
+static const uint8_t FLAG_TX_DONE = 0x08;
+static const uint8_t FLAG_CAD_DONE = 0x04;
+static const uint8_t FLAG_FHSS_CHANGE = 0x02;
+static const uint8_t FLAG_CAD_DETECTED = 0x01;
+
+// Bandwidths of RegModemConfig1, in Hz
+static const double bandwidth_hz[10] = {
+  7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+};
+
+// Symbols of the preamble the receiver needs to detect it and lock
+static const double LOCK_SYMBOLS = 5.0;
+// Symbols of the explicit header, after the preamble and the sync word
+static const double HEADER_SYMBOLS = 8.0;
+
+fake_spi_counters fake_spi;
+fake_cpu_counters fake_cpu;
+uint64_t fake_mode_ns[8];
+uint32_t fake_frames_lost;
+uint32_t fake_dio_edges[2];
+
+volatile uint32_t millis_cnt = 0;
+uint32_t fake_tim_cr1[2];
+_Serial Serial;
+
+// A frame of the test on its way to the radio
+struct air_frame{
+  fake_frame frame;
+  uint64_t header_ns; // explicit header decoded, or payload start
+  bool header_done;
+  bool locked;
+  uint32_t session;   // Rx session that locked on it
+};
+
+// One radio and the frames on their way to it
+struct radio_state{
+  bool active;        // receives the frames of the other radios
+  uint8_t regs[0x80];
+  uint8_t fifo[256];
+  fake_mode mode;
+  uint64_t mode_since_ns;
+  uint32_t rx_session;
+  uint16_t rx_preamble;   // programmed when the Rx started
+  uint8_t rx_write;
+  uint64_t rx_timeout_ns;
+  fake_frame tx_frame;
+  uint64_t cad_end_ns;
+  std::vector<air_frame> air;
+  bool dio_pending[2];
+  void (*dio_handler)(uint8_t);
+  void (*tx_handler)(const fake_frame &);
+};
+
+static radio_state radios[FAKE_RADIOS];
+static radio_state *r = &radios[0];  // selected, or the one an event is for
+static bool (*link_handler)(uint8_t from, uint8_t to, fake_frame &frame);
+static uint64_t now_ns;
+// 8 bits of about 13 cycles at 48 MHz, see spi.cpp
+static uint32_t spi_byte_ns = 2170;
+
+static bool irq_masked;
+
+// SPI slave
+static bool selected;
+static uint8_t spi_count;
+static uint8_t spi_address;
+static bool spi_writing;
+
+// GPIO front end
+static uint32_t odr[4];
+static uint8_t sck_bits;
+static uint8_t sck_in;
+static uint8_t sck_out;
+static bool miso;
+
+static void advance_to(uint64_t t);
+static void put_on_air(radio_state &to, const fake_frame &frame);
+
+/******************************************************************************
+ * Modulation and time-on-air
+ ******************************************************************************/
+
+fake_modulation fake_radio_modulation(){
+  fake_modulation mod;
+
+  mod.bw = r->regs[REG_MODEM_CONFIG1] >> 4;
+  mod.cr = (r->regs[REG_MODEM_CONFIG1] >> 1) & 0x07;
+  mod.implicit_header = r->regs[REG_MODEM_CONFIG1] & 0x01;
+  mod.sf = r->regs[REG_MODEM_CONFIG2] >> 4;
+  mod.crc = (r->regs[REG_MODEM_CONFIG2] >> 2) & 0x01;
+  mod.ldro = (r->regs[REG_MODEM_CONFIG3] >> 3) & 0x01;
+  mod.preamble = ((uint16_t)r->regs[REG_PREAMBLE_MSB_LORA] << 8) | r->regs[REG_PREAMBLE_LSB_LORA];
+  return mod;
+}
+
+double fake_symbol_us(const fake_modulation &mod){
+  return (double)(1UL << mod.sf) * 1e6 / bandwidth_hz[mod.bw];
+}
+
+double fake_time_on_air_us(const fake_modulation &mod, uint16_t length){
+  double t_sym = fake_symbol_us(mod);
+  double t_preamble = (mod.preamble + 4.25) * t_sym;
+  double num = 8.0 * length - 4.0 * mod.sf + 28 + 16 * mod.crc - 20 * mod.implicit_header;
+  double den = 4.0 * (mod.sf - 2 * mod.ldro);
+  double n_payload = 8 + fmax(ceil(num / den) * (mod.cr + 4), 0);
+
+  return t_preamble + n_payload * t_sym;
+}
+
+static bool same_channel(const fake_modulation &a, const fake_modulation &b){
+  return (a.sf == b.sf) && (a.bw == b.bw) && (a.implicit_header == b.implicit_header)
+    && (!a.implicit_header || ((a.cr == b.cr) && (a.crc == b.crc)));
+}
+
+/******************************************************************************
+ * Radio
+ ******************************************************************************/
+
+// Sets IRQ flags not masked, a DIO line mapped to a flag that rises has an edge
+static void raise_irq(uint8_t flags){
+  static const uint8_t dio0_flags[4] = { FLAG_RX_DONE, FLAG_TX_DONE, FLAG_CAD_DONE, 0 };
+  static const uint8_t dio1_flags[4] = { FLAG_RX_TIMEOUT, FLAG_FHSS_CHANGE, FLAG_CAD_DETECTED, 0 };
+  uint8_t rising = flags & ~r->regs[REG_IRQ_FLAGS_MASK] & ~r->regs[REG_IRQ_FLAGS];
+
+  r->regs[REG_IRQ_FLAGS] |= rising;
+  for(uint8_t dio = 0; dio < 2; dio++){
+    uint8_t map = (r->regs[REG_DIO_MAPPING1] >> (6 - 2 * dio)) & 0x03;
+    if(rising & (dio ? dio1_flags[map] : dio0_flags[map])){
+      if(r == &radios[0]){
+        fake_dio_edges[dio]++;
+      }
+      r->dio_pending[dio] = true;
+    }
+  }
+  if(!irq_masked){
+    enable_interrupts();
+  }
+}
+
+static void set_mode(fake_mode next){
+  bool was_rx = (r->mode == FAKE_RXCONT) || (r->mode == FAKE_RXSINGLE);
+  bool is_rx = (next == FAKE_RXCONT) || (next == FAKE_RXSINGLE);
+
+  r->regs[REG_OP_MODE] = (r->regs[REG_OP_MODE] & 0xF8) | next;
+  if(next == r->mode){
+    return;
+  }
+  r->mode = next;
+  r->mode_since_ns = now_ns;
+
+  if(is_rx && !was_rx){
+    // Back in Rx the module writes from the RX base again
+    r->rx_session++;
+    r->rx_write = r->regs[REG_FIFO_RX_BASE_ADDR];
+    r->rx_preamble = fake_radio_modulation().preamble;
+    r->rx_timeout_ns = 0;
+    if(next == FAKE_RXSINGLE){
+      uint16_t symbols = ((r->regs[REG_MODEM_CONFIG2] & 0x03) << 8) | r->regs[REG_SYMB_TIMEOUT_LSB];
+      r->rx_timeout_ns = now_ns + (uint64_t)(symbols * fake_symbol_us(fake_radio_modulation()) * 1000);
+    }
+  }
+  if(!is_rx){
+    r->rx_session++;   // a frame being received is lost
+  }
+
+  switch(next){
+    case FAKE_SLEEP:
+      // The FIFO is not kept in sleep mode
+      for(uint16_t i = 0; i < 256; i++) r->fifo[i] = 0;
+      break;
+
+    case FAKE_TX:
+      r->tx_frame.mod = fake_radio_modulation();
+      r->tx_frame.length = r->regs[REG_PAYLOAD_LENGTH_LORA];
+      for(uint16_t i = 0; i < r->tx_frame.length; i++)
+        r->tx_frame.data[i] = r->fifo[(uint8_t)(r->regs[REG_FIFO_TX_BASE_ADDR] + i)];
+      r->tx_frame.rssi = 0;
+      r->tx_frame.snr = 0;
+      r->tx_frame.crc_error = false;
+      r->tx_frame.start_ns = now_ns;
+      r->tx_frame.end_ns = now_ns + (uint64_t)(fake_time_on_air_us(r->tx_frame.mod, r->tx_frame.length) * 1000);
+      for(uint8_t i = 0; i < FAKE_RADIOS; i++){
+        fake_frame frame = r->tx_frame;
+        if((&radios[i] != r) && radios[i].active
+           && (!link_handler || link_handler((uint8_t)(r - radios), i, frame))){
+          put_on_air(radios[i], frame);
+        }
+      }
+      break;
+
+    case FAKE_CAD:
+      // One symbol listened to, one processed
+      r->cad_end_ns = now_ns + (uint64_t)(2 * fake_symbol_us(fake_radio_modulation()) * 1000);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void write_op_mode(uint8_t value){
+  r->regs[REG_OP_MODE] = value;
+  set_mode((fake_mode)(value & 0x07));
+}
+
+static uint8_t reg_read(uint8_t address){
+  if(address == REG_FIFO){
+    return r->fifo[r->regs[REG_FIFO_ADDR_PTR]++];
+  }
+  return r->regs[address];
+}
+
+static void reg_write(uint8_t address, uint8_t value){
+  switch(address){
+    case REG_FIFO:
+      r->fifo[r->regs[REG_FIFO_ADDR_PTR]++] = value;
+      break;
+    case REG_OP_MODE:
+      write_op_mode(value);
+      break;
+    case REG_IRQ_FLAGS:
+      r->regs[REG_IRQ_FLAGS] &= ~value;
+      break;
+    // read only
+    case REG_FIFO_RX_CURRENT_ADDR:
+    case REG_RX_NB_BYTES:
+    case REG_MODEM_STAT:
+    case REG_PKT_SNR_VALUE:
+    case REG_PKT_RSSI_VALUE:
+    case REG_RSSI_VALUE_LORA:
+    case REG_FIFO_RX_BYTE_ADDR:
+    case REG_VERSION:
+      break;
+    default:
+      r->regs[address] = value;
+      break;
+  }
+}
+
+// Decides at the end of its explicit header if the radio follows a frame: it
+// must have been in Rx on the same channel from LOCK_SYMBOLS before the end
+// of the preamble, expecting a preamble at least as long as what it heard.
+static void frame_header(air_frame &f){
+  fake_modulation mod = fake_radio_modulation();
+  double t_sym_ns = fake_symbol_us(f.frame.mod) * 1000;
+  double preamble_end = f.frame.start_ns + (f.frame.mod.preamble + 4.25) * t_sym_ns;
+  uint64_t heard_from = (r->mode_since_ns > f.frame.start_ns) ? r->mode_since_ns : f.frame.start_ns;
+  double heard = (preamble_end - heard_from) / t_sym_ns;
+  bool busy = false;
+
+  f.header_done = true;
+  for(size_t i = 0; i < r->air.size(); i++){
+    if((&r->air[i] != &f) && r->air[i].locked && (r->air[i].session == r->rx_session)){
+      busy = true;
+    }
+  }
+  if(((r->mode != FAKE_RXCONT) && (r->mode != FAKE_RXSINGLE)) || busy || !same_channel(mod, f.frame.mod)
+     || (heard < LOCK_SYMBOLS) || (heard > r->rx_preamble + 4.25 + LOCK_SYMBOLS)
+     || (mod.implicit_header && (r->regs[REG_PAYLOAD_LENGTH_LORA] != f.frame.length))){
+    return;
+  }
+  f.locked = true;
+  f.session = r->rx_session;
+  r->rx_timeout_ns = 0;
+  if(!mod.implicit_header){
+    raise_irq(FLAG_VALID_HEADER);
+  }
+}
+
+static void frame_end(air_frame &f){
+  uint8_t start = r->rx_write;
+
+  if(!f.locked || (f.session != r->rx_session)){
+    if(r == &radios[0]){
+      fake_frames_lost++;
+    }
+    return;
+  }
+  for(uint16_t i = 0; i < f.frame.length; i++){
+    r->fifo[r->rx_write++] = f.frame.data[i];
+  }
+  r->regs[REG_FIFO_RX_CURRENT_ADDR] = start;
+  r->regs[REG_RX_NB_BYTES] = (uint8_t)f.frame.length;
+  r->regs[REG_FIFO_RX_BYTE_ADDR] = (uint8_t)(r->rx_write - 1);
+  r->regs[REG_PKT_SNR_VALUE] = (uint8_t)(int8_t)(f.frame.snr * 4);
+  r->regs[REG_PKT_RSSI_VALUE] = (uint8_t)(f.frame.rssi + OFFSET_RSSI);
+  raise_irq(FLAG_RX_DONE | (f.frame.crc_error ? FLAG_CRC_ERROR : 0));
+  if(r->mode == FAKE_RXSINGLE){
+    set_mode(FAKE_STANDBY);
+  }
+}
+
+// Earliest event of a radio after now, 0 if none
+static uint64_t next_event(const radio_state &radio){
+  uint64_t next = 0;
+
+  #define EARLIEST(t) if((t) != 0 && (next == 0 || (t) < next)) next = (t)
+  if(radio.mode == FAKE_TX) EARLIEST(radio.tx_frame.end_ns);
+  if(radio.mode == FAKE_CAD) EARLIEST(radio.cad_end_ns);
+  if(radio.mode == FAKE_RXSINGLE) EARLIEST(radio.rx_timeout_ns);
+  for(size_t i = 0; i < radio.air.size(); i++){
+    EARLIEST(radio.air[i].header_done ? radio.air[i].frame.end_ns : radio.air[i].header_ns);
+  }
+  #undef EARLIEST
+  return next;
+}
+
+// Earliest event of all the radios, 0 if none. 'radio' gets the one it is for
+static uint64_t next_event(radio_state **radio = 0){
+  uint64_t next = 0;
+
+  for(uint8_t i = 0; i < FAKE_RADIOS; i++){
+    uint64_t e = next_event(radios[i]);
+    if((e != 0) && ((next == 0) || (e < next))){
+      next = e;
+      if(radio){
+        *radio = &radios[i];
+      }
+    }
+  }
+  return next;
+}
+
+// Handles the event of the radio 'r' due at 'e'
+static void radio_event(uint64_t e){
+  if((r->mode == FAKE_TX) && (r->tx_frame.end_ns == e)){
+    set_mode(FAKE_STANDBY);
+    raise_irq(FLAG_TX_DONE);
+    if(r->tx_handler){
+      r->tx_handler(r->tx_frame);
+    }
+    return;
+  }
+  if((r->mode == FAKE_CAD) && (r->cad_end_ns == e)){
+    fake_modulation mod = fake_radio_modulation();
+    bool detected = false;
+    for(size_t i = 0; i < r->air.size(); i++){
+      const fake_frame &f = r->air[i].frame;
+      double preamble_end = f.start_ns + f.mod.preamble * fake_symbol_us(f.mod) * 1000;
+      if(same_channel(mod, f.mod) && (f.start_ns < r->cad_end_ns) && (preamble_end > r->mode_since_ns)){
+        detected = true;
+      }
+    }
+    set_mode(FAKE_STANDBY);
+    raise_irq(FLAG_CAD_DONE | (detected ? FLAG_CAD_DETECTED : 0));
+    return;
+  }
+  if((r->mode == FAKE_RXSINGLE) && (r->rx_timeout_ns == e)){
+    set_mode(FAKE_STANDBY);
+    raise_irq(FLAG_RX_TIMEOUT);
+    return;
+  }
+  for(size_t i = 0; i < r->air.size(); i++){
+    if(!r->air[i].header_done && (r->air[i].header_ns == e)){
+      frame_header(r->air[i]);
+      break;
+    }
+    if(r->air[i].header_done && (r->air[i].frame.end_ns == e)){
+      air_frame f = r->air[i];
+      r->air.erase(r->air.begin() + i);
+      frame_end(f);
+      break;
+    }
+  }
+}
+
+static void advance_to(uint64_t t){
+  for(;;){
+    radio_state *at = 0;
+    uint64_t e = next_event(&at);
+    uint64_t step = ((e != 0) && (e <= t)) ? e : t;
+
+    if(step > now_ns){
+      fake_mode_ns[radios[0].mode] += step - now_ns;
+      now_ns = step;
+      millis_cnt = (uint32_t)(now_ns / 1000000);
+    }
+    if((e == 0) || (e > t)){
+      return;
+    }
+
+    radio_state *current = r;
+    r = at;
+    radio_event(e);
+    r = current;
+  }
+}
+
+/******************************************************************************
+ * Test interface
+ ******************************************************************************/
+
+void fake_reset(){
+  for(uint8_t n = 0; n < FAKE_RADIOS; n++){
+    radio_state &radio = radios[n];
+
+    for(uint8_t i = 0; i < 0x80; i++) radio.regs[i] = 0;
+    for(uint16_t i = 0; i < 256; i++) radio.fifo[i] = 0;
+    // Reset values of the datasheet (LoRa page where they differ)
+    radio.regs[REG_OP_MODE] = 0x09;
+    radio.regs[REG_FRF_MSB] = 0x6C;
+    radio.regs[REG_FRF_MID] = 0x80;
+    radio.regs[REG_PA_CONFIG] = 0x4F;
+    radio.regs[REG_PA_RAMP] = 0x09;
+    radio.regs[REG_OCP] = 0x2B;
+    radio.regs[REG_LNA] = 0x20;
+    radio.regs[REG_FIFO_TX_BASE_ADDR] = 0x80;
+    radio.regs[REG_MODEM_CONFIG1] = 0x72;
+    radio.regs[REG_MODEM_CONFIG2] = 0x70;
+    radio.regs[REG_SYMB_TIMEOUT_LSB] = 0x64;
+    radio.regs[REG_PREAMBLE_LSB_LORA] = 0x08;
+    radio.regs[REG_PAYLOAD_LENGTH_LORA] = 0x01;
+    radio.regs[REG_MAX_PAYLOAD_LENGTH] = 0xFF;
+    radio.regs[REG_MODEM_CONFIG3] = 0x04;
+    radio.regs[REG_SYNC_WORD] = 0x12;
+    radio.regs[REG_VERSION] = 0x12;
+
+    radio.active = (n == 0);
+    radio.mode = FAKE_STANDBY;
+    radio.mode_since_ns = 0;
+    radio.rx_session = 0;
+    radio.rx_write = 0;
+    radio.air.clear();
+    radio.dio_pending[0] = radio.dio_pending[1] = false;
+  }
+  r = &radios[0];
+
+  now_ns = 0;
+  millis_cnt = 0;
+  irq_masked = false;
+  selected = false;
+  for(uint8_t i = 0; i < 4; i++) odr[i] = 0;
+  sck_bits = 0;
+  miso = false;
+  for(uint8_t i = 0; i < 8; i++) fake_mode_ns[i] = 0;
+  fake_frames_lost = 0;
+  fake_dio_edges[0] = fake_dio_edges[1] = 0;
+  fake_spi_clear();
+}
+
+void fake_spi_clear(){
+  fake_spi.transactions = 0;
+  fake_spi.bytes = 0;
+  fake_spi.fifo_bytes = 0;
+  fake_spi.reg_reads = 0;
+  fake_spi.reg_writes = 0;
+  fake_cpu.gpio = 0;
+  fake_cpu.spi = 0;
+  fake_cpu.dma = 0;
+}
+
+void fake_set_dio_handler(void (*handler)(uint8_t dio)){
+  r->dio_handler = handler;
+}
+
+void fake_set_tx_handler(void (*handler)(const fake_frame &frame)){
+  r->tx_handler = handler;
+}
+
+void fake_select(uint8_t radio){
+  r = &radios[radio];
+  r->active = true;
+}
+
+void fake_set_link_handler(bool (*handler)(uint8_t from, uint8_t to, fake_frame &frame)){
+  link_handler = handler;
+}
+
+uint64_t fake_now_ns(){
+  return now_ns;
+}
+
+void fake_sleep_us(uint64_t us){
+  advance_to(now_ns + us * 1000);
+}
+
+void fake_set_spi_byte_ns(uint32_t ns){
+  spi_byte_ns = ns;
+}
+
+static void put_on_air(radio_state &to, const fake_frame &frame){
+  air_frame f;
+  double t_sym_ns = fake_symbol_us(frame.mod) * 1000;
+
+  f.frame = frame;
+  f.header_ns = frame.start_ns + (uint64_t)((frame.mod.preamble + 4.25 + (frame.mod.implicit_header ? 0 : HEADER_SYMBOLS)) * t_sym_ns);
+  f.header_done = false;
+  f.locked = false;
+  f.session = 0;
+  to.air.push_back(f);
+}
+
+void fake_send(const uint8_t *data, uint16_t length, uint32_t delay_us,
+               const fake_modulation &mod, int16_t rssi, int8_t snr, bool crc_error){
+  fake_frame frame;
+
+  for(uint16_t i = 0; i < length; i++) frame.data[i] = data[i];
+  frame.length = length;
+  frame.mod = mod;
+  frame.rssi = rssi;
+  frame.snr = snr;
+  frame.crc_error = crc_error;
+  frame.start_ns = now_ns + (uint64_t)delay_us * 1000;
+  frame.end_ns = frame.start_ns + (uint64_t)(fake_time_on_air_us(mod, length) * 1000);
+  put_on_air(*r, frame);
+}
+
+void fake_send(const uint8_t *data, uint16_t length, uint32_t delay_us){
+  fake_send(data, length, delay_us, fake_radio_modulation());
+}
+
+uint8_t fake_reg(uint8_t address){
+  return r->regs[address];
+}
+
+void fake_set_reg(uint8_t address, uint8_t value){
+  r->regs[address] = value;
+}
+
+uint8_t fake_fifo(uint8_t address){
+  return r->fifo[address];
+}
+
+fake_mode fake_radio_mode(){
+  return r->mode;
+}
+
+/******************************************************************************
+ * SPI slave
+ ******************************************************************************/
+
+void fake_spi_select(){
+  selected = true;
+  spi_count = 0;
+}
+
+void fake_spi_deselect(){
+  if(selected && (spi_count != 0)){
+    fake_spi.transactions++;
+  }
+  selected = false;
+}
+
+uint8_t fake_spi_begin_byte(){
+  uint8_t value;
+
+  if(!selected || (spi_count == 0) || spi_writing){
+    return 0;
+  }
+  value = reg_read(spi_address);
+  if(spi_address == REG_FIFO){
+    fake_spi.fifo_bytes++;
+  }else{
+    fake_spi.reg_reads++;
+    spi_address = (spi_address + 1) & 0x7F;
+  }
+  return value;
+}
+
+void fake_spi_end_byte(uint8_t mosi){
+  if(!selected){
+    return;
+  }
+  if(spi_count == 0){
+    spi_address = mosi & 0x7F;
+    spi_writing = (mosi & 0x80) != 0;
+  }else if(spi_writing){
+    reg_write(spi_address, mosi);
+    if(spi_address == REG_FIFO){
+      fake_spi.fifo_bytes++;
+    }else{
+      fake_spi.reg_writes++;
+      spi_address = (spi_address + 1) & 0x7F;
+    }
+  }
+  if(spi_count < 0xFF){
+    spi_count++;
+  }
+  fake_spi.bytes++;
+  advance_to(now_ns + spi_byte_ns);
+}
+
+uint8_t fake_spi_exchange(uint8_t mosi){
+  uint8_t miso_byte = fake_spi_begin_byte();
+
+  fake_spi_end_byte(mosi);
+  return miso_byte;
+}
+
+/******************************************************************************
+ * MCU: GPIO, interrupts, clock, UART
+ ******************************************************************************/
+
+// SPI mode 0: MOSI is sampled and MISO shifted on the rising SCK edge
+void fake_gpio_store::operator=(uint32_t value){
+  uint32_t before = odr[_port];
+
+  fake_cpu.gpio++;
+  if(_brr){
+    odr[_port] &= ~(value & 0xFFFF);
+  }else{
+    odr[_port] = (odr[_port] & ~(value >> 16)) | (value & 0xFFFF);
+  }
+
+  if(_port == SPI_NSS_PORT){
+    if((before & SPI_NSS_PIN) && !(odr[_port] & SPI_NSS_PIN)){
+      fake_spi_select();
+      sck_bits = 0;
+    }else if(!(before & SPI_NSS_PIN) && (odr[_port] & SPI_NSS_PIN)){
+      fake_spi_deselect();
+      miso = false;
+    }
+  }
+  if((_port == SPI_SCK_PORT) && !(before & SPI_SCK_PIN) && (odr[_port] & SPI_SCK_PIN) && selected){
+    if(sck_bits == 0){
+      sck_out = fake_spi_begin_byte();
+      sck_in = 0;
+    }
+    miso = (sck_out >> (7 - sck_bits)) & 1;
+    sck_in = (sck_in << 1) | ((odr[SPI_MOSI_PORT] & SPI_MOSI_PIN) ? 1 : 0);
+    if(++sck_bits == 8){
+      sck_bits = 0;
+      fake_spi_end_byte(sck_in);
+    }
+  }
+}
+
+uint32_t fake_gpio_idr(uint32_t port){
+  uint32_t value = odr[port];
+
+  fake_cpu.gpio++;
+  if(port == SPI_MISO_PORT){
+    value = miso ? (value | SPI_MISO_PIN) : (value & ~SPI_MISO_PIN);
+  }
+  return value;
+}
+
+void gpio_mode_setup(uint32_t, uint8_t, uint8_t, uint16_t){ }
+void gpio_set_output_options(uint32_t, uint8_t, uint8_t, uint16_t){ }
+void gpio_set_af(uint32_t, uint8_t, uint16_t){ }
+
+void gpio_set(uint32_t gpioport, uint16_t gpios){
+  GPIO_BSRR(gpioport) = gpios;
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios){
+  GPIO_BRR(gpioport) = gpios;
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios){
+  return fake_gpio_idr(gpioport) & gpios;
+}
+
+void disable_interrupts(){
+  irq_masked = true;
+}
+
+// Edges latched while masked are taken now, as the NVIC would
+void enable_interrupts(){
+  irq_masked = false;
+  for(uint8_t n = 0; n < FAKE_RADIOS; n++){
+    for(uint8_t dio = 0; dio < 2; dio++){
+      if(radios[n].dio_pending[dio]){
+        radios[n].dio_pending[dio] = false;
+        if(radios[n].dio_handler){
+          radios[n].dio_handler(dio);
+        }
+      }
+    }
+  }
+}
+
+// Sleeps until the next radio event or the next systick (1 ms)
+void wait_for_interrupt(){
+  uint64_t tick = (now_ns / 1000000 + 1) * 1000000;
+  uint64_t e = next_event();
+
+  advance_to(((e != 0) && (e < tick)) ? e : tick);
+}
+
+void wait_with_timer2(uint16_t limit){
+  advance_to(now_ns + (uint64_t)limit * 1000000);
+}
+
+void _Serial::print(int32_t){ }
+void _Serial::print(uint32_t, Type){ }
+void _Serial::print(char const*){ }
+void _Serial::println(char const*){ }
+void _Serial::println(int32_t){ }
+void _Serial::println(uint32_t, Type){ }
+void _Serial::println(){ }
@@ -0,0 +1,120 @@
+#ifndef FAKE_RADIO_HPP
+#define FAKE_RADIO_HPP
+
+#include <stdint.h>
+
+// Host model of the SX1278 behind the SPI pins of definitions.hpp, and of the
+// MCU around it (clock, WFI, DIO interrupts). The time only moves when the
+// driver does something that takes time on the target: an SPI byte, a
+// wait_for_interrupt() or a wait_with_timer2(). The other end of the link is
+// the test: it gets the frames put on air and sends frames to the radio.
+// Or a second radio, with its own driver: the frames of one are put on air
+// towards the other, the two nodes share the clock and the MCU model.
+
+#define FAKE_RADIOS 2
+
+// LoRa modulation of a frame, in register codes (BW_125, CR_5, SF_7...)
+struct fake_modulation{
+  uint8_t bw;
+  uint8_t cr;
+  uint8_t sf;
+  bool implicit_header;
+  bool crc;
+  bool ldro;
+  uint16_t preamble;
+};
+
+// A frame on air, sent by the radio or by the test
+struct fake_frame{
+  uint8_t data[256];
+  uint16_t length;
+  fake_modulation mod;
+  int16_t rssi;       // at the receiver (dBm)
+  int8_t snr;         // at the receiver (dB)
+  bool crc_error;     // payload corrupted on the way
+  uint64_t start_ns;  // first preamble symbol
+  uint64_t end_ns;
+};
+
+// SPI traffic seen by the radio since fake_reset() or the last clear
+struct fake_spi_counters{
+  uint32_t transactions; // chip selects with at least one byte
+  uint32_t bytes;        // address bytes included
+  uint32_t fifo_bytes;   // data bytes of REG_FIFO
+  uint32_t reg_reads;    // data bytes read, REG_FIFO excluded
+  uint32_t reg_writes;   // data bytes written, REG_FIFO excluded
+};
+
+// Peripheral register accesses of the core since the last clear, the work
+// an SPI backend leaves to the CPU
+struct fake_cpu_counters{
+  uint32_t gpio;  // BSRR/BRR stores and IDR loads
+  uint32_t spi;   // SPI1 SR/DR and DMA request bits
+  uint32_t dma;   // DMA channel registers
+};
+
+// Radio modes of REG_OP_MODE bits 2:0
+enum fake_mode{
+  FAKE_SLEEP, FAKE_STANDBY, FAKE_FSTX, FAKE_TX, FAKE_FSRX, FAKE_RXCONT, FAKE_RXSINGLE, FAKE_CAD
+};
+
+extern fake_spi_counters fake_spi;
+extern fake_cpu_counters fake_cpu;
+// Radio 0 only
+extern uint64_t fake_mode_ns[8];     // time spent in each mode, for the current draw
+extern uint32_t fake_frames_lost;    // frames on air the radio was not listening to
+extern uint32_t fake_dio_edges[2];   // rising edges of DIO0 and DIO1
+
+// Power-on state of every radio: registers at their reset value, FIFO
+// cleared, time 0, no frame on air, counters cleared, radio 0 selected and
+// alone on air. The handlers are kept.
+void fake_reset();
+void fake_spi_clear();   // fake_spi and fake_cpu
+
+// The radio on the SPI bus and the one the calls below are for. Select a
+// radio with the bus idle only. A radio once selected gets the frames the
+// others send.
+void fake_select(uint8_t radio);
+// Called for each frame a radio sends to another one: it returns false to
+// lose it, and can change its rssi, snr or crc_error
+void fake_set_link_handler(bool (*handler)(uint8_t from, uint8_t to, fake_frame &frame));
+
+// Called on a rising edge of DIO0/DIO1, as the EXTI handler of main.cpp
+void fake_set_dio_handler(void (*handler)(uint8_t dio));
+// Called when a frame sent by the radio ends
+void fake_set_tx_handler(void (*handler)(const fake_frame &frame));
+
+uint64_t fake_now_ns();
+// The core sleeps for 'us': interrupts and radio events still happen
+void fake_sleep_us(uint64_t us);
+// Nanoseconds one SPI byte takes on the bus, for the time model
+void fake_set_spi_byte_ns(uint32_t ns);
+
+// Current modulation set in the registers
+fake_modulation fake_radio_modulation();
+// Time-on-air with the floating point formula of the datasheet (4.1.1.7)
+double fake_time_on_air_us(const fake_modulation &mod, uint16_t length);
+double fake_symbol_us(const fake_modulation &mod);
+
+// Puts a frame on air towards the radio, starting 'delay_us' from now
+void fake_send(const uint8_t *data, uint16_t length, uint32_t delay_us,
+               const fake_modulation &mod, int16_t rssi = -80, int8_t snr = 8, bool crc_error = false);
+// Same, with the modulation the radio is set to
+void fake_send(const uint8_t *data, uint16_t length, uint32_t delay_us = 0);
+
+// Register and FIFO content, without SPI traffic
+uint8_t fake_reg(uint8_t address);
+void fake_set_reg(uint8_t address, uint8_t value);
+uint8_t fake_fifo(uint8_t address);
+fake_mode fake_radio_mode();
+
+// SPI slave, driven by the bus front ends (GPIO bit-bang, SPI1). A byte is
+// begun on its first SCK edge, which gives the byte shifted out on MISO, and
+// ended on its last one with the byte received on MOSI.
+void fake_spi_select();
+void fake_spi_deselect();
+uint8_t fake_spi_begin_byte();
+void fake_spi_end_byte(uint8_t mosi);
+uint8_t fake_spi_exchange(uint8_t mosi);
+
+#endif
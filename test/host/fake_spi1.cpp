@@ -0,0 +1,174 @@
+#include "fake_radio.hpp"
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+
+// SPI1 of the STM32F042 for spi_hw.cpp (SPI_BACKEND 1): 8 bit frames, a
+// 4 byte RX FIFO, and the DMA channels 2 (RX) and 3 (TX) it requests.
+
+struct fake_dma_channel{
+  uint8_t *memory;
+  uint16_t count;
+  bool increment;
+  bool enabled;
+  uint32_t flags;
+};
+
+fake_spi_dr8 fake_spi1_dr8;
+
+static uint8_t rx_fifo[4];
+static uint8_t rx_count;
+static fake_dma_channel channels[8];
+
+// The DMA registers hold 32 bit addresses: on a 64 bit host the upper half
+// is the one of the stack, for a buffer of a caller, or of the static data.
+static uint8_t *host_pointer(uint32_t address){
+  static uint8_t marker;
+  uint8_t local;
+  uintptr_t sp = (uintptr_t)&local;
+  uintptr_t on_stack = (sp & ~(uintptr_t)0xFFFFFFFF) | address;
+
+  if((on_stack >= sp) && (on_stack - sp < 0x100000)){
+    return (uint8_t *)on_stack;
+  }
+  return (uint8_t *)(((uintptr_t)&marker & ~(uintptr_t)0xFFFFFFFF) | address);
+}
+
+void fake_spi_dr8::operator=(uint8_t value){
+  uint8_t miso = fake_spi_exchange(value);
+
+  fake_cpu.spi++;
+  if(rx_count < sizeof(rx_fifo)){
+    rx_fifo[rx_count++] = miso;
+  }
+}
+
+fake_spi_dr8::operator uint8_t(){
+  uint8_t value = rx_fifo[0];
+
+  fake_cpu.spi++;
+  if(rx_count != 0){
+    for(uint8_t i = 1; i < rx_count; i++) rx_fifo[i - 1] = rx_fifo[i];
+    rx_count--;
+  }
+  return value;
+}
+
+uint32_t fake_spi_sr(uint32_t){
+  fake_cpu.spi++;
+  return SPI_SR_TXE | (rx_count ? SPI_SR_RXNE : 0);
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken){ }
+
+void spi_reset(uint32_t){
+  rx_count = 0;
+}
+
+int spi_init_master(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t){
+  return 0;
+}
+
+void spi_set_data_size(uint32_t, uint16_t){ }
+void spi_fifo_reception_threshold_8bit(uint32_t){ }
+void spi_enable_software_slave_management(uint32_t){ }
+void spi_set_nss_high(uint32_t){ }
+void spi_enable(uint32_t){ }
+
+void spi_enable_rx_dma(uint32_t){
+  fake_cpu.spi++;
+}
+
+void spi_disable_rx_dma(uint32_t){
+  fake_cpu.spi++;
+}
+
+// The TX request starts the transfer, the RX channel drains each byte
+void spi_enable_tx_dma(uint32_t){
+  fake_dma_channel &rx = channels[DMA_CHANNEL2];
+  fake_dma_channel &tx = channels[DMA_CHANNEL3];
+
+  fake_cpu.spi++;
+  if(!rx.enabled || !tx.enabled || (rx.count != tx.count)){
+    return;
+  }
+  for(uint16_t i = 0; i < tx.count; i++){
+    uint8_t miso = fake_spi_exchange(tx.memory[tx.increment ? i : 0]);
+    rx.memory[rx.increment ? i : 0] = miso;
+  }
+  tx.flags |= DMA_TCIF;
+  rx.flags |= DMA_TCIF;
+}
+
+void spi_disable_tx_dma(uint32_t){
+  fake_cpu.spi++;
+}
+
+void dma_channel_reset(uint32_t, uint8_t channel){
+  fake_cpu.dma++;
+  channels[channel].memory = 0;
+  channels[channel].count = 0;
+  channels[channel].increment = false;
+  channels[channel].enabled = false;
+  channels[channel].flags = 0;
+}
+
+void dma_set_peripheral_address(uint32_t, uint8_t, uint32_t){
+  fake_cpu.dma++;
+}
+
+void dma_set_memory_address(uint32_t, uint8_t channel, uint32_t address){
+  fake_cpu.dma++;
+  channels[channel].memory = host_pointer(address);
+}
+
+void dma_set_number_of_data(uint32_t, uint8_t channel, uint16_t number){
+  fake_cpu.dma++;
+  channels[channel].count = number;
+}
+
+void dma_set_read_from_peripheral(uint32_t, uint8_t){
+  fake_cpu.dma++;
+}
+
+void dma_set_read_from_memory(uint32_t, uint8_t){
+  fake_cpu.dma++;
+}
+
+void dma_enable_memory_increment_mode(uint32_t, uint8_t channel){
+  fake_cpu.dma++;
+  channels[channel].increment = true;
+}
+
+void dma_set_peripheral_size(uint32_t, uint8_t, uint32_t){
+  fake_cpu.dma++;
+}
+
+void dma_set_memory_size(uint32_t, uint8_t, uint32_t){
+  fake_cpu.dma++;
+}
+
+void dma_set_priority(uint32_t, uint8_t, uint32_t){
+  fake_cpu.dma++;
+}
+
+void dma_enable_channel(uint32_t, uint8_t channel){
+  fake_cpu.dma++;
+  channels[channel].enabled = true;
+}
+
+void dma_disable_channel(uint32_t, uint8_t channel){
+  fake_cpu.dma++;
+  channels[channel].enabled = false;
+}
+
+bool dma_get_interrupt_flag(uint32_t, uint8_t channel, uint32_t interrupts){
+  fake_cpu.dma++;
+  return (channels[channel].flags & interrupts) != 0;
+}
+
+void dma_clear_interrupt_flags(uint32_t, uint8_t channel, uint32_t interrupts){
+  fake_cpu.dma++;
+  channels[channel].flags &= ~interrupts;
+}
@@ -0,0 +1,8 @@
+#ifndef FAKE_LIBOPENCM3_DAC_H
+#define FAKE_LIBOPENCM3_DAC_H
+
+// Host stand-in for libopencm3 DAC, only included for its types
+
+#include <stdint.h>
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef FAKE_LIBOPENCM3_DMA_H
+#define FAKE_LIBOPENCM3_DMA_H
+
+// Host stand-in for libopencm3 DMA: the SPI1 channels of fake_spi1.cpp move
+// the whole transfer when the TX request is enabled.
+
+#include <stdint.h>
+
+#define DMA1 0
+
+#define DMA_CHANNEL1 1
+#define DMA_CHANNEL2 2
+#define DMA_CHANNEL3 3
+#define DMA_CHANNEL4 4
+#define DMA_CHANNEL5 5
+
+#define DMA_TCIF (1 << 1)
+
+#define DMA_CCR_PSIZE_8BIT  (0x0 << 8)
+#define DMA_CCR_MSIZE_8BIT  (0x0 << 10)
+#define DMA_CCR_PL_LOW       (0x0 << 12)
+#define DMA_CCR_PL_MEDIUM    (0x1 << 12)
+#define DMA_CCR_PL_HIGH      (0x2 << 12)
+#define DMA_CCR_PL_VERY_HIGH (0x3 << 12)
+
+void dma_channel_reset(uint32_t dma, uint8_t channel);
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uint32_t address);
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uint32_t address);
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number);
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel);
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel);
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel);
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t peripheral_size);
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t mem_size);
+void dma_set_priority(uint32_t dma, uint8_t channel, uint32_t prio);
+void dma_enable_channel(uint32_t dma, uint8_t channel);
+void dma_disable_channel(uint32_t dma, uint8_t channel);
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts);
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts);
+
+#endif
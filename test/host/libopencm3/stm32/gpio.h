@@ -0,0 +1,80 @@
+#ifndef FAKE_LIBOPENCM3_GPIO_H
+#define FAKE_LIBOPENCM3_GPIO_H
+
+// Host stand-in for libopencm3 GPIO: the pin registers are RAM, and the SPI
+// pins of definitions.hpp drive the SPI slave of fake_radio.cpp.
+
+#include <stdint.h>
+
+#define GPIOA 0
+#define GPIOB 1
+#define GPIOC 2
+#define GPIOF 3
+
+#define GPIO0  (1 << 0)
+#define GPIO1  (1 << 1)
+#define GPIO2  (1 << 2)
+#define GPIO3  (1 << 3)
+#define GPIO4  (1 << 4)
+#define GPIO5  (1 << 5)
+#define GPIO6  (1 << 6)
+#define GPIO7  (1 << 7)
+#define GPIO8  (1 << 8)
+#define GPIO9  (1 << 9)
+#define GPIO10 (1 << 10)
+#define GPIO11 (1 << 11)
+#define GPIO12 (1 << 12)
+#define GPIO13 (1 << 13)
+#define GPIO14 (1 << 14)
+#define GPIO15 (1 << 15)
+
+#define GPIO_MODE_INPUT  0x00
+#define GPIO_MODE_OUTPUT 0x01
+#define GPIO_MODE_AF     0x02
+#define GPIO_MODE_ANALOG 0x03
+
+#define GPIO_PUPD_NONE     0x00
+#define GPIO_PUPD_PULLUP   0x01
+#define GPIO_PUPD_PULLDOWN 0x02
+
+#define GPIO_OTYPE_PP 0x00
+#define GPIO_OTYPE_OD 0x01
+
+#define GPIO_OSPEED_LOW    0x00
+#define GPIO_OSPEED_MED    0x01
+#define GPIO_OSPEED_HIGH   0x03
+#define GPIO_OSPEED_100MHZ 0x03
+
+#define GPIO_AF0 0x00
+#define GPIO_AF1 0x01
+#define GPIO_AF2 0x02
+#define GPIO_AF3 0x03
+#define GPIO_AF4 0x04
+#define GPIO_AF5 0x05
+#define GPIO_AF6 0x06
+#define GPIO_AF7 0x07
+
+// A store to BSRR (set bits 15:0, reset bits 31:16) or to BRR
+class fake_gpio_store{
+public:
+  fake_gpio_store(uint32_t port, bool brr) : _port(port), _brr(brr){ }
+  void operator=(uint32_t value);
+private:
+  uint32_t _port;
+  bool _brr;
+};
+
+uint32_t fake_gpio_idr(uint32_t port);
+
+#define GPIO_BSRR(port) fake_gpio_store((port), false)
+#define GPIO_BRR(port)  fake_gpio_store((port), true)
+#define GPIO_IDR(port)  fake_gpio_idr(port)
+
+void gpio_mode_setup(uint32_t gpioport, uint8_t mode, uint8_t pull_up_down, uint16_t gpios);
+void gpio_set_output_options(uint32_t gpioport, uint8_t otype, uint8_t speed, uint16_t gpios);
+void gpio_set_af(uint32_t gpioport, uint8_t alt_func_num, uint16_t gpios);
+void gpio_set(uint32_t gpioport, uint16_t gpios);
+void gpio_clear(uint32_t gpioport, uint16_t gpios);
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef FAKE_LIBOPENCM3_RCC_H
+#define FAKE_LIBOPENCM3_RCC_H
+
+// Host stand-in for libopencm3 RCC: clocks are always on
+
+#include <stdint.h>
+
+enum rcc_periph_clken{
+  RCC_SPI1, RCC_DMA
+};
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef FAKE_LIBOPENCM3_SPI_H
+#define FAKE_LIBOPENCM3_SPI_H
+
+// Host stand-in for libopencm3 SPI: SPI1 is a model in fake_spi1.cpp, in
+// front of the SPI slave of fake_radio.cpp. A byte written to DR is shifted
+// at once, SR reports it received.
+
+#include <stdint.h>
+
+#define SPI1 0
+
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_8     (0x02 << 3)
+#define SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE  (0 << 1)
+#define SPI_CR1_CPHA_CLK_TRANSITION_1    (0 << 0)
+#define SPI_CR1_MSBFIRST                 (0 << 7)
+#define SPI_CR2_DS_8BIT                  (0x7 << 8)
+
+#define SPI_SR_RXNE (1 << 0)
+#define SPI_SR_TXE  (1 << 1)
+#define SPI_SR_BSY  (1 << 7)
+
+// DR accessed as a byte: a store starts a transfer, a load pops the RX FIFO
+class fake_spi_dr8{
+public:
+  void operator=(uint8_t value);
+  operator uint8_t();
+};
+
+extern fake_spi_dr8 fake_spi1_dr8;
+uint32_t fake_spi_sr(uint32_t spi);
+
+#define SPI_SR(spi)  fake_spi_sr(spi)
+#define SPI_DR8(spi) fake_spi1_dr8
+
+void spi_reset(uint32_t spi_peripheral);
+int spi_init_master(uint32_t spi, uint32_t br, uint32_t cpol, uint32_t cpha, uint32_t lsbfirst);
+void spi_set_data_size(uint32_t spi, uint16_t data_s);
+void spi_fifo_reception_threshold_8bit(uint32_t spi);
+void spi_enable_software_slave_management(uint32_t spi);
+void spi_set_nss_high(uint32_t spi);
+void spi_enable(uint32_t spi);
+void spi_enable_rx_dma(uint32_t spi);
+void spi_disable_rx_dma(uint32_t spi);
+void spi_enable_tx_dma(uint32_t spi);
+void spi_disable_tx_dma(uint32_t spi);
+
+#endif
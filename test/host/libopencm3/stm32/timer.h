@@ -0,0 +1,17 @@
+#ifndef FAKE_LIBOPENCM3_TIMER_H
+#define FAKE_LIBOPENCM3_TIMER_H
+
+// Host stand-in for libopencm3 timers: the counters never run, the waits of
+// timer.hpp are provided by fake_radio.cpp
+
+#include <stdint.h>
+
+#define TIM2 0
+#define TIM3 1
+
+#define TIM_CR1_CEN (1 << 0)
+
+extern uint32_t fake_tim_cr1[2];
+#define TIM_CR1(tim) (fake_tim_cr1[(tim)])
+
+#endif
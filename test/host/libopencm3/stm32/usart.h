@@ -0,0 +1,11 @@
+#ifndef FAKE_LIBOPENCM3_USART_H
+#define FAKE_LIBOPENCM3_USART_H
+
+// Host stand-in for libopencm3 USART: Serial prints nothing on the host
+
+#include <stdint.h>
+
+#define USART1 0
+#define USART2 1
+
+#endif
@@ -0,0 +1,13 @@
+// Bring-up of a driver on the selected fake radio, with the settings of
+// definitions.hpp: LoRa mode LORA_MODE, explicit header, CRC, channel and
+// power. 'rx_buf' holds MAX_PAYLOAD bytes. Suites include <unity.h> first.
+void setup_radio(SX1278 &radio, uint8_t *rx_buf, uint8_t address = LORA_ADDRESS){
+  TEST_ASSERT_EQUAL(0, radio.ON());
+  TEST_ASSERT_EQUAL(0, radio.setMode<LORA_MODE>());
+  TEST_ASSERT_EQUAL(0, radio.setHeaderON());
+  TEST_ASSERT_EQUAL(0, radio.setChannel(LORA_CHANNEL));
+  TEST_ASSERT_EQUAL(0, radio.setCRC_ON());
+  TEST_ASSERT_EQUAL(0, radio.setPower(LORA_POWER));
+  radio.setRxBuffer(rx_buf, MAX_PAYLOAD);
+  TEST_ASSERT_EQUAL(0, radio.setNodeAddress(address));
+}
@@ -0,0 +1,12 @@
+// Firmware sources built for the host with the fake MCU and radio, in one
+// translation unit per test suite. A suite can set flags of definitions.hpp
+// before including it.
+#include "fake_radio.cpp"
+#include "fake_spi1.cpp"
+#include "spi.cpp"
+#include "spi_hw.cpp"
+#include "rx_queue.cpp"
+#include "adr.cpp"
+#include "compress.cpp"
+#include "lora_arduino.cpp"
+#include "setup_radio.cpp"
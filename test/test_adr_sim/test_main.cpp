@@ -0,0 +1,206 @@
+// The ADR policy of adr.cpp run over simulated RSSI traces: one packet per
+// step, lost when its level is under the sensitivity of the mode in use (no
+// sample then). The summary gives the switches, losses and airtime against
+// a fixed mode that closes the link over the whole trace, to tune
+// LORA_ADR_MARGIN/HYSTERESIS/SAMPLES.
+#include <stdio.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+#define FRAME_LENGTH (20 + OFFSET_PAYLOADLENGTH)
+
+struct adr_run{
+  uint8_t mode;       // mode at the end of the trace
+  uint16_t switches;
+  uint16_t lost;
+  uint32_t airtime_ms;
+  uint32_t fixed_ms;  // the same packets in the fastest mode with margin at the weakest level
+};
+
+static uint32_t toa_us[17];
+
+template<uint8_t M>
+static void fill_toa(){
+  toa_us[M] = LoraMode<M>::timeOnAirUs(FRAME_LENGTH);
+  fill_toa<M - 1>();
+}
+
+template<>
+void fill_toa<0>(){
+}
+
+static int16_t sens(uint8_t mode){
+  return sensitivity[mode - 1];
+}
+
+static adr_run run(const int16_t *trace, uint16_t count, uint8_t mode){
+  adr_link link;
+  adr_run r = { 0, 0, 0, 0, 0 };
+  int16_t weakest = 0;
+  uint8_t fixed = ladder[sizeof(ladder) - 1];
+
+  for(uint16_t i = 0; i < count; i++){
+    if(trace[i] < weakest) weakest = trace[i];
+  }
+  for(uint8_t i = sizeof(ladder); i-- > 0; ){
+    if(sens(ladder[i]) + LORA_ADR_MARGIN <= weakest) fixed = ladder[i];
+  }
+
+  adr_init(&link, mode);
+  for(uint16_t i = 0; i < count; i++){
+    uint8_t pick;
+
+    r.airtime_ms += toa_us[link.mode] / 1000;
+    r.fixed_ms += toa_us[fixed] / 1000;
+    if(trace[i] < sens(link.mode)){
+      r.lost++;
+      continue;
+    }
+    adr_sample(&link, trace[i]);
+    pick = adr_pick(&link);
+    if(pick != link.mode){
+      adr_switch(&link, pick);
+      r.switches++;
+    }
+  }
+  r.mode = link.mode;
+  return r;
+}
+
+static void report(const char *name, const adr_run &r){
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "%s: mode %u, %u switches, %u lost, airtime %u ms (fixed mode %u ms)",
+           name, r.mode, r.switches, r.lost, (unsigned)r.airtime_ms, (unsigned)r.fixed_ms);
+  TEST_MESSAGE(msg);
+}
+
+static int16_t trace[400];
+static uint32_t seed;
+
+static int16_t noise(int16_t amplitude){
+  seed = seed * 1103515245 + 12345;
+  return (int16_t)((seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+void setUp(){
+  fill_toa<16>();
+  seed = 1;
+}
+
+void tearDown(){
+}
+
+// Every ladder mode travels in the 4 bits of the ACK, the others do not
+void test_codes(){
+  uint8_t coded = 0;
+
+  for(uint8_t mode = 1; mode <= 16; mode++){
+    uint8_t code = adr_encode(mode);
+    if(code == 0) continue;
+    TEST_ASSERT_LESS_THAN(16, code);
+    TEST_ASSERT_EQUAL(mode, adr_decode(code));
+    coded++;
+  }
+  TEST_ASSERT_EQUAL(sizeof(ladder), coded);
+  TEST_ASSERT_EQUAL(0, adr_decode(0));
+  TEST_ASSERT_EQUAL(0, adr_decode(sizeof(ladder) + 1));
+}
+
+// Each step of the ladder is slower and more sensitive than the one before
+void test_ladder_order(){
+  for(uint8_t i = 1; i < sizeof(ladder); i++){
+    TEST_ASSERT_LESS_THAN(sens(ladder[i - 1]), sens(ladder[i]));
+    TEST_ASSERT_GREATER_THAN(toa_us[ladder[i - 1]], toa_us[ladder[i]]);
+  }
+}
+
+// A strong steady link ends in the fastest mode and stays there
+void test_steady_strong(){
+  adr_run r;
+
+  for(uint16_t i = 0; i < 50; i++) trace[i] = -90;
+  r = run(trace, 50, LORA_MODE);
+  report("steady -90 dBm", r);
+  TEST_ASSERT_EQUAL(ladder[0], r.mode);
+  TEST_ASSERT_LESS_OR_EQUAL(1, r.switches);
+  TEST_ASSERT_EQUAL(0, r.lost);
+}
+
+// A sudden 25 dB fade is followed within a few packets, without a loss
+void test_fade(){
+  adr_run r;
+
+  for(uint16_t i = 0; i < 20; i++) trace[i] = -90;
+  for(uint16_t i = 20; i < 40; i++) trace[i] = -115;
+  r = run(trace, 40, LORA_MODE);
+  report("fade -90 -> -115 dBm", r);
+  TEST_ASSERT_EQUAL(0, r.lost);
+  TEST_ASSERT_LESS_OR_EQUAL(-115 - LORA_ADR_MARGIN, sens(r.mode));
+  TEST_ASSERT_EQUAL(r.mode, run(trace, 24, LORA_MODE).mode);   // settled after 4 packets
+}
+
+// A slow decline down to the edge of the slowest mode
+void test_slow_decline(){
+  uint16_t count = 0;
+  adr_run r;
+
+  for(int16_t level = -80 * 2; level >= -135 * 2; level--) trace[count++] = level / 2;
+  r = run(trace, count, LORA_MODE);
+  report("decline -80 -> -135 dBm", r);
+  TEST_ASSERT_EQUAL(0, r.lost);
+  TEST_ASSERT_EQUAL(ladder[sizeof(ladder) - 1], r.mode);
+  TEST_ASSERT_LESS_OR_EQUAL(sizeof(ladder), r.switches);
+}
+
+// Noise around a step of the ladder: the hysteresis keeps the mode from
+// flapping on every packet
+void test_noisy(){
+  const uint16_t count = sizeof(trace) / sizeof(trace[0]);
+  int16_t mean = sens(ladder[2]) + LORA_ADR_MARGIN;
+  adr_run r;
+
+  for(uint16_t i = 0; i < count; i++) trace[i] = mean + noise(4);
+  r = run(trace, count, LORA_MODE);
+  report("noisy, +-4 dB", r);
+  TEST_ASSERT_EQUAL(0, r.lost);
+  TEST_ASSERT_LESS_THAN(count / 10, r.switches);
+  TEST_ASSERT_LESS_THAN(r.fixed_ms, r.airtime_ms);
+}
+
+// 30 dB fades that build up at 3 dB a packet are followed without a loss.
+// A fade deeper than the margin from one packet to the next is not: nothing
+// is heard to sample, LORA_ADR_FALLBACK_MS brings both ends back.
+void test_deep_fades(){
+  const uint16_t count = sizeof(trace) / sizeof(trace[0]);
+  adr_run r;
+
+  for(uint16_t i = 0; i < count; i++){
+    uint16_t step = i % 50;
+    int16_t fade = (step < 10) ? 3 * step : (step < 20) ? 30 - 3 * (step - 10) : 0;
+    trace[i] = -95 + noise(2) - fade;
+  }
+  r = run(trace, count, LORA_MODE);
+  report("-95 dBm with 30 dB fades, 3 dB/packet", r);
+  TEST_ASSERT_EQUAL(0, r.lost);
+  TEST_ASSERT_LESS_THAN(r.fixed_ms, r.airtime_ms);
+
+  for(uint16_t i = 0; i < count; i++){
+    trace[i] = -95 + noise(2) - ((i % 50 >= 45) ? 30 : 0);
+  }
+  r = run(trace, count, LORA_MODE);
+  report("-95 dBm with sudden 30 dB fades", r);
+  TEST_ASSERT_EQUAL(count / 50 * 5, r.lost);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_codes);
+  RUN_TEST(test_ladder_order);
+  RUN_TEST(test_steady_strong);
+  RUN_TEST(test_fade);
+  RUN_TEST(test_slow_decline);
+  RUN_TEST(test_noisy);
+  RUN_TEST(test_deep_fades);
+  return UNITY_END();
+}
@@ -0,0 +1,140 @@
+// text_compress()/text_decompress() over the chat corpus of the
+// COMPRESS_BENCHMARK block of main.cpp: ratio, round trip, host time per
+// message, and the airtime the ratio saves in LORA_MODE.
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+static const char *const corpus[] = {
+  "hello, are you there?", "the battery is at 80 percent", "ok",
+  "meeting at the station in ten minutes", "lora test message number one",
+  "I sent the data, did you get it?", "going home now. see you tomorrow!",
+  "temperature is 23.5 C and rising"};
+static const uint8_t count = sizeof(corpus) / sizeof(corpus[0]);
+
+static uint8_t packed[MAX_PAYLOAD];
+static uint8_t text[MAX_PAYLOAD];
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+// The figure quoted for the corpus: coded to 53% of its size
+void test_corpus_ratio(){
+  uint32_t raw = 0;
+  uint32_t coded = 0;
+  uint32_t toa_raw = 0;
+  uint32_t toa_coded = 0;
+  char msg[96];
+
+  for(uint8_t i = 0; i < count; i++){
+    uint8_t len = strlen(corpus[i]);
+    uint8_t n = text_compress((const uint8_t *)corpus[i], len, packed, sizeof(packed));
+
+    raw += len;
+    coded += n ? n : len;
+    toa_raw += LoraMode<LORA_MODE>::timeOnAirUs(len + OFFSET_PAYLOADLENGTH);
+    toa_coded += LoraMode<LORA_MODE>::timeOnAirUs((n ? n : len) + OFFSET_PAYLOADLENGTH);
+  }
+  snprintf(msg, sizeof(msg), "coded/raw %u/%u bytes (%u%%), airtime %u/%u us",
+           (unsigned)coded, (unsigned)raw, (unsigned)(coded * 100 / raw),
+           (unsigned)toa_coded, (unsigned)toa_raw);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(53, coded * 100 / raw);
+  TEST_ASSERT_LESS_THAN(toa_raw, toa_coded);
+}
+
+void test_corpus_round_trip(){
+  for(uint8_t i = 0; i < count; i++){
+    uint8_t len = strlen(corpus[i]);
+    uint8_t n = text_compress((const uint8_t *)corpus[i], len, packed, sizeof(packed));
+
+    if(n == 0){
+      continue;   // sent raw
+    }
+    TEST_ASSERT_LESS_THAN(len, n);
+    TEST_ASSERT_EQUAL(len, text_decompress(packed, n, text, sizeof(text)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(corpus[i], text, len);
+  }
+}
+
+// Every line of 1..MAX_PAYLOAD printable characters that codes comes back
+void test_generated_round_trip(){
+  uint32_t seed = 1;
+
+  for(uint16_t run = 0; run < 2000; run++){
+    uint8_t len = 1 + run % MAX_PAYLOAD;
+    uint8_t n;
+
+    for(uint8_t i = 0; i < len; i++){
+      const char *line;
+      seed = seed * 1103515245 + 12345;
+      line = corpus[(seed >> 20) % count];
+      // mostly corpus text, some random printable bytes
+      packed[i] = ((seed >> 16) & 3) ? line[i % strlen(line)] : (uint8_t)(' ' + (seed >> 24) % 95);
+    }
+    TEST_ASSERT_EQUAL(0, text_compress(packed, len, text, 0));   // no room: sent raw
+
+    n = text_compress(packed, len, text, sizeof(text));
+    if(n != 0){
+      uint8_t back[MAX_PAYLOAD];
+      TEST_ASSERT_LESS_THAN(len, n);
+      TEST_ASSERT_EQUAL(len, text_decompress(text, n, back, sizeof(back)));
+      TEST_ASSERT_EQUAL_UINT8_ARRAY(packed, back, len);
+    }
+  }
+}
+
+void test_not_coded(){
+  const uint8_t binary[] = { 'a', 0x80, 'b' };
+  const uint8_t short_text[] = { 'x', 'q' };
+
+  TEST_ASSERT_EQUAL(0, text_compress(binary, sizeof(binary), packed, sizeof(packed)));
+  TEST_ASSERT_EQUAL(0, text_compress(short_text, sizeof(short_text), packed, sizeof(packed)));
+  TEST_ASSERT_EQUAL(0, text_compress((const uint8_t *)corpus[0], strlen(corpus[0]), packed, 2));
+}
+
+// Host time only: the figures of the target come from COMPRESS_BENCHMARK
+void test_host_time(){
+  const uint16_t rounds = 2000;
+  uint8_t len[count];
+  uint8_t n[count];
+  char msg[96];
+
+  for(uint8_t i = 0; i < count; i++){
+    len[i] = strlen(corpus[i]);
+    n[i] = text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+  }
+  auto t0 = std::chrono::steady_clock::now();
+  for(uint16_t r = 0; r < rounds; r++)
+    for(uint8_t i = 0; i < count; i++)
+      text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+  auto t1 = std::chrono::steady_clock::now();
+  for(uint16_t r = 0; r < rounds; r++)
+    for(uint8_t i = 0; i < count; i++){
+      uint8_t k = text_compress((const uint8_t *)corpus[i], len[i], packed, sizeof(packed));
+      TEST_ASSERT_EQUAL(n[i], k);
+      if(k) text_decompress(packed, k, text, sizeof(text));
+    }
+  auto t2 = std::chrono::steady_clock::now();
+  uint64_t encode = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+  uint64_t decode = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() - encode;
+
+  snprintf(msg, sizeof(msg), "host: encode %u ns/message, decode %u ns/message",
+           (unsigned)(encode / (rounds * count)), (unsigned)((int64_t)decode > 0 ? decode / (rounds * count) : 0));
+  TEST_MESSAGE(msg);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_corpus_ratio);
+  RUN_TEST(test_corpus_round_trip);
+  RUN_TEST(test_generated_round_trip);
+  RUN_TEST(test_not_coded);
+  RUN_TEST(test_host_time);
+  return UNITY_END();
+}
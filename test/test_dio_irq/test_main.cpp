@@ -0,0 +1,275 @@
+// DIO interrupts: dioInterrupt() decoding, waitIrq() sleeping on the DIO
+// edges, and poll() driving a send and a receive through the fake radio.
+#include <unity.h>
+#include "host/units.cpp"
+
+static uint8_t rx_buf[MAX_PAYLOAD];
+static fake_frame last_tx;
+static uint16_t tx_count;
+static bool ack_reply;
+
+static void dio_isr(uint8_t dio){
+  sx1278.dioInterrupt(dio);
+}
+
+// The peer: answers data frames with an ACK when asked to
+static void peer_tx(const fake_frame &frame){
+  last_tx = frame;
+  tx_count++;
+  if(ack_reply && (frame.data[3] != ACK_MARK)){
+    uint8_t ack[ACK_LENGTH] = { frame.data[1], frame.data[0], frame.data[2], ACK_MARK, CORRECT_PACKET };
+    fake_send(ack, ACK_LENGTH, 2000);
+  }
+}
+
+// Another node talks to us before the peer answers a burst with its block ACK
+static const uint8_t other_frame[] = { LORA_ADDRESS, 9, 1, 8, 'o', 't', 'h', 0 };
+
+static void window_peer_tx(const fake_frame &frame){
+  uint32_t other_us = 1000 + (uint32_t)fake_time_on_air_us(frame.mod, sizeof(other_frame));
+  uint8_t ack[ACK_LENGTH + 1] = { frame.data[1], frame.data[0], frame.data[2], ACK_MARK, CORRECT_PACKET | ACK_BLOCK, 0x01 };
+
+  last_tx = frame;
+  tx_count++;
+  if(frame.data[frame.length - 1] & WINDOW_ACK_REQUEST){
+    fake_send(other_frame, sizeof(other_frame), 1000);
+    fake_send(ack, ACK_LENGTH + 1, other_us + 1000);
+  }
+}
+
+void setUp(){
+  sx1278 = SX1278();
+  fake_reset();
+  fake_set_dio_handler(dio_isr);
+  fake_set_tx_handler(peer_tx);
+  tx_count = 0;
+  ack_reply = false;
+  while(rx_queue_front()){
+    rx_queue_pop();
+  }
+  rx_queue_dropped = 0;
+  setup_radio(sx1278, rx_buf);
+}
+
+void tearDown(){
+}
+
+void test_dio_decoded_with_mapping(){
+  sx1278._irqPending = 0;
+  sx1278.setDioMapping(DIO_MAPPING_TX);
+  sx1278.dioInterrupt(0);
+  TEST_ASSERT_EQUAL_HEX8(IRQ_TX_DONE, sx1278._irqPending);
+
+  sx1278._irqPending = 0;
+  sx1278.setDioMapping(DIO_MAPPING_RX);
+  sx1278.dioInterrupt(0);
+  sx1278.dioInterrupt(1);
+  TEST_ASSERT_EQUAL_HEX8(IRQ_RX_DONE | IRQ_RX_TIMEOUT, sx1278._irqPending);
+
+  sx1278._irqPending = 0;
+  sx1278.setDioMapping(DIO_MAPPING_CAD);
+  sx1278.dioInterrupt(0);
+  sx1278.dioInterrupt(1);
+  TEST_ASSERT_EQUAL_HEX8(IRQ_CAD_DONE | IRQ_CAD_DETECTED, sx1278._irqPending);
+}
+
+// The wait ends on the DIO edge, with a single bus access for the flags
+void test_wait_irq_wakes_on_rx_done(){
+  uint8_t frame[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 1, 8, 'a', 'b', 'c', 0 };
+  uint8_t flags;
+  uint64_t end;
+
+  TEST_ASSERT_EQUAL(0, sx1278.receive());
+  fake_send(frame, sizeof(frame), 1000);
+  end = fake_now_ns() / 1000 + 1000 + (uint64_t)fake_time_on_air_us(fake_radio_modulation(), sizeof(frame));
+  fake_spi_clear();
+
+  flags = sx1278.waitIrq(IRQ_RX_DONE, 5000);
+  TEST_ASSERT_TRUE(flags & IRQ_RX_DONE);
+  TEST_ASSERT_EQUAL_UINT32(1, fake_dio_edges[0]);
+  TEST_ASSERT_EQUAL_UINT32(1, fake_spi.transactions);
+  TEST_ASSERT_UINT32_WITHIN(50, end, fake_now_ns() / 1000);
+}
+
+void test_wait_irq_times_out(){
+  uint8_t flags;
+  uint32_t start;
+
+  TEST_ASSERT_EQUAL(0, sx1278.receive());
+  start = millis();
+  fake_spi_clear();
+  flags = sx1278.waitIrq(IRQ_RX_DONE, 100);
+  TEST_ASSERT_EQUAL_HEX8(0, flags & IRQ_RX_DONE);
+  TEST_ASSERT_EQUAL_UINT32(100, millis() - start);
+  TEST_ASSERT_EQUAL_UINT32(1, fake_spi.transactions);
+}
+
+// availableData() and getPacket() sleep until RxDone instead of polling the
+// flags over SPI
+void test_receive_sleeps_until_rx_done(){
+  uint8_t frame[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 2, 9, 'd', 'i', 'o', '!', 0 };
+
+  TEST_ASSERT_EQUAL(0, sx1278.receive());
+  fake_send(frame, sizeof(frame), 20000);
+  fake_spi_clear();
+  TEST_ASSERT_TRUE(sx1278.availableData(5000));
+  TEST_ASSERT_EQUAL(0, sx1278.getPacket(0));
+  TEST_ASSERT_EQUAL(4, sx1278._payloadlength);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&frame[4], rx_buf, 4);
+  TEST_ASSERT_LESS_THAN(20, fake_spi.transactions);
+}
+
+// A data frame comes in while poll() runs the receive, the ACK goes out
+void test_receive_async_sends_ack(){
+  uint8_t frame[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 7, 10, 'h', 'e', 'l', 'l', 'o', 0 };
+  lora_async *op = sx1278.receivePacketAsync(10000, true);
+
+  TEST_ASSERT_NOT_NULL(op);
+  fake_send(frame, sizeof(frame), 20000);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(5, sx1278._payloadlength);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&frame[4], rx_buf, 5);
+
+  TEST_ASSERT_EQUAL(1, tx_count);
+  TEST_ASSERT_EQUAL(ACK_LENGTH, last_tx.length);
+  TEST_ASSERT_EQUAL(LORA_SEND_TO_ADDRESS, last_tx.data[0]);
+  TEST_ASSERT_EQUAL(LORA_ADDRESS, last_tx.data[1]);
+  TEST_ASSERT_EQUAL(7, last_tx.data[2]);
+  TEST_ASSERT_EQUAL(ACK_MARK, last_tx.data[3]);
+  TEST_ASSERT_EQUAL(CORRECT_PACKET, last_tx.data[4] & ACK_STATUS_MASK);
+}
+
+// Send, TxDone on DIO0, then the ACK of the peer on DIO0 again
+void test_send_async_gets_ack(){
+  uint8_t payload[] = { 'p', 'i', 'n', 'g' };
+  lora_async *op;
+
+  ack_reply = true;
+  op = sx1278.sendPacketAsync(LORA_SEND_TO_ADDRESS, payload, sizeof(payload), 0, false);
+  TEST_ASSERT_NOT_NULL(op);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(1, tx_count);
+  TEST_ASSERT_EQUAL(LORA_SEND_TO_ADDRESS, last_tx.data[0]);
+  TEST_ASSERT_EQUAL(LORA_ADDRESS, last_tx.data[1]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(payload, &last_tx.data[4], sizeof(payload));
+  TEST_ASSERT_EQUAL_UINT32(2, fake_dio_edges[0]);
+}
+
+void test_send_async_without_ack_fails(){
+  uint8_t payload[] = { 'p', 'i', 'n', 'g' };
+  lora_async *op = sx1278.sendPacketAsync(LORA_SEND_TO_ADDRESS, payload, sizeof(payload), 0, false);
+
+  TEST_ASSERT_NOT_NULL(op);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(9, op->result);
+  TEST_ASSERT_EQUAL(1, tx_count);
+}
+
+// Two frames land before the main loop gets to the FIFO: the first one is
+// found from the tail, the second one from the packet pointers
+void test_service_rx_walks_fifo(){
+  uint8_t first[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 3, 7, 'a', 'b', 0 };
+  uint8_t second[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 4, 8, 'c', 'd', 'e', 0 };
+  uint32_t gap = (uint32_t)fake_time_on_air_us(fake_radio_modulation(), sizeof(first)) + 5000;
+
+  TEST_ASSERT_EQUAL(0, sx1278.rearm());
+  fake_send(first, sizeof(first), 1000);
+  fake_send(second, sizeof(second), 1000 + gap);
+  fake_sleep_us(2 * gap + 10000);
+  TEST_ASSERT_EQUAL(2, sx1278.serviceRx());
+  TEST_ASSERT_EQUAL(sizeof(first), rx_queue_front()->sz);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(first, rx_queue_front()->data, sizeof(first));
+  rx_queue_pop();
+  TEST_ASSERT_EQUAL(sizeof(second), rx_queue_front()->sz);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(second, rx_queue_front()->data, sizeof(second));
+  TEST_ASSERT_EQUAL(0, sx1278._rxLost);
+}
+
+// The CRC error flag does not tell which frame failed: the walked ones are
+// dropped with it
+void test_service_rx_crc_error_drops_walked(){
+  uint8_t first[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 3, 7, 'a', 'b', 0 };
+  uint8_t second[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, 4, 8, 'c', 'd', 'e', 0 };
+  uint32_t gap = (uint32_t)fake_time_on_air_us(fake_radio_modulation(), sizeof(first)) + 5000;
+
+  TEST_ASSERT_EQUAL(0, sx1278.rearm());
+  fake_send(first, sizeof(first), 1000, fake_radio_modulation(), -80, 8, true);
+  fake_send(second, sizeof(second), 1000 + gap);
+  fake_sleep_us(2 * gap + 10000);
+  TEST_ASSERT_EQUAL(0, sx1278.serviceRx());
+  TEST_ASSERT_EQUAL(1, sx1278._rxLost);
+  TEST_ASSERT_EQUAL(1, sx1278._rxCrcErrors);
+
+  // The next frame is read from where the bad ones ended
+  fake_send(first, sizeof(first), 1000);
+  fake_sleep_us(gap + 5000);
+  TEST_ASSERT_EQUAL(1, sx1278.serviceRx());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(first, rx_queue_front()->data, sizeof(first));
+}
+
+// A frame longer than a queue slot is counted, not copied
+void test_service_rx_drops_oversize(){
+  uint8_t frame[RX_FRAME_MAX + 1];
+  uint32_t airtime;
+
+  memset(frame, 'x', sizeof(frame));
+  frame[0] = LORA_ADDRESS;
+  frame[1] = LORA_SEND_TO_ADDRESS;
+  frame[2] = 5;
+  frame[3] = sizeof(frame);
+  airtime = (uint32_t)fake_time_on_air_us(fake_radio_modulation(), sizeof(frame));
+  TEST_ASSERT_EQUAL(0, sx1278.rearm());
+  fake_send(frame, sizeof(frame), 1000);
+  fake_sleep_us(airtime + 5000);
+  TEST_ASSERT_EQUAL(0, sx1278.serviceRx());
+  TEST_ASSERT_EQUAL(1, rx_queue_dropped);
+}
+
+// The frame of the other node is left queued by the block ACK wait, the
+// next receive gets it
+void test_window_ack_wait_keeps_other_frames(){
+  uint8_t message[] = { 'w', 'i', 'n' };
+  lora_async *op;
+
+  fake_set_tx_handler(window_peer_tx);
+  op = sx1278.sendWindowAsync(LORA_SEND_TO_ADDRESS, message, sizeof(message), sizeof(message));
+  TEST_ASSERT_NOT_NULL(op);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(1, tx_count);
+  TEST_ASSERT_EQUAL(1, rx_queue_count());
+
+  op = sx1278.receivePacketAsync(1000, false);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(9, sx1278.packet_received.src);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&other_frame[4], rx_buf, 3);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_dio_decoded_with_mapping);
+  RUN_TEST(test_wait_irq_wakes_on_rx_done);
+  RUN_TEST(test_wait_irq_times_out);
+  RUN_TEST(test_receive_sleeps_until_rx_done);
+  RUN_TEST(test_receive_async_sends_ack);
+  RUN_TEST(test_send_async_gets_ack);
+  RUN_TEST(test_send_async_without_ack_fails);
+  RUN_TEST(test_service_rx_walks_fifo);
+  RUN_TEST(test_service_rx_crc_error_drops_walked);
+  RUN_TEST(test_service_rx_drops_oversize);
+  RUN_TEST(test_window_ack_wait_keeps_other_frames);
+  return UNITY_END();
+}
@@ -0,0 +1,227 @@
+// Low-power listening (LORA_LOW_POWER_RX) on the fake radio: the receiver
+// runs the loop of main.cpp, the test sends it data packets with the wake
+// preamble at random phases of its CAD cycle. The time spent in each radio
+// mode gives the average current against continuous Rx.
+#include <stdio.h>
+#include <unity.h>
+#include "definitions.hpp"
+#undef LORA_LOW_POWER_RX
+#define LORA_LOW_POWER_RX 1
+#include "host/units.cpp"
+
+// Supply current of each mode of fake_mode (mA), SX1276/77/78/79 datasheet
+// 2.5.1, 433 MHz band, LnaBoost off. Tx is the RFO at +13 dBm, an upper bound
+// for the 'I' power of LORA_POWER. The MCU is not counted.
+static const double mode_ma[8] = {
+  0.0002,  // sleep
+  1.6,     // standby
+  5.8,     // FSTX
+  29.0,    // Tx
+  5.8,     // FSRX
+  10.8,    // Rx continuous
+  10.8,    // Rx single
+  10.8     // CAD
+};
+
+struct mode_time{
+  uint64_t ns[8];
+};
+
+static uint8_t rx_buf[MAX_PAYLOAD];
+static lora_async *op;
+static uint32_t received;
+static uint32_t acks;
+static uint32_t seed;
+
+static void dio_isr(uint8_t dio){
+  sx1278.dioInterrupt(dio);
+}
+
+static void peer_tx(const fake_frame &frame){
+  if((frame.length == ACK_LENGTH) && (frame.data[3] == ACK_MARK)){
+    acks++;
+  }
+}
+
+static mode_time snapshot(){
+  mode_time t;
+
+  for(uint8_t i = 0; i < 8; i++) t.ns[i] = fake_mode_ns[i];
+  return t;
+}
+
+static double average_ma(const mode_time &since){
+  double charge = 0;
+  uint64_t total = 0;
+
+  for(uint8_t i = 0; i < 8; i++){
+    uint64_t ns = fake_mode_ns[i] - since.ns[i];
+    charge += mode_ma[i] * ns;
+    total += ns;
+  }
+  return total ? charge / total : 0;
+}
+
+// One turn of the main loop of main.cpp, without the UART
+static void loop_once(){
+  if(op != 0){
+    if(sx1278.poll()){
+      disable_interrupts();
+      if(sx1278._irqPending == 0) wait_for_interrupt();
+      enable_interrupts();
+      return;
+    }
+    if(op->result == 0) received++;
+    op = 0;
+    sx1278.startListening();
+  }
+  else if(sx1278.lowPowerListen()){
+    op = sx1278.receivePacketAsync(10000, false);
+  }
+  else{
+    disable_interrupts();
+    if(sx1278._irqPending == 0) wait_for_interrupt();
+    enable_interrupts();
+  }
+}
+
+static void run_ms(uint32_t ms){
+  uint32_t start = millis();
+
+  while(millis() - start < ms) loop_once();
+}
+
+// A data packet of the peer, with the preamble its sender stretches
+static void peer_send(uint8_t packnum, uint32_t delay_us){
+  uint8_t frame[] = { LORA_ADDRESS, LORA_SEND_TO_ADDRESS, packnum, 10, 'h', 'e', 'l', 'l', 'o', 0 };
+  fake_modulation mod = fake_radio_modulation();
+
+  mod.preamble = sx1278.wakePreamble();
+  fake_send(frame, sizeof(frame), delay_us, mod);
+}
+
+static uint32_t random_us(uint32_t limit){
+  seed = seed * 1103515245 + 12345;
+  return (uint32_t)(((uint64_t)(seed >> 8) * limit) >> 24);
+}
+
+void setUp(){
+  sx1278 = SX1278();
+  fake_reset();
+  while(rx_queue_count() != 0) rx_queue_pop();
+  fake_set_dio_handler(dio_isr);
+  fake_set_tx_handler(peer_tx);
+  setup_radio(sx1278, rx_buf);
+  op = 0;
+  received = 0;
+  acks = 0;
+  seed = 1;
+}
+
+void tearDown(){
+}
+
+// The preamble covers a sleep interval and one CAD
+void test_wake_preamble(){
+  double t_sym_us = fake_symbol_us(fake_radio_modulation());
+
+  TEST_ASSERT_GREATER_OR_EQUAL((LORA_LPRX_INTERVAL_MS + sx1278.cadTime()) * 1000.0,
+                               (sx1278.wakePreamble() - LORA_PREAMBLE) * t_sym_us);
+}
+
+// Idle: continuous Rx, then sleep and a CAD every LORA_LPRX_INTERVAL_MS.
+// The charge of one wake up gives the current of other intervals.
+void test_idle_current(){
+  const uint32_t span_ms = 60000;
+  mode_time t;
+  double rx_ma;
+  double lp_ma;
+  double wake_nc;   // charge of one CAD cycle, sleep excluded (mA * ns)
+  uint32_t cads;
+  char msg[128];
+
+  sx1278.receive();
+  t = snapshot();
+  run_ms(10000);
+  rx_ma = average_ma(t);
+
+  sx1278.startListening();
+  run_ms(LORA_LPRX_INTERVAL_MS);   // first CAD
+  t = snapshot();
+  run_ms(span_ms);
+  lp_ma = average_ma(t);
+  cads = (uint32_t)((fake_mode_ns[FAKE_CAD] - t.ns[FAKE_CAD]) / (2 * fake_symbol_us(fake_radio_modulation()) * 1000) + 0.5);
+
+  snprintf(msg, sizeof(msg), "continuous Rx %.2f mA, low-power Rx %.3f mA every %u ms (%u CADs in %u s)",
+           rx_ma, lp_ma, LORA_LPRX_INTERVAL_MS, (unsigned)cads, (unsigned)(span_ms / 1000));
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL(0, received);
+  TEST_ASSERT_UINT32_WITHIN(1, span_ms / LORA_LPRX_INTERVAL_MS, cads);
+  TEST_ASSERT_LESS_THAN(rx_ma / 20, lp_ma);
+
+  wake_nc = 0;
+  for(uint8_t i = FAKE_STANDBY; i < 8; i++){
+    wake_nc += mode_ma[i] * (fake_mode_ns[i] - t.ns[i]);
+  }
+  wake_nc /= cads;
+  {
+    static const uint32_t intervals[] = { 100, 250, 500, 1000, 2000, 5000 };
+    for(uint8_t i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++){
+      double ma = (wake_nc + mode_ma[FAKE_SLEEP] * intervals[i] * 1e6) / (intervals[i] * 1e6);
+      snprintf(msg, sizeof(msg), "  interval %4u ms: %.3f mA (%.2f%% of continuous Rx), latency up to %u ms",
+               (unsigned)intervals[i], ma, 100 * ma / rx_ma, (unsigned)(intervals[i] + sx1278.cadTime()));
+      TEST_MESSAGE(msg);
+    }
+  }
+}
+
+// Packets at random phases of the CAD cycle are all heard and ACKed, the
+// CAD that hears the preamble keeps the long preamble for the Rx
+void test_receives_wake_packets(){
+  const uint8_t packets = 12;
+  const uint32_t period_ms = 10000;
+  uint32_t latency_max = 0;
+  mode_time t;
+  double lp_ma;
+  double sender_ms;
+  char msg[160];
+
+  sx1278.receive();
+  sx1278.startListening();
+  t = snapshot();
+  for(uint8_t i = 0; i < packets; i++){
+    uint64_t cycle_ns = fake_now_ns();
+    uint32_t delay_us = random_us(period_ms / 2 * 1000);
+    uint64_t start_ns = cycle_ns + (uint64_t)delay_us * 1000;
+    uint32_t before = received;
+
+    peer_send(i, delay_us);
+    while((received == before) && (fake_now_ns() < start_ns + (uint64_t)period_ms * 1000000 / 2)){
+      loop_once();
+    }
+    TEST_ASSERT_EQUAL_UINT32(before + 1, received);
+    TEST_ASSERT_EQUAL(i, sx1278.packet_received.packnum);
+    if((fake_now_ns() - start_ns) / 1000000 > latency_max){
+      latency_max = (uint32_t)((fake_now_ns() - start_ns) / 1000000);
+    }
+    run_ms(period_ms - (uint32_t)((fake_now_ns() - cycle_ns) / 1000000));
+  }
+  lp_ma = average_ma(t);
+  sender_ms = LoraMode<LORA_MODE>::timeOnAirUs(10, sx1278.wakePreamble()) / 1000.0;
+
+  snprintf(msg, sizeof(msg), "%u packets: %.3f mA average, longest latency %u ms; sender %.0f ms on air a packet (%.0f ms without the wake preamble)",
+           packets, lp_ma, (unsigned)latency_max, sender_ms, LoraMode<LORA_MODE>::timeOnAirUs(10) / 1000.0);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(packets, acks);
+  TEST_ASSERT_EQUAL_UINT32(0, fake_frames_lost);
+  TEST_ASSERT_LESS_OR_EQUAL(LORA_LPRX_INTERVAL_MS + sx1278.cadTime() + sender_ms + 2 * LORA_ACK_GUARD_MS, latency_max);
+  TEST_ASSERT_LESS_THAN(mode_ma[FAKE_RXCONT] / 2, lp_ma);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_wake_preamble);
+  RUN_TEST(test_idle_current);
+  RUN_TEST(test_receives_wake_packets);
+  return UNITY_END();
+}
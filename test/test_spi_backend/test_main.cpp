@@ -0,0 +1,195 @@
+// The two SPI backends side by side against the same fake SX1278: bit-bang
+// (spi.cpp, SPI_BACKEND 0) and SPI1 + DMA (spi_hw.cpp, SPI_BACKEND 1, built
+// in namespace hw below, with the spi_write()/spi_read() of spi.cpp).
+// Both must move the same bytes; the figures compare the register accesses
+// the core makes and the bus time of each transfer. The pins of SPI1 do not
+// matter here, only NSS is a GPIO and it is the same for both.
+#include <stdio.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+#undef SPI_BACKEND
+#define SPI_BACKEND 1
+#define SPI_AF GPIO_AF0
+namespace hw{
+#include "spi_hw.cpp"
+
+void spi_write(uint8_t reg, uint8_t sz, uint8_t *data){
+  spi_write_start(reg);
+  spi_burst_write(sz, data);
+  spi_burst_end();
+}
+
+void spi_read(uint8_t reg, uint8_t sz, uint8_t *data){
+  spi_read_start(reg);
+  spi_burst_read(sz, data);
+  spi_burst_end();
+}
+}
+#undef SPI_BACKEND
+#define SPI_BACKEND 0
+
+// Bus time of a byte: bit-bang as modelled in fake_radio.cpp, SPI1 at
+// 48MHz / 8 (spi_setup() of spi_hw.cpp)
+#define BITBANG_BYTE_NS 2170
+#define SPI1_BYTE_NS    1333
+
+struct cost{
+  uint32_t accesses;  // peripheral registers touched by the core
+  uint32_t bus_ns;
+};
+
+static uint8_t out[200];
+static uint8_t back[200];
+
+static void use_bitbang(){
+  fake_set_spi_byte_ns(BITBANG_BYTE_NS);
+}
+
+static void use_spi1(){
+  fake_set_spi_byte_ns(SPI1_BYTE_NS);
+}
+
+static void begin(){
+  fake_spi_clear();
+}
+
+static cost end(uint64_t t0){
+  cost c;
+
+  c.accesses = fake_cpu.gpio + fake_cpu.spi + fake_cpu.dma;
+  c.bus_ns = (uint32_t)(fake_now_ns() - t0);
+  return c;
+}
+
+void setUp(){
+  fake_reset();
+  use_bitbang();
+  spi_setup();
+  hw::spi_setup();
+  for(uint8_t i = 0; i < sizeof(out); i++) out[i] = (uint8_t)(i * 13 + 1);
+}
+
+void tearDown(){
+}
+
+// Data written by one backend is read back by the other
+void test_same_bytes(){
+  for(uint8_t length = 1; length < sizeof(out); length += 9){
+    use_spi1();
+    hw::spi_write8(REG_FIFO_ADDR_PTR, 0x00);
+    hw::spi_write(REG_FIFO, length, out);
+    use_bitbang();
+    spi_write8(REG_FIFO_ADDR_PTR, 0x00);
+    spi_read(REG_FIFO, length, back);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, length);
+
+    spi_write8(REG_FIFO_ADDR_PTR, 0x00);
+    spi_write(REG_FIFO, length, back);
+    use_spi1();
+    hw::spi_write8(REG_FIFO_ADDR_PTR, 0x00);
+    for(uint8_t i = 0; i < length; i++) back[i] = 0;
+    hw::spi_read(REG_FIFO, length, back);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(out, back, length);
+  }
+
+  use_spi1();
+  hw::spi_write8(REG_SYNC_WORD, 0x34);
+  TEST_ASSERT_EQUAL_HEX8(0x34, fake_reg(REG_SYNC_WORD));
+  TEST_ASSERT_EQUAL_HEX8(0x12, hw::spi_read8(REG_VERSION));
+  use_bitbang();
+  TEST_ASSERT_EQUAL_HEX8(0x34, spi_read8(REG_SYNC_WORD));
+}
+
+static cost bitbang_register_read(){
+  uint64_t t0 = fake_now_ns();
+
+  use_bitbang();
+  begin();
+  TEST_ASSERT_EQUAL_HEX8(0x12, spi_read8(REG_VERSION));
+  return end(t0);
+}
+
+static cost spi1_register_read(){
+  uint64_t t0 = fake_now_ns();
+
+  use_spi1();
+  begin();
+  TEST_ASSERT_EQUAL_HEX8(0x12, hw::spi_read8(REG_VERSION));
+  return end(t0);
+}
+
+static cost bitbang_burst(uint8_t length){
+  uint64_t t0 = fake_now_ns();
+
+  use_bitbang();
+  begin();
+  spi_read(REG_FIFO, length, back);
+  return end(t0);
+}
+
+static cost spi1_burst(uint8_t length){
+  uint64_t t0 = fake_now_ns();
+
+  use_spi1();
+  begin();
+  hw::spi_read(REG_FIFO, length, back);
+  return end(t0);
+}
+
+void test_register_read(){
+  cost bb = bitbang_register_read();
+  cost sp = spi1_register_read();
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "register read: bit-bang %u accesses %u ns, SPI1 %u accesses %u ns",
+           (unsigned)bb.accesses, (unsigned)bb.bus_ns, (unsigned)sp.accesses, (unsigned)sp.bus_ns);
+  TEST_MESSAGE(msg);
+  // 16 bits of 3 GPIO accesses each (MOSI or MISO, SCK up, SCK down) + NSS
+  TEST_ASSERT_GREATER_OR_EQUAL(48, bb.accesses);
+  TEST_ASSERT_LESS_THAN(bb.accesses / 2, sp.accesses);
+}
+
+// DMA setup is paid once: the core's work no longer grows with the burst
+void test_fifo_burst(){
+  cost bb64 = bitbang_burst(64);
+  cost sp64 = spi1_burst(64);
+  cost bb200 = bitbang_burst(200);
+  cost sp200 = spi1_burst(200);
+  char msg[128];
+
+  snprintf(msg, sizeof(msg), "64-byte FIFO burst: bit-bang %u accesses %u ns, SPI1 + DMA %u accesses %u ns",
+           (unsigned)bb64.accesses, (unsigned)bb64.bus_ns, (unsigned)sp64.accesses, (unsigned)sp64.bus_ns);
+  TEST_MESSAGE(msg);
+  snprintf(msg, sizeof(msg), "200-byte FIFO burst: bit-bang %u accesses %u ns, SPI1 + DMA %u accesses %u ns",
+           (unsigned)bb200.accesses, (unsigned)bb200.bus_ns, (unsigned)sp200.accesses, (unsigned)sp200.bus_ns);
+  TEST_MESSAGE(msg);
+
+  TEST_ASSERT_GREATER_OR_EQUAL(64 * 8 * 3, bb64.accesses);
+  TEST_ASSERT_EQUAL_UINT32(sp64.accesses, sp200.accesses);
+  TEST_ASSERT_LESS_THAN(bb64.accesses / 10, sp64.accesses);
+  TEST_ASSERT_LESS_THAN(bb200.bus_ns, sp200.bus_ns);
+}
+
+// Under SPI_DMA_MIN the bytes are polled: the cost follows the length
+void test_short_burst_polled(){
+  cost sp4 = spi1_burst(4);
+  cost sp7 = spi1_burst(SPI_DMA_MIN - 1);
+  cost sp8 = spi1_burst(SPI_DMA_MIN);
+  char msg[96];
+
+  snprintf(msg, sizeof(msg), "SPI1 burst of 4/%u/%u bytes: %u/%u/%u accesses", SPI_DMA_MIN - 1, SPI_DMA_MIN,
+           (unsigned)sp4.accesses, (unsigned)sp7.accesses, (unsigned)sp8.accesses);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_THAN(sp7.accesses, sp4.accesses);
+  TEST_ASSERT_EQUAL_UINT32(sp8.accesses, spi1_burst(100).accesses);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_same_bytes);
+  RUN_TEST(test_register_read);
+  RUN_TEST(test_fifo_burst);
+  RUN_TEST(test_short_burst_polled);
+  return UNITY_END();
+}
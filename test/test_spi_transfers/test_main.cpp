@@ -0,0 +1,151 @@
+// SPI traffic of the burst API and SpiBatch, and of a packet written to and
+// read from the FIFO: the number of chip selects must not grow with the payload.
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+static uint8_t rx_buf[MAX_PAYLOAD];
+
+static void dio_isr(uint8_t dio){
+  sx1278.dioInterrupt(dio);
+}
+
+void setUp(){
+  sx1278 = SX1278();
+  fake_reset();
+  fake_set_dio_handler(dio_isr);
+  setup_radio(sx1278, rx_buf);
+  fake_spi_clear();
+}
+
+void tearDown(){
+}
+
+void test_burst_is_one_transaction(){
+  uint8_t data[32];
+  uint8_t back[32];
+
+  for(uint8_t i = 0; i < sizeof(data); i++) data[i] = i * 7;
+  spi_write8(REG_FIFO_ADDR_PTR, 0x40);
+  fake_spi_clear();
+
+  spi_write(REG_FIFO, sizeof(data), data);
+  TEST_ASSERT_EQUAL_UINT32(1, fake_spi.transactions);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(data) + 1, fake_spi.bytes);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(data), fake_spi.fifo_bytes);
+  for(uint8_t i = 0; i < sizeof(data); i++) TEST_ASSERT_EQUAL_HEX8(data[i], fake_fifo(0x40 + i));
+
+  spi_write8(REG_FIFO_ADDR_PTR, 0x40);
+  fake_spi_clear();
+  spi_read(REG_FIFO, sizeof(back), back);
+  TEST_ASSERT_EQUAL_UINT32(1, fake_spi.transactions);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, back, sizeof(data));
+}
+
+// A split burst (header, then the rest) keeps NSS low: still one transaction
+void test_split_burst_is_one_transaction(){
+  uint8_t head[4] = { 1, 2, 3, 4 };
+  uint8_t tail[6] = { 5, 6, 7, 8, 9, 10 };
+
+  spi_write8(REG_FIFO_ADDR_PTR, 0x00);
+  fake_spi_clear();
+  spi_write_start(REG_FIFO);
+  spi_burst_write(sizeof(head), head);
+  spi_burst_write(sizeof(tail), tail);
+  spi_burst_end();
+  TEST_ASSERT_EQUAL_UINT32(1, fake_spi.transactions);
+  TEST_ASSERT_EQUAL_UINT32(10, fake_spi.fifo_bytes);
+  TEST_ASSERT_EQUAL_HEX8(10, fake_fifo(9));
+}
+
+// Consecutive addresses go in one burst, a rewrite replaces the value
+void test_batch_one_transaction_per_run(){
+  SpiBatch batch;
+
+  batch.write(REG_MODEM_CONFIG2, 0x94);
+  batch.write(REG_MODEM_CONFIG1, 0x72);
+  batch.write(REG_PREAMBLE_MSB_LORA, 0x00);
+  batch.write(REG_PREAMBLE_LSB_LORA, 0x0C);
+  batch.write(REG_MODEM_CONFIG1, 0x78);
+  batch.write(REG_SYNC_WORD, 0x34);
+  TEST_ASSERT_EQUAL(5, batch._count);
+
+  fake_spi_clear();
+  TEST_ASSERT_EQUAL(3, batch.flush());
+  TEST_ASSERT_EQUAL_UINT32(3, fake_spi.transactions);
+  TEST_ASSERT_EQUAL_UINT32(5, fake_spi.reg_writes);
+  TEST_ASSERT_EQUAL_HEX8(0x78, fake_reg(REG_MODEM_CONFIG1));
+  TEST_ASSERT_EQUAL_HEX8(0x94, fake_reg(REG_MODEM_CONFIG2));
+  TEST_ASSERT_EQUAL_HEX8(0x0C, fake_reg(REG_PREAMBLE_LSB_LORA));
+  TEST_ASSERT_EQUAL_HEX8(0x34, fake_reg(REG_SYNC_WORD));
+  TEST_ASSERT_EQUAL(0, batch._count);
+}
+
+static uint32_t set_packet_transactions(uint8_t length){
+  char payload[MAX_PAYLOAD];
+
+  for(uint8_t i = 0; i < length; i++) payload[i] = 'a' + i % 26;
+  payload[length] = '\0';
+  fake_spi_clear();
+  TEST_ASSERT_EQUAL(0, sx1278.setPacket(LORA_SEND_TO_ADDRESS, payload));
+  TEST_ASSERT_EQUAL_UINT32(OFFSET_PAYLOADLENGTH + length, fake_spi.fifo_bytes);
+  return fake_spi.transactions;
+}
+
+void test_set_packet_transactions_independent_of_length(){
+  uint32_t small = set_packet_transactions(4);
+  uint32_t large;
+  char msg[48];
+
+  setUp();
+  large = set_packet_transactions(200);
+  snprintf(msg, sizeof(msg), "setPacket: %u SPI transactions", (unsigned)large);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(small, large);
+}
+
+static uint32_t get_packet_transactions(uint8_t length){
+  uint8_t frame[MAX_PAYLOAD];
+
+  frame[0] = LORA_ADDRESS;
+  frame[1] = LORA_SEND_TO_ADDRESS;
+  frame[2] = 3;
+  frame[3] = OFFSET_PAYLOADLENGTH + length;
+  for(uint8_t i = 0; i < length; i++) frame[4 + i] = 'A' + i % 26;
+  frame[4 + length] = 0;
+
+  TEST_ASSERT_EQUAL(0, sx1278.receive());
+  fake_send(frame, OFFSET_PAYLOADLENGTH + length, 0);
+  fake_sleep_us((uint64_t)fake_time_on_air_us(fake_radio_modulation(), OFFSET_PAYLOADLENGTH + length) + 1000);
+  fake_spi_clear();
+  TEST_ASSERT_TRUE(sx1278.availableData(1000));
+  TEST_ASSERT_EQUAL(0, sx1278.getPacket(0));
+  TEST_ASSERT_EQUAL(length, sx1278._payloadlength);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(&frame[4], rx_buf, length);
+  // the destination byte, then the whole frame
+  TEST_ASSERT_EQUAL_UINT32(1 + OFFSET_PAYLOADLENGTH + length, fake_spi.fifo_bytes);
+  return fake_spi.transactions;
+}
+
+void test_get_packet_transactions_independent_of_length(){
+  uint32_t small = get_packet_transactions(4);
+  uint32_t large;
+  char msg[48];
+
+  setUp();
+  large = get_packet_transactions(200);
+  snprintf(msg, sizeof(msg), "availableData + getPacket: %u SPI transactions", (unsigned)large);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(small, large);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_is_one_transaction);
+  RUN_TEST(test_split_burst_is_one_transaction);
+  RUN_TEST(test_batch_one_transaction_per_run);
+  RUN_TEST(test_set_packet_transactions_independent_of_length);
+  RUN_TEST(test_get_packet_transactions_independent_of_length);
+  return UNITY_END();
+}
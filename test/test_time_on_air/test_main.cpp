@@ -0,0 +1,106 @@
+// loraTimeOnAirUs() (integer, quarter symbols) against the floating point
+// formula of the SX1276/77/78/79 datasheet (4.1.1.7), over every modulation.
+#include <math.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+static uint8_t rx_buf[MAX_PAYLOAD];
+
+// Bandwidths of the datasheet (RegModemConfig1), in Hz
+static const double datasheet_hz[10] = {
+  7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+};
+
+static double semtech_us(uint8_t sf, uint8_t bw, uint8_t cr, uint16_t length,
+                         bool explicit_header, bool crc, bool ldro, uint16_t preamble){
+  double t_sym = pow(2, sf) / datasheet_hz[bw] * 1e6;
+  double t_preamble = (preamble + 4.25) * t_sym;
+  double num = 8.0 * length - 4.0 * sf + 28 + 16 * crc - 20 * (!explicit_header);
+  double n_payload = 8 + fmax(ceil(num / (4.0 * (sf - 2 * ldro))) * (cr + 4), 0);
+
+  return t_preamble + n_payload * t_sym;
+}
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+// Every SF, BW, CR, header and CRC setting, lengths 1..255
+void test_matches_formula(){
+  static const uint16_t preambles[3] = { 6, 8, 1000 };
+  uint32_t cases = 0;
+
+  for(uint8_t sf = SF_6; sf <= SF_12; sf++)
+  for(uint8_t bw = BW_7_8; bw <= BW_500; bw++)
+  for(uint8_t cr = CR_5; cr <= CR_8; cr++)
+  for(uint8_t flags = 0; flags < 8; flags++)
+  for(uint8_t p = 0; p < 3; p++)
+  for(uint16_t length = 1; length <= 255; length++){
+    bool explicit_header = flags & 1;
+    bool crc = flags & 2;
+    bool ldro = flags & 4;
+    double expected = semtech_us(sf, bw, cr, length, explicit_header, crc, ldro, preambles[p]);
+    uint32_t got = loraTimeOnAirUs(sf, bw, cr, length, explicit_header, crc, ldro, preambles[p]);
+
+    // rounded down, the float has a few ulp of error
+    if((got > expected + 1e-6 * expected) || (got + 1 <= expected - 1e-6 * expected)){
+      TEST_ASSERT_EQUAL_UINT32((uint32_t)expected, got);
+    }
+    cases++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(7 * 10 * 4 * 8 * 3 * 255, cases);
+}
+
+// Values of the Semtech LoRa calculator
+void test_known_values(){
+  TEST_ASSERT_EQUAL_UINT32(56576, loraTimeOnAirUs(SF_7, BW_125, CR_5, 20, true, true, false));
+  TEST_ASSERT_EQUAL_UINT32(991232, loraTimeOnAirUs(SF_12, BW_125, CR_5, 10, true, true, true));
+  TEST_ASSERT_EQUAL_UINT32(1318912, LoraMode<1>::timeOnAirUs(16));
+}
+
+// The driver's figure is the time the radio really stays in Tx
+static fake_frame last_tx;
+
+static void peer_tx(const fake_frame &frame){
+  last_tx = frame;
+}
+
+static void dio_isr(uint8_t dio){
+  sx1278.dioInterrupt(dio);
+}
+
+void test_driver_matches_air(){
+  uint8_t payload[40] = { 0 };
+  lora_async *op;
+
+  sx1278 = SX1278();
+  fake_reset();
+  fake_set_dio_handler(dio_isr);
+  fake_set_tx_handler(peer_tx);
+  setup_radio(sx1278, rx_buf);
+
+  TEST_ASSERT_EQUAL_UINT32(LoraMode<LORA_MODE>::timeOnAirUs(sizeof(payload) + OFFSET_PAYLOADLENGTH),
+                           sx1278.timeOnAirUs(sizeof(payload)));
+
+  op = sx1278.sendPacketAsync(LORA_SEND_TO_ADDRESS, payload, sizeof(payload), 0, false);
+  TEST_ASSERT_NOT_NULL(op);
+  while(sx1278.poll()){
+    wait_for_interrupt();
+  }
+  TEST_ASSERT_EQUAL(sizeof(payload) + OFFSET_PAYLOADLENGTH, last_tx.length);
+  TEST_ASSERT_UINT32_WITHIN(1, sx1278.timeOnAirUs(sizeof(payload)), (last_tx.end_ns - last_tx.start_ns) / 1000);
+
+  // The ACK wait is sized for the longest ACK, a block ACK
+  uint16_t t_ack = (LoraMode<LORA_MODE>::timeOnAirUs(ACK_LENGTH + 1) + 999) / 1000 + 1;
+  TEST_ASSERT_EQUAL_UINT16(sx1278.ackDelay() + t_ack + (t_ack >> 3) + 2 * LORA_ACK_GUARD_MS, sx1278.ackWaitTime());
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_matches_formula);
+  RUN_TEST(test_known_values);
+  RUN_TEST(test_driver_matches_air);
+  return UNITY_END();
+}
@@ -0,0 +1,225 @@
+// Throughput of a message sent stop-and-wait (one ACK per packet) and with the
+// selective repeat window (one block ACK per burst), over a link losing a
+// fraction of the frames (data and ACKs alike). Both ends run the driver, each
+// on its own radio: the receiver acknowledges through poll() and reassembles
+// the windowed message. The losses come from seeded generators so every run
+// gives the same figures.
+#include <stdio.h>
+#include <unity.h>
+#include "host/units.cpp"
+
+#define MESSAGE_LEN 1200
+#define CHUNK       60
+#define RUNS        8
+
+static SX1278 receiver;
+static lora_async *rx_op;
+static uint8_t rx_buf[2][MAX_PAYLOAD];
+static uint8_t message[MESSAGE_LEN];
+static uint8_t got[MESSAGE_LEN];
+static uint16_t got_len;
+static int16_t got_packnum;
+
+static uint32_t seed;
+static uint16_t loss_permille;
+
+static uint16_t rand16(){
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7FFF;
+}
+
+static bool link(uint8_t, uint8_t, fake_frame &){
+  return (rand16() % 1000) >= loss_permille;
+}
+
+static void sender_isr(uint8_t dio){
+  sx1278.dioInterrupt(dio);
+}
+
+static void receiver_isr(uint8_t dio){
+  receiver.dioInterrupt(dio);
+}
+
+// The RX queue of rx_queue.cpp is one per node on the target: each node gets
+// its own back while it runs
+struct node_queue{
+  rx_frame frames[RX_QUEUE_LEN];
+  uint8_t head;
+  uint8_t cnt;
+};
+static node_queue queues[2];
+static uint8_t running;
+
+static void run_node(uint8_t node){
+  if(node != running){
+    memcpy(queues[running].frames, rx_queue, sizeof(rx_queue));
+    queues[running].head = rx_queue_head;
+    queues[running].cnt = rx_queue_cnt;
+    memcpy(rx_queue, queues[node].frames, sizeof(rx_queue));
+    rx_queue_head = queues[node].head;
+    rx_queue_cnt = queues[node].cnt;
+    running = node;
+  }
+  fake_select(node);
+}
+
+static void start(uint16_t loss, uint32_t run_seed){
+  sx1278 = SX1278();
+  receiver = SX1278();
+  fake_reset();
+  while(rx_queue_count() != 0) rx_queue_pop();
+  queues[0].cnt = queues[1].cnt = 0;
+  running = 0;
+  fake_set_link_handler(link);
+
+  run_node(1);
+  fake_set_dio_handler(receiver_isr);
+  setup_radio(receiver, rx_buf[1], LORA_SEND_TO_ADDRESS);
+  TEST_ASSERT_EQUAL(0, receiver.setRetries(MAX_RETRIES));
+  receiver.setWindowBuffer(got, sizeof(got));
+  rx_op = receiver.receivePacketAsync(MAX_TIMEOUT, true);
+  TEST_ASSERT_NOT_NULL(rx_op);
+  run_node(0);
+  fake_set_dio_handler(sender_isr);
+  setup_radio(sx1278, rx_buf[0]);
+  TEST_ASSERT_EQUAL(0, sx1278.setRetries(MAX_RETRIES));
+
+  seed = run_seed;
+  loss_permille = loss;
+  for(uint16_t i = 0; i < MESSAGE_LEN; i++) got[i] = 0;
+  got_len = 0;
+  got_packnum = -1;
+}
+
+// Stop-and-wait packets are put one after the other, a retry whose ACK was
+// lost comes again with the same packet number
+static void deliver(){
+  const pack &p = receiver.packet_received;
+
+  if(!(p.retry & WINDOW_FRAME) && (p.packnum != got_packnum)){
+    got_packnum = p.packnum;
+    memcpy(&got[got_len], p.data, receiver._payloadlength);
+    got_len += receiver._payloadlength;
+  }
+}
+
+// Both nodes until the send completes, the receiver listening again after
+// each packet
+static void run(lora_async *op){
+  bool busy = true;
+
+  TEST_ASSERT_NOT_NULL(op);
+  while(busy){
+    run_node(0);
+    busy = sx1278.poll();
+    run_node(1);
+    if(!receiver.poll()){
+      if(rx_op->result == 0){
+        deliver();
+      }
+      rx_op = receiver.receivePacketAsync(MAX_TIMEOUT, true);
+    }
+    wait_for_interrupt();
+  }
+  run_node(0);
+}
+
+// Goodput in bytes/s, the whole message delivered
+static uint32_t stop_and_wait(uint16_t loss, uint32_t run_seed){
+  uint64_t t0;
+  lora_async *op;
+
+  start(loss, run_seed);
+  t0 = fake_now_ns();
+  for(uint16_t offset = 0; offset < MESSAGE_LEN; offset += CHUNK){
+    op = sx1278.sendPacketAsync(LORA_SEND_TO_ADDRESS, &message[offset], CHUNK, 0, true);
+    run(op);
+    TEST_ASSERT_EQUAL(0, op->result);
+  }
+  TEST_ASSERT_EQUAL(MESSAGE_LEN, got_len);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(message, got, MESSAGE_LEN);
+  return (uint32_t)(MESSAGE_LEN * 1000000000ULL / (fake_now_ns() - t0));
+}
+
+static uint32_t windowed(uint16_t loss, uint8_t size, uint32_t run_seed){
+  uint64_t t0;
+  lora_async *op;
+
+  start(loss, run_seed);
+  TEST_ASSERT_EQUAL(0, sx1278.setWindowSize(size));
+  t0 = fake_now_ns();
+  op = sx1278.sendWindowAsync(LORA_SEND_TO_ADDRESS, message, MESSAGE_LEN, CHUNK);
+  run(op);
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(MESSAGE_LEN, receiver.windowMessage());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(message, got, MESSAGE_LEN);
+  return (uint32_t)(MESSAGE_LEN * 1000000000ULL / (fake_now_ns() - t0));
+}
+
+void setUp(){
+  for(uint16_t i = 0; i < MESSAGE_LEN; i++) message[i] = (uint8_t)(i * 31 + 7);
+}
+
+void tearDown(){
+}
+
+// Mean goodput over RUNS messages, each with its own loss pattern
+static void compare(uint16_t loss){
+  uint32_t saw = 0;
+  uint32_t win4 = 0;
+  uint32_t win8 = 0;
+  char msg[96];
+
+  for(uint32_t i = 1; i <= RUNS; i++){
+    saw += stop_and_wait(loss, i) / RUNS;
+    win4 += windowed(loss, 4, i) / RUNS;
+    win8 += windowed(loss, 8, i) / RUNS;
+  }
+
+  snprintf(msg, sizeof(msg), "loss %2u%%: stop-and-wait %u B/s, window 4 %u B/s, window 8 %u B/s",
+           loss / 10, (unsigned)saw, (unsigned)win4, (unsigned)win8);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_GREATER_THAN(saw, win4);
+  TEST_ASSERT_GREATER_OR_EQUAL(win4, win8);
+}
+
+void test_no_loss(){
+  compare(0);
+}
+
+void test_loss_10(){
+  compare(100);
+}
+
+void test_loss_20(){
+  compare(200);
+}
+
+// The packets of a window arrive out of order after losses: the message is
+// put back together from their offsets, and only once all of them are in
+void test_reassembly_out_of_order(){
+  lora_async *op;
+
+  start(300, 7);
+  TEST_ASSERT_EQUAL(0, sx1278.setWindowSize(MAX_WINDOW));
+  op = sx1278.sendWindowAsync(LORA_SEND_TO_ADDRESS, message, MESSAGE_LEN, CHUNK);
+  run(op);
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(MESSAGE_LEN, receiver.windowMessage());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(message, got, MESSAGE_LEN);
+
+  // A second message starts over in the same buffer
+  op = sx1278.sendWindowAsync(LORA_SEND_TO_ADDRESS, message, 100, CHUNK);
+  run(op);
+  TEST_ASSERT_EQUAL(0, op->result);
+  TEST_ASSERT_EQUAL(100, receiver.windowMessage());
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_no_loss);
+  RUN_TEST(test_loss_10);
+  RUN_TEST(test_loss_20);
+  RUN_TEST(test_reassembly_out_of_order);
+  return UNITY_END();
+}